@@ -0,0 +1,49 @@
+/************************************
+ * bench.h - timing and reporting shared by the
+ *           microbenchmarks
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#ifndef CHIP8_BENCH_H
+#define CHIP8_BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * seconds on the monotonic clock
+ */
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * the column headings for bench_compare, naming the library's
+ * way and the obvious one it is measured against
+ */
+static inline void bench_header(const char *ours, const char *naive) {
+    printf("%-24s %13s %13s %8s\n", "", ours, naive, "speedup");
+}
+
+/**
+ * `count` operations done both ways, in `ours` and `naive`
+ * seconds: the time per operation each way, and how many
+ * times faster the library's way is
+ */
+static inline void bench_compare(const char *what, double count, double ours, double naive) {
+    printf("%-24s %10.2f ns %10.2f ns %7.2fx\n", what, ours * 1e9 / count, naive * 1e9 / count, naive / ours);
+}
+
+/**
+ * the same as bench_compare, as millions of operations a
+ * second rather than the time each one takes
+ */
+static inline void bench_rate(const char *what, double count, double ours, double naive) {
+    printf("%-24s %9.2f M/s %9.2f M/s %7.2fx\n", what, count / ours / 1e6, count / naive / 1e6, naive / ours);
+}
+
+#endif
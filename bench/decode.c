@@ -0,0 +1,129 @@
+/************************************
+ * decode.c - instructions per second through the
+ *            decode table against walking optab
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <string.h>
+
+#include "bench.h"
+#include "chip8_internal.h"
+
+#define BENCH_INSTRUCTIONS 200000000
+
+/**
+ * a loop of ALU, memory and subroutine instructions, roughly
+ * what a game executes between frames
+ */
+static const uint8_t program[] = {
+    0x6A, 0x02, // 200: LD VA, 2
+    0x7A, 0x01, // 202: ADD VA, 1
+    0x8A, 0xB4, // 204: ADD VA, VB
+    0x3A, 0x10, // 206: SE VA, 0x10
+    0xA3, 0x00, // 208: LD I, 0x300
+    0xC1, 0x0F, // 20A: RND V1, 0x0F
+    0x81, 0x26, // 20C: SHR V1, V2
+    0x22, 0x1A, // 20E: CALL 0x21A
+    0xF1, 0x1E, // 210: ADD I, V1
+    0x4A, 0x00, // 212: SNE VA, 0
+    0x00, 0xE0, // 214: CLS
+    0x12, 0x02, // 216: JP 0x202
+    0x00, 0x00, // 218
+    0xF1, 0x07, // 21A: LD V1, DT
+    0x80, 0x14, // 21C: ADD V0, V1
+    0xF0, 0x55, // 21E: LD [I], V0
+    0x00, 0xEE, // 220: RET
+};
+
+static volatile uint32_t sink;
+
+/**
+ * how decode worked before the table: every fetched word walks
+ * optab until a mask matches, then has its operands pulled out
+ */
+static chip8_decoded walk(uint16_t word) {
+    chip8_decoded d;
+    int i;
+
+    for (i = 0; optab[i].mnemonic != NULL; i++) {
+        if (optab[i].opr == CHIP8_OPR_IX && (word & optab[i].mask) == optab[i].opcode) {
+            break;
+        }
+    }
+
+    d.vx = (word & CHIP8_OP_MASK_VX8) >> 8;
+    d.vy = (word & CHIP8_OP_MASK_VX4) >> 4;
+    d.slab = word & CHIP8_OP_MASK_LSS;
+
+    if (optab[i].mnemonic == NULL) {
+        d.opcode = CHIP8_OP_ILLEGAL;
+        d.handler = CHIP8_H_ILLEGAL;
+        d.byte = 0x00;
+        return d;
+    }
+
+    d.opcode = optab[i].opcode;
+    d.byte = word & CHIP8_OP_MASK_LSB;
+
+    for (int j = 0; j < 3; j++) {
+        if (optab[i].operands[j] == CHIP8_OP_NIBBLE) {
+            d.byte = word & CHIP8_OP_MASK_LSN;
+        }
+    }
+
+#define X(name, op) if (d.opcode == (op)) d.handler = CHIP8_H_##name;
+    CHIP8_HANDLERS(X)
+#undef X
+
+    return d;
+}
+
+/**
+ * run_switch, decoding by walking optab
+ */
+static uint64_t run_walk(chip8_vm *vm, uint64_t cycles) {
+    uint64_t executed = 0;
+
+    while (!vm->halted && executed < cycles) {
+        uint16_t pc = vm->rs2[CHIP8_PC];
+        uint16_t word = fetch(vm, pc);
+        vm->rs2[CHIP8_PC] = (pc + 2) & CHIP8_ADDRESS_MASK;
+
+        chip8_decoded d = walk(word);
+        execute(vm, &d);
+        executed++;
+    }
+
+    return executed;
+}
+
+int main(void) {
+    static chip8_vm vm;
+
+    chip8_vm_init(&vm);
+    chip8_vm_load_buffer(&vm, program, sizeof(program));
+
+    double start = bench_now();
+    uint64_t executed = run_switch(&vm, BENCH_INSTRUCTIONS);
+    double table = bench_now() - start;
+
+    sink = vm.rs1[CHIP8_V0];
+
+    chip8_vm_reset(&vm);
+    chip8_vm_load_buffer(&vm, program, sizeof(program));
+
+    // the old way is an order of magnitude slower, so it runs a tenth
+    // as many instructions and its time is scaled up to match
+    start = bench_now();
+    uint64_t walked = run_walk(&vm, BENCH_INSTRUCTIONS / 10);
+    double naive = (bench_now() - start) * executed / walked;
+
+    sink = vm.rs1[CHIP8_V0];
+    chip8_vm_free(&vm);
+
+    bench_header("table", "optab walk");
+    bench_rate("instructions", executed, table, naive);
+
+    return 0;
+}
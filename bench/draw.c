@@ -0,0 +1,104 @@
+/************************************
+ * draw.c - DXYN microbenchmark, the packed display
+ *          against a byte-per-pixel one
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <string.h>
+
+#include "bench.h"
+#include "chip8_internal.h"
+
+#define SPRITES 4096
+#define ROUNDS 2000
+
+typedef struct {
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint16_t ix;
+} sprite;
+
+/**
+ * the obvious implementation: one byte per pixel and a
+ * test and XOR for every pixel of every sprite row
+ */
+static uint8_t naive[CHIP8_DISPLAY_HEIGHT][CHIP8_DISPLAY_WIDTH];
+
+static uint8_t draw_naive(const chip8_vm *vm, uint8_t x, uint8_t y, uint16_t ix, uint8_t n) {
+    uint8_t hit = 0;
+
+    for (int i = 0; i < n; i++) {
+        uint8_t bits = vm->memory[(ix + i) & CHIP8_ADDRESS_MASK];
+
+        for (int j = 0; j < 8; j++) {
+            if (bits & (0x80 >> j)) {
+                uint8_t *pixel = &naive[(y + i) % CHIP8_DISPLAY_HEIGHT][(x + j) % CHIP8_DISPLAY_WIDTH];
+                hit |= *pixel;
+                *pixel ^= 1;
+            }
+        }
+    }
+
+    return hit;
+}
+
+int main(void) {
+    static sprite sprites[SPRITES];
+    chip8_vm vm;
+    unsigned hits[2] = { 0, 0 };
+    double elapsed[2];
+
+    chip8_vm_init(&vm);
+
+    // random sprite data above the font, random positions and heights
+    for (int i = CHIP8_PROGRAM_START; i < CHIP8_MEMORY_CAPACITY; i++) {
+        vm.memory[i] = rnd(&vm);
+    }
+
+    for (int i = 0; i < SPRITES; i++) {
+        sprites[i].x = rnd(&vm);
+        sprites[i].y = rnd(&vm);
+        sprites[i].n = 1 + rnd(&vm) % 15;
+        sprites[i].ix = CHIP8_PROGRAM_START + rnd(&vm) * 4;
+    }
+
+    elapsed[0] = bench_now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < SPRITES; i++) {
+            hits[0] += draw(&vm, sprites[i].x, sprites[i].y, sprites[i].ix, sprites[i].n);
+        }
+    }
+    elapsed[0] = bench_now() - elapsed[0];
+
+    elapsed[1] = bench_now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < SPRITES; i++) {
+            hits[1] += draw_naive(&vm, sprites[i].x, sprites[i].y, sprites[i].ix, sprites[i].n);
+        }
+    }
+    elapsed[1] = bench_now() - elapsed[1];
+
+    // both displays went through the same sprites in the same order
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < CHIP8_DISPLAY_WIDTH; x++) {
+            if (chip8_vm_pixel(&vm, x, y) != naive[y][x]) {
+                printf("display mismatch at (%d, %d)\n", x, y);
+                return 1;
+            }
+        }
+    }
+
+    if (hits[0] != hits[1]) {
+        printf("collision mismatch: %u vs %u\n", hits[0], hits[1]);
+        return 1;
+    }
+
+    bench_header("packed", "naive");
+    bench_compare("draw, per sprite", (double) ROUNDS * SPRITES, elapsed[0], elapsed[1]);
+
+    chip8_vm_free(&vm);
+
+    return 0;
+}
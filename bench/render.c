@@ -0,0 +1,145 @@
+/************************************
+ * render.c - terminal renderer microbenchmark, redrawing
+ *            what changed against redrawing everything
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "chip8_internal.h"
+
+#define FRAMES 20000
+#define IPF 10
+
+typedef struct {
+    const char *name;
+    const uint16_t *words;
+    size_t count;
+} rom;
+
+// random 5-row font sprites all over the low resolution screen
+static const uint16_t sprites[] = {
+    0xC03F, 0xC11F, 0xC20F, 0xF229, 0xD015, 0xC03F, 0xC11F, 0xD015,
+    0x1200,
+};
+
+// a counter in the corner, redrawn now and then, as games keep score
+static const uint16_t score[] = {
+    0x6A00, 0x6B00, 0x6C3C, 0xFC15, 0xFD07, 0x3D00, 0x1208, 0xF929,
+    0xDAB5, 0x7901, 0xF929, 0xDAB5, 0x1204,
+};
+
+// 16x16 sprites and scrolling in high resolution
+static const uint16_t sprites_hires[] = {
+    0x00FF, 0xA200, 0xC07F, 0xC13F, 0xD010, 0xC07F, 0xC13F, 0xD01F,
+    0x00C1, 0x00FB, 0x00FC, 0x1202,
+};
+
+#define ROM(name, words) { name, words, sizeof(words) / sizeof(words[0]) }
+
+static const rom roms[] = {
+    ROM("sprites", sprites),
+    ROM("score", score),
+    ROM("sprites-hires", sprites_hires),
+};
+
+/**
+ * the obvious implementation: every frame, home the cursor and
+ * print every cell, a line at a time
+ */
+static void naive_frame(const chip8_vm *vm, int fd, uint64_t *bytes, uint64_t *syscalls) {
+    static const char *const glyphs[4] = { " ", "\xe2\x96\x84", "\xe2\x96\x80", "\xe2\x96\x88" };
+    unsigned width = vm->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    unsigned height = vm->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    char line[CHIP8_HIRES_WIDTH * 3 + 16];
+
+    *bytes += write(fd, "\x1b[H", 3);
+    (*syscalls)++;
+
+    for (unsigned y = 0; y < height; y += 2) {
+        size_t size = 0;
+
+        for (unsigned x = 0; x < width; x++) {
+            const char *glyph = glyphs[chip8_vm_pixel(vm, x, y) << 1 | chip8_vm_pixel(vm, x, y + 1)];
+
+            size += strlen(strcpy(&line[size], glyph));
+        }
+
+        line[size++] = '\n';
+        *bytes += write(fd, line, size);
+        (*syscalls)++;
+    }
+}
+
+int main(void) {
+    int fd = open("/dev/null", O_WRONLY);
+
+    if (fd < 0) {
+        printf("cannot open /dev/null\n");
+        return 1;
+    }
+
+    bench_header("diffed", "whole");
+
+    for (size_t r = 0; r < sizeof(roms) / sizeof(roms[0]); r++) {
+        uint8_t image[64];
+        chip8_render render;
+        chip8_vm vm;
+        uint64_t bytes = 0, syscalls = 0;
+        double elapsed[2];
+
+        for (size_t i = 0; i < roms[r].count; i++) {
+            image[2 * i] = roms[r].words[i] >> 8;
+            image[2 * i + 1] = roms[r].words[i];
+        }
+
+        if (!chip8_render_init(&render, fd)) {
+            printf("out of memory\n");
+            return 1;
+        }
+
+        // the same frames both ways, the machine run outside the timing
+        chip8_vm_init(&vm);
+        chip8_vm_load_buffer(&vm, image, roms[r].count * 2);
+        elapsed[0] = 0;
+
+        for (int f = 0; f < FRAMES; f++) {
+            chip8_vm_run(&vm, IPF);
+            chip8_vm_tick(&vm);
+
+            double start = bench_now();
+            chip8_render_frame(&render, &vm);
+            elapsed[0] += bench_now() - start;
+        }
+
+        chip8_vm_free(&vm);
+        chip8_vm_init(&vm);
+        chip8_vm_load_buffer(&vm, image, roms[r].count * 2);
+        elapsed[1] = 0;
+
+        for (int f = 0; f < FRAMES; f++) {
+            chip8_vm_run(&vm, IPF);
+            chip8_vm_tick(&vm);
+
+            double start = bench_now();
+            naive_frame(&vm, fd, &bytes, &syscalls);
+            elapsed[1] += bench_now() - start;
+        }
+
+        // what goes to the terminal matters as much as the time
+        bench_compare(roms[r].name, FRAMES, elapsed[0], elapsed[1]);
+        printf("%-24s %10.1f B  %10.1f B\n", "  bytes per frame", (double) render.bytes / FRAMES, (double) bytes / FRAMES);
+        printf("%-24s %10.2f    %10.2f\n", "  writes per frame", (double) render.syscalls / FRAMES, (double) syscalls / FRAMES);
+
+        chip8_render_free(&render);
+        chip8_vm_free(&vm);
+    }
+
+    close(fd);
+
+    return 0;
+}
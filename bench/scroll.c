@@ -0,0 +1,109 @@
+/************************************
+ * scroll.c - SUPER-CHIP scroll microbenchmark, the
+ *            packed display against a byte-per-pixel one
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <string.h>
+
+#include "bench.h"
+#include "chip8_internal.h"
+
+#define FRAMES 200000
+
+/**
+ * the obvious implementation: one byte per pixel, every
+ * pixel of the screen copied on every scroll
+ */
+static uint8_t naive[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH];
+
+static void naive_down(uint8_t n) {
+    for (int y = CHIP8_HIRES_HEIGHT - 1; y >= 0; y--) {
+        for (int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+            naive[y][x] = y >= n ? naive[y - n][x] : 0;
+        }
+    }
+}
+
+static void naive_right(void) {
+    for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+        for (int x = CHIP8_HIRES_WIDTH - 1; x >= 0; x--) {
+            naive[y][x] = x >= 4 ? naive[y][x - 4] : 0;
+        }
+    }
+}
+
+static void naive_left(void) {
+    for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+        for (int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+            naive[y][x] = x + 4 < CHIP8_HIRES_WIDTH ? naive[y][x + 4] : 0;
+        }
+    }
+}
+
+int main(void) {
+    chip8_vm vm;
+    double elapsed[2];
+
+    chip8_vm_init(&vm);
+    set_hires(&vm, true);
+
+    // the same random screen in both, redrawn every 64 frames so
+    // there is still something left to scroll
+    for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+        for (int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+            if (rnd(&vm) & 1) {
+                vm.display[y][x >> 6] |= 1ull << (63 - (x & 63));
+            }
+        }
+    }
+
+    uint64_t screen[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+    memcpy(screen, vm.display, sizeof(screen));
+
+    // a frame scrolls the screen down a row and right, then left
+    elapsed[0] = bench_now();
+    for (int f = 0; f < FRAMES; f++) {
+        if (f % 64 == 0) {
+            memcpy(vm.display, screen, sizeof(screen));
+        }
+
+        scroll_down(&vm, 1);
+        scroll_right(&vm);
+        scroll_left(&vm);
+    }
+    elapsed[0] = bench_now() - elapsed[0];
+
+    elapsed[1] = bench_now();
+    for (int f = 0; f < FRAMES; f++) {
+        if (f % 64 == 0) {
+            for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+                for (int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+                    naive[y][x] = screen[y][x >> 6] >> (63 - (x & 63)) & 1;
+                }
+            }
+        }
+
+        naive_down(1);
+        naive_right();
+        naive_left();
+    }
+    elapsed[1] = bench_now() - elapsed[1];
+
+    for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+        for (int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+            if (chip8_vm_pixel(&vm, x, y) != naive[y][x]) {
+                printf("display mismatch at (%d, %d)\n", x, y);
+                return 1;
+            }
+        }
+    }
+
+    bench_header("packed", "naive");
+    bench_compare("scroll, per frame", FRAMES, elapsed[0], elapsed[1]);
+
+    chip8_vm_free(&vm);
+
+    return 0;
+}
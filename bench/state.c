@@ -0,0 +1,176 @@
+/************************************
+ * state.c - save and restore microbenchmark, states
+ *           sharing memory against whole copies
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <string.h>
+
+#include "bench.h"
+#include "chip8_internal.h"
+
+#define BRANCHES 1000000
+#define STEPS 64
+
+/**
+ * a search from a known state: count up in V0 and store it to
+ * memory as BCD and as a register dump, a few bytes per trip
+ */
+static const uint16_t program[] = {
+    0x7001, // loop: ADD V0, 1
+    0xA300, //       LD I, 0x300
+    0xF033, //       LD B, V0
+    0xF355, //       LD [I], V3
+    0x1200, //       JP loop
+};
+
+/**
+ * the obvious implementation: everything a program can see,
+ * copied whole both ways
+ */
+typedef struct {
+    uint8_t rs1[CHIP8_GP_REGS];
+    uint16_t rs2[CHIP8_SP_REGS];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint8_t memory[CHIP8_MEMORY_CAPACITY];
+    uint64_t display[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+    uint16_t keys;
+    uint32_t rng;
+    bool hires;
+    bool halted;
+} naive_state;
+
+static void naive_save(const chip8_vm *vm, naive_state *state) {
+    memcpy(state->rs1, vm->rs1, sizeof(state->rs1));
+    memcpy(state->rs2, vm->rs2, sizeof(state->rs2));
+    memcpy(state->stack, vm->stack, sizeof(state->stack));
+    memcpy(state->memory, vm->memory, sizeof(state->memory));
+    memcpy(state->display, vm->display, sizeof(state->display));
+    state->keys = vm->keys;
+    state->rng = vm->rng;
+    state->hires = vm->hires;
+    state->halted = vm->halted;
+}
+
+static void naive_restore(chip8_vm *vm, const naive_state *state) {
+    memcpy(vm->rs1, state->rs1, sizeof(vm->rs1));
+    memcpy(vm->rs2, state->rs2, sizeof(vm->rs2));
+    memcpy(vm->stack, state->stack, sizeof(vm->stack));
+    memcpy(vm->memory, state->memory, sizeof(vm->memory));
+    memcpy(vm->display, state->display, sizeof(vm->display));
+    vm->keys = state->keys;
+    vm->rng = state->rng;
+    vm->hires = state->hires;
+    vm->halted = state->halted;
+    invalidate(vm, 0, CHIP8_MEMORY_CAPACITY);
+}
+
+int main(void) {
+    static naive_state naive[3];
+    chip8_state root = { 0 }, branch = { 0 }, copy = { 0 };
+    uint8_t rom[sizeof(program)];
+    chip8_vm vm, clone;
+    uint32_t checksums[2];
+    double elapsed[2][3];
+
+    for (size_t i = 0; i < sizeof(program) / 2; i++) {
+        rom[2 * i] = program[i] >> 8;
+        rom[2 * i + 1] = program[i];
+    }
+
+    chip8_vm_init(&vm);
+    chip8_vm_load_buffer(&vm, rom, sizeof(rom));
+    chip8_vm_run(&vm, 1000);
+
+    if (!chip8_vm_save(&vm, &root) || !chip8_vm_fork(&vm, &clone)) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    naive_save(&vm, &naive[0]);
+
+    // a search from the root: go back to it, run a little way on
+    // and save, the way a search expands a node; both ways must
+    // end up in the same place
+    for (int b = 0; b < 1000; b++) {
+        chip8_vm_restore(&vm, &root);
+        chip8_vm_run(&vm, STEPS);
+        chip8_vm_save(&vm, &branch);
+    }
+
+    checksums[0] = chip8_vm_checksum(&vm);
+
+    for (int b = 0; b < 1000; b++) {
+        naive_restore(&vm, &naive[0]);
+        chip8_vm_run(&vm, STEPS);
+        naive_save(&vm, &naive[1]);
+    }
+
+    checksums[1] = chip8_vm_checksum(&vm);
+    chip8_vm_restore(&clone, &branch);
+
+    if (checksums[0] != checksums[1] || chip8_vm_checksum(&clone) != checksums[0]) {
+        printf("memory mismatch: %08x %08x %08x\n", checksums[0], checksums[1], chip8_vm_checksum(&clone));
+        return 1;
+    }
+
+    // restore: back and forth between the root and the branch,
+    // which differ in a page of memory and the registers
+    elapsed[0][0] = bench_now();
+    for (int b = 0; b < BRANCHES; b++) {
+        chip8_vm_restore(&vm, b & 1 ? &branch : &root);
+    }
+    elapsed[0][0] = bench_now() - elapsed[0][0];
+
+    elapsed[1][0] = bench_now();
+    for (int b = 0; b < BRANCHES; b++) {
+        naive_restore(&vm, &naive[b & 1]);
+    }
+    elapsed[1][0] = bench_now() - elapsed[1][0];
+
+    // save: after a store to memory, as a program would make
+    chip8_vm_restore(&vm, &root);
+
+    elapsed[0][1] = bench_now();
+    for (int b = 0; b < BRANCHES; b++) {
+        vm.memory[0x300 + (b & 7)]++;
+        invalidate(&vm, 0x300 + (b & 7), 1);
+        chip8_vm_save(&vm, &branch);
+    }
+    elapsed[0][1] = bench_now() - elapsed[0][1];
+
+    elapsed[1][1] = bench_now();
+    for (int b = 0; b < BRANCHES; b++) {
+        vm.memory[0x300 + (b & 7)]++;
+        invalidate(&vm, 0x300 + (b & 7), 1);
+        naive_save(&vm, &naive[1]);
+    }
+    elapsed[1][1] = bench_now() - elapsed[1][1];
+
+    // fork: a second state, to go on from separately
+    elapsed[0][2] = bench_now();
+    for (int b = 0; b < BRANCHES; b++) {
+        chip8_state_fork(&root, &copy);
+        chip8_state_release(&copy);
+    }
+    elapsed[0][2] = bench_now() - elapsed[0][2];
+
+    elapsed[1][2] = bench_now();
+    for (int b = 0; b < BRANCHES; b++) {
+        memcpy(&naive[2], &naive[b & 1], sizeof(naive_state));
+    }
+    elapsed[1][2] = bench_now() - elapsed[1][2];
+
+    bench_header("shared", "naive");
+    bench_compare("restore", BRANCHES, elapsed[0][0], elapsed[1][0]);
+    bench_compare("save", BRANCHES, elapsed[0][1], elapsed[1][1]);
+    bench_compare("fork", BRANCHES, elapsed[0][2], elapsed[1][2]);
+
+    chip8_state_release(&root);
+    chip8_state_release(&branch);
+    chip8_vm_free(&clone);
+    chip8_vm_free(&vm);
+
+    return 0;
+}
@@ -0,0 +1,451 @@
+/************************************
+ * suite.c - benchmark suite: a corpus of synthetic
+ *           ROMs on every core, and generated sources
+ *           through the assembler, reported as JSON
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "chip8_internal.h"
+
+#ifndef CHIP8_BENCH_VERSION
+#define CHIP8_BENCH_VERSION "unknown"
+#endif
+
+#define INSTRUCTIONS 5000000
+#define REPEAT 3
+#define IPF 1000
+
+/**
+ * the ROM corpus
+ *
+ * each one an endless loop hammering one part of the machine,
+ * written out as instruction words
+ */
+typedef struct {
+    const char *name;
+    const uint16_t *words;
+    size_t count;
+} rom;
+
+// 8XYN arithmetic on every register pair, round and round
+static const uint16_t alu[] = {
+    0x6001, 0x6102, 0x6203, 0x6304, 0x6405, 0x6506, 0x6607, 0x6708,
+    0x8014, 0x8125, 0x8236, 0x8301, 0x8452, 0x8563, 0x8674, 0x8705,
+    0x8016, 0x811E, 0x8237, 0x8343, 0x8454, 0x8565, 0x8670, 0x8781,
+    0x7001, 0x3000, 0x1210, 0x1200,
+};
+
+// random 5-row font sprites all over the low resolution screen
+static const uint16_t sprites[] = {
+    0xC03F, 0xC11F, 0xC20F, 0xF229, 0xD015, 0xC03F, 0xC11F, 0xD015,
+    0x1200,
+};
+
+// 16x16 sprites and scrolling in high resolution
+static const uint16_t sprites_hires[] = {
+    0x00FF, 0xA200, 0xC07F, 0xC13F, 0xD010, 0xC07F, 0xC13F, 0xD01F,
+    0x00C1, 0x00FB, 0x00FC, 0x1202,
+};
+
+// recursion 15 calls deep, unwinding back to the top, with a
+// count of the rounds so that no two trips look the same
+static const uint16_t calls[] = {
+    0x7101, 0x2206, 0x1200, 0x7001, 0x300F, 0x2206, 0x70FF, 0x00EE,
+};
+
+// block stores and loads of every register through I
+static const uint16_t memory[] = {
+    0xA400, 0xFF55, 0xFF65, 0xA500, 0xFF55, 0xF765, 0xF01E, 0xFF55,
+    0xF033, 0xF265, 0x7001, 0x1200,
+};
+
+// a short delay, waited out by polling DT
+static const uint16_t timers[] = {
+    0x6003, 0xF015, 0xF107, 0x3100, 0x1204, 0x7201, 0x1200,
+};
+
+#define ROM(name, words) { name, words, sizeof(words) / sizeof(words[0]) }
+
+static const rom roms[] = {
+    ROM("alu", alu),
+    ROM("sprites", sprites),
+    ROM("sprites-hires", sprites_hires),
+    ROM("calls", calls),
+    ROM("memory", memory),
+    ROM("timers", timers),
+};
+
+static const struct {
+    const char *name;
+    chip8_core core;
+} cores[] = {
+    { "switch", CHIP8_CORE_SWITCH },
+    { "threaded", CHIP8_CORE_THREADED },
+    { "block", CHIP8_CORE_BLOCK },
+    { "jit", CHIP8_CORE_JIT },
+};
+
+/**
+ * the generated assembler sources, in lines
+ */
+static const int sources[] = { 2000, 20000, 100000 };
+
+typedef struct {
+    bool ok;
+    uint64_t executed;
+    uint64_t skipped;
+    double seconds;
+} rom_result;
+
+/**
+ * run one ROM on one core for `instructions`, a frame of IPF
+ * instructions at a time with the timers ticking in between
+ */
+static rom_result run_rom(const rom *r, chip8_core core, uint64_t instructions) {
+    rom_result result = { false, 0, 0, 0 };
+    uint8_t program[CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START];
+    chip8_vm vm;
+
+    for (size_t i = 0; i < r->count; i++) {
+        program[2 * i] = r->words[i] >> 8;
+        program[2 * i + 1] = r->words[i] & 0xFF;
+    }
+
+    chip8_vm_init(&vm);
+
+    if (!chip8_vm_set_core(&vm, core)) {
+        chip8_vm_free(&vm);
+        return result;
+    }
+
+    chip8_vm_load_buffer(&vm, program, 2 * r->count);
+
+    double start = bench_now();
+
+    while (!vm.halted && result.executed < instructions) {
+        result.executed += chip8_vm_run(&vm, IPF);
+        chip8_vm_tick(&vm);
+    }
+
+    result.seconds = bench_now() - start;
+    result.skipped = vm.idled;
+    result.ok = !vm.halted;
+
+    chip8_vm_free(&vm);
+
+    return result;
+}
+
+/**
+ * run a ROM in a child process, so that its peak RSS is its own
+ */
+static bool fork_rom(const rom *r, chip8_core core, uint64_t instructions, rom_result *result, long *rss) {
+    int fds[2];
+    struct rusage usage;
+    int status;
+
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        rom_result child = run_rom(r, core, instructions);
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == sizeof(child) ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    bool ok = pid > 0 && read(fds[0], result, sizeof(*result)) == sizeof(*result);
+
+    close(fds[0]);
+
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return false;
+    }
+
+    *rss = usage.ru_maxrss;
+
+    return ok && result->ok;
+}
+
+/**
+ * write a source of `lines` lines that looks like a real
+ * program: labels, comments, every kind of instruction, and
+ * data. Labels are placed all the way through, but only the
+ * ones within the 4K address space are jumped to
+ */
+static bool generate(const char *path, int lines) {
+    FILE *out = fopen(path, "w");
+    uint32_t seed = 0x2545F491;
+    int labels = 0, reachable = 0;
+    unsigned address = CHIP8_PROGRAM_START;
+
+    if (out == NULL) {
+        return false;
+    }
+
+    fprintf(out, "; generated by bench-suite, %d lines\n", lines);
+
+    for (int i = 1; i < lines; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        unsigned x = seed >> 8 & 0xF, y = seed >> 12 & 0xF, nn = seed >> 16 & 0xFF;
+        unsigned target = reachable > 0 ? (seed >> 4) % reachable : 0;
+
+        if (i % 32 == 1) {
+            fprintf(out, "l%d:\n", labels++);
+
+            if (address < CHIP8_MEMORY_CAPACITY) {
+                reachable = labels;
+            }
+
+            continue;
+        }
+
+        switch (seed % 16) {
+            case 0:
+                fprintf(out, "    ; step %d\n", i);
+                continue;
+            case 1:
+                fprintf(out, "    LD V%X, 0x%02x ; load\n", x, nn);
+                break;
+            case 2:
+                fprintf(out, "    ADD V%X, V%X\n", x, y);
+                break;
+            case 3:
+                fprintf(out, "    SE V%X, 0x%02x\n", x, nn);
+                break;
+            case 4:
+                fprintf(out, "    JP l%u\n", target);
+                break;
+            case 5:
+                fprintf(out, "    CALL l%u\n", target);
+                break;
+            case 6:
+                fprintf(out, "    LD I, l%u\n", target);
+                break;
+            case 7:
+                fprintf(out, "    DRW V%X, V%X, %X\n", x, y, nn & 0xF);
+                break;
+            case 8:
+                fprintf(out, "    LD [I], V%X\n", x);
+                break;
+            case 9:
+                fprintf(out, "    LD V%X, DT\n", x);
+                break;
+            case 10:
+                fprintf(out, "    XOR V%X, V%X\n", x, y);
+                break;
+            case 11:
+                fprintf(out, "    SHR V%X, V%X\n", x, y);
+                break;
+            case 12:
+                fprintf(out, "    RND V%X, 0x%02x\n", x, nn);
+                break;
+            case 13:
+                fprintf(out, "    RET\n");
+                break;
+            case 14:
+                fprintf(out, "    DB 0x%02x\n", nn);
+                address--;
+                break;
+            default:
+                fprintf(out, "\n");
+                continue;
+        }
+
+        address += 2;
+    }
+
+    return fclose(out) == 0;
+}
+
+/**
+ * assemble `file` in `dir` with the assembler at `chip8c`,
+ * returns the seconds it took or a negative number on failure
+ */
+static double assemble(const char *chip8c, const char *dir, const char *file, long *rss) {
+    struct rusage usage;
+    int status;
+    double start = bench_now();
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+
+        // the assembler writes its output next to its input
+        if (chdir(dir) != 0 || dup2(null, STDOUT_FILENO) < 0) {
+            _exit(127);
+        }
+
+        execl(chip8c, chip8c, file, (char *) NULL);
+        _exit(127);
+    }
+
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) {
+        return -1;
+    }
+
+    double seconds = bench_now() - start;
+    *rss = usage.ru_maxrss;
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? seconds : -1;
+}
+
+int main(int argc, char **argv) {
+    uint64_t instructions = INSTRUCTIONS;
+    int repeat = REPEAT;
+    const char *chip8c = "build/chip8c";
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:n:o:r:")) != -1) {
+        switch (opt) {
+            case 'a':
+                chip8c = optarg;
+                break;
+            case 'n':
+                instructions = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc || instructions < 1 || repeat < 1) {
+        printf("usage: %s [-a chip8c] [-n instructions] [-o FILE] [-r repeat]\n", argv[0]);
+        return 1;
+    }
+
+    char assembler[PATH_MAX], dir[] = "/tmp/chip8-bench-XXXXXX";
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+
+    if (realpath(chip8c, assembler) == NULL || mkdtemp(dir) == NULL || out == NULL) {
+        printf("Error setting up: %s\n", strerror(errno));
+        return 2;
+    }
+
+    fprintf(out, "{\n  \"version\": \"%s\",\n  \"instructions\": %llu,\n  \"repeat\": %d,\n  \"roms\": [",
+        CHIP8_BENCH_VERSION, (unsigned long long) instructions, repeat);
+
+    bool first = true, failed = false;
+
+    // best of `repeat` runs for every ROM on every core
+    for (size_t i = 0; i < sizeof(roms) / sizeof(roms[0]); i++) {
+        for (size_t c = 0; c < sizeof(cores) / sizeof(cores[0]); c++) {
+            rom_result best = { false, 0, 0, 0 }, result;
+            long rss = 0, peak = 0;
+
+            if (cores[c].core == CHIP8_CORE_JIT && !CHIP8_JIT) {
+                continue;
+            }
+
+            for (int r = 0; r < repeat; r++) {
+                if (!fork_rom(&roms[i], cores[c].core, instructions, &result, &rss)) {
+                    printf("%s on the %s core failed\n", roms[i].name, cores[c].name);
+                    failed = true;
+                    break;
+                }
+
+                if (!best.ok || result.seconds < best.seconds) {
+                    best = result;
+                }
+
+                peak = rss > peak ? rss : peak;
+            }
+
+            if (!best.ok) {
+                continue;
+            }
+
+            double ips = best.executed / best.seconds;
+
+            fprintf(out, "%s\n    { \"rom\": \"%s\", \"core\": \"%s\", \"executed\": %llu, \"skipped\": %llu, "
+                "\"seconds\": %.6f, \"instructions_per_second\": %.0f, \"ns_per_instruction\": %.3f, \"peak_rss_kb\": %ld }",
+                first ? "" : ",", roms[i].name, cores[c].name, (unsigned long long) best.executed,
+                (unsigned long long) best.skipped, best.seconds, ips, 1e9 / ips, peak);
+            fprintf(stderr, "%-14s %-9s %10.2f MIPS %8.3f ns/instruction %8ld KB\n",
+                roms[i].name, cores[c].name, ips / 1e6, 1e9 / ips, peak);
+            first = false;
+        }
+    }
+
+    fprintf(out, "\n  ],\n  \"assembler\": [");
+    first = true;
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        char file[32], path[PATH_MAX];
+        double best = -1;
+        long rss = 0, peak = 0;
+
+        snprintf(file, sizeof(file), "gen%d.ch8", sources[i]);
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+        if (!generate(path, sources[i])) {
+            printf("Error writing %s\n", path);
+            failed = true;
+            break;
+        }
+
+        for (int r = 0; r < repeat; r++) {
+            double seconds = assemble(assembler, dir, file, &rss);
+
+            if (seconds < 0) {
+                printf("Assembling %s failed\n", path);
+                failed = true;
+                break;
+            }
+
+            best = best < 0 || seconds < best ? seconds : best;
+            peak = rss > peak ? rss : peak;
+        }
+
+        unlink(path);
+        path[strlen(path) - 4] = '\0';
+        unlink(path);
+
+        if (best < 0) {
+            continue;
+        }
+
+        fprintf(out, "%s\n    { \"source\": \"%s\", \"lines\": %d, \"seconds\": %.6f, \"lines_per_second\": %.0f, \"peak_rss_kb\": %ld }",
+            first ? "" : ",", file, sources[i], best, sources[i] / best, peak);
+        fprintf(stderr, "%-24s %10.0f lines/s %8ld KB\n", file, sources[i] / best, peak);
+        first = false;
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    rmdir(dir);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return failed ? 1 : 0;
+}
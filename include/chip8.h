@@ -10,8 +10,11 @@
 /**
  * includes
  */
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 /**
  * general-purpose registers
@@ -63,6 +66,18 @@
  */
 #define CHIP8_MEMORY_CAPACITY 4096
 
+/**
+ * memory layout
+ *
+ * the built-in hexadecimal font sprites live at the
+ * bottom of memory, in the area historically reserved
+ * for the interpreter, and programs are loaded at 0x200
+ */
+#define CHIP8_FONT_START 0x000
+#define CHIP8_FONT_SPRITE_SIZE 5
+#define CHIP8_PROGRAM_START 0x200
+#define CHIP8_ADDRESS_MASK 0x0FFF
+
 /**
  * the stack
  *
@@ -74,27 +89,21 @@
 #define CHIP8_STACK_SIZE 16
 
 /**
- * rs1: register set 1
- * the 16 general purpose registers
- */
-uint8_t rs1[CHIP8_GP_REGS];
-
-/**
- * rs2: register set 2
- * the program counter, index register
- * stack pointer, delay timer and sound timer
- */
-uint16_t rs2[CHIP8_SP_REGS];
-
-/**
- * 4096 main memory
- */
-uint8_t memory[CHIP8_MEMORY_CAPACITY];
-
-/**
- * the 256-bit stack
+ * the display
+ *
+ * CHIP-8 specification has a 64x32 monochrome display,
+ * and SUPER-CHIP adds a 128x64 high resolution mode. It is
+ * kept bit-packed, two 64-bit words per row with the
+ * leftmost pixel in the most significant bit of the first,
+ * so that a sprite row is drawn with a rotate and an XOR.
+ * In low resolution only the first word of the top 32 rows
+ * is used
  */
-uint16_t stack[CHIP8_STACK_SIZE];
+#define CHIP8_DISPLAY_WIDTH 64
+#define CHIP8_DISPLAY_HEIGHT 32
+#define CHIP8_HIRES_WIDTH 128
+#define CHIP8_HIRES_HEIGHT 64
+#define CHIP8_DISPLAY_WORDS (CHIP8_HIRES_WIDTH / 64)
 
 /**
  * the operation code table
@@ -194,313 +203,867 @@ typedef struct {
     chip8_operands operands[3];
 } chip8_operations;
 
-chip8_operations optab[] = {
-    { // CLS -> 00E0
-        "CLS",
-        CHIP8_OP_CLS,
-        CHIP8_OP_MASK_WRD,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // RET -> 00EE
-        "RET",
-        CHIP8_OP_RET,
-        CHIP8_OP_MASK_WRD,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // SCR -> 00FB
-        "SCR",
-        CHIP8_OP_SCR,
-        CHIP8_OP_MASK_WRD,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // SCL -> 00FC
-        "SCL",
-        CHIP8_OP_SCL,
-        CHIP8_OP_MASK_WRD,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // EXIT -> 00FD
-        "EXIT",
-        CHIP8_OP_EXIT,
-        CHIP8_OP_MASK_WRD,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // LOW -> 00FE
-        "LOW",
-        CHIP8_OP_LOW,
-        CHIP8_OP_MASK_WRD,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // HIGH -> 00FF
-        "HIGH",
-        CHIP8_OP_HIGH,
-        CHIP8_OP_MASK_WRD,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // SCD nibble -> 00CN
-        "SCD",
-        CHIP8_OP_SCD,
-        CHIP8_OP_MASK_GSS,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_NIBBLE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // JP addr -> 1NNN
-        "JP",
-        CHIP8_OP_JP,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_SLAB, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // CALL addr -> 2NNN
-        "CALL",
-        CHIP8_OP_CALL,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_SLAB, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // LD I, addr -> ANNN
-        "LD",
-        CHIP8_OP_LD_ADDR,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_IX, CHIP8_OP_SLAB, CHIP8_OP_NONE }
-    },
-    { // JP V0, addr
-        "JP",
-        CHIP8_OP_JP_V0,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG0, CHIP8_OP_SLAB, CHIP8_OP_NONE }
-    },
-    { // SE Vx, byte -> 3XNN
-        "SE",
-        CHIP8_OP_SE_BYTE,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
-    },
-    { // SNE Vx, byte -> 4XNN
-        "SNE",
-        CHIP8_OP_SNE_BYTE,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
-    },
-    { // LD Vx, byte -> 6XNN
-        "LD",
-        CHIP8_OP_LD_BYTE,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
-    },
-    { // ADD Vx, byte -> 7XNN
-        "ADD",
-        CHIP8_OP_ADD_BYTE,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
-    },
-    { // RND Vx, byte -> CXNN
-        "RND",
-        CHIP8_OP_RND_BYTE,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
-    },
-    { // SE Vx, Vy -> 5XY0
-        "SE",
-        CHIP8_OP_SE_REG,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // LD Vx, Vy -> 8XY0
-        "LD",
-        CHIP8_OP_LD_REG,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // OR Vx, Vy -> 8XY1
-        "OR",
-        CHIP8_OP_OR,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // AND Vx, Vy -> 8XY2
-        "AND",
-        CHIP8_OP_AND,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // X0R Vx, Vy -> 8XY3
-        "XOR",
-        CHIP8_OP_XOR,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // ADD Vx, Vy -> 8XY4
-        "ADD",
-        CHIP8_OP_ADD_REG,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // SUB Vx, Vy -> 8XY5
-        "SUB",
-        CHIP8_OP_SUB,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // SHR Vx -> 8XY6
-        "SHR",
-        CHIP8_OP_SHR,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // SUBN Vx, Vy -> 8XY7
-        "SUBN",
-        CHIP8_OP_SUBN,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // SHL Vx -> 8XYE
-        "SHL",
-        CHIP8_OP_SHL,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // SNE Vx, Vy -> 9XY0
-        "SNE",
-        CHIP8_OP_SNE_REG,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
-    },
-    { // SKP Vx -> EX9E
-        "SKP",
-        CHIP8_OP_SKP,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // SKNP Vx -> EXA1
-        "SKNP",
-        CHIP8_OP_SKNP,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // LD Vx, DT -> FX07
-        "LD",
-        CHIP8_OP_LD_DT,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_DT, CHIP8_OP_NONE }
-    },
-    { // LD Vx, K -> FX0A
-        "LD",
-        CHIP8_OP_LD_KEY,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_KEY, CHIP8_OP_NONE }
-    },
-    { // LD DT, Vx -> FX15
-        "LD",
-        CHIP8_OP_LD_REG_DT,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_DT, CHIP8_OP_REG8, CHIP8_OP_NONE }
-    },
-    { // LD ST, Vx -> FX18
-        "LD",
-        CHIP8_OP_LD_REG_ST,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_ST, CHIP8_OP_REG8, CHIP8_OP_NONE }
-    },
-    { // ADD I, Vx -> FX1E
-        "ADD",
-        CHIP8_OP_ADD_REG_IX,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_IX, CHIP8_OP_REG8, CHIP8_OP_NONE }
-    },
-    { // LD F, Vx -> FX29
-        "LD",
-        CHIP8_OP_LD_SPRITE,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_SPRITE, CHIP8_OP_REG8, CHIP8_OP_NONE }
-    },
-    { // LD B, Vx -> FX33
-        "LD",
-        CHIP8_OP_LDS_BCD,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_BCD, CHIP8_OP_REG8, CHIP8_OP_NONE }
-    },
-    { // LD [I], Vx -> FX55
-        "LD",
-        CHIP8_OP_LDS_REGS,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_IXR, CHIP8_OP_REG8, CHIP8_OP_NONE }
-    },
-    { // LD Vx, [I] -> FX65
-        "LD",
-        CHIP8_OP_LD_REGS,
-        CHIP8_OP_MASK_EXX,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_IXR, CHIP8_OP_NONE }
-    },
-    { // DRW Vx, Vy, 0 -> DXY0
-        "DRW",
-        CHIP8_OP_DRW_EXT,
-        CHIP8_OP_MASK_EXT,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NULL }
-    },
-    { // DRW Vx, Vy, nibble -> DXYN
-        "DRW",
-        CHIP8_OP_DRW_NIBBLE,
-        CHIP8_OP_MASK_GSN,
-        CHIP8_OPR_IX,
-        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NIBBLE }
-    },
-    { // DB byte -> NN -- assembler directive
-        "DB",
-        CHIP8_OP_DB,
-        CHIP8_OP_MASK_GSB,
-        CHIP8_OPR_DR,
-        { CHIP8_OP_BYTE, CHIP8_OP_NONE, CHIP8_OP_NONE }
-    },
-    { // Sentinal to indicate end of optab
-        NULL, 0, 0, 0, { 0 }
-    }
-};
+extern chip8_operations optab[];
+
+/**
+ * pre-decoded instruction
+ *
+ * the interpreter builds one of these for every possible
+ * 16-bit instruction word at startup, so that decoding an
+ * instruction is a single indexed load
+ */
+#define CHIP8_DECODE_TABLE_SIZE 65536
+#define CHIP8_OP_ILLEGAL        0xFFFF
+
+/**
+ * execution handlers
+ *
+ * one dense id per distinct CHIP8_OP_* opcode so that the
+ * interpreter cores can dispatch through a table instead of
+ * a switch over sparse opcode values
+ */
+#define CHIP8_HANDLERS(X) \
+    X(ILLEGAL, CHIP8_OP_ILLEGAL) \
+    X(CLS, CHIP8_OP_CLS) \
+    X(RET, CHIP8_OP_RET) \
+    X(SCR, CHIP8_OP_SCR) \
+    X(SCL, CHIP8_OP_SCL) \
+    X(EXIT, CHIP8_OP_EXIT) \
+    X(LOW, CHIP8_OP_LOW) \
+    X(HIGH, CHIP8_OP_HIGH) \
+    X(SCD, CHIP8_OP_SCD) \
+    X(JP, CHIP8_OP_JP) \
+    X(CALL, CHIP8_OP_CALL) \
+    X(LD_ADDR, CHIP8_OP_LD_ADDR) \
+    X(JP_V0, CHIP8_OP_JP_V0) \
+    X(SE_BYTE, CHIP8_OP_SE_BYTE) \
+    X(SNE_BYTE, CHIP8_OP_SNE_BYTE) \
+    X(LD_BYTE, CHIP8_OP_LD_BYTE) \
+    X(ADD_BYTE, CHIP8_OP_ADD_BYTE) \
+    X(RND_BYTE, CHIP8_OP_RND_BYTE) \
+    X(SE_REG, CHIP8_OP_SE_REG) \
+    X(LD_REG, CHIP8_OP_LD_REG) \
+    X(OR, CHIP8_OP_OR) \
+    X(AND, CHIP8_OP_AND) \
+    X(XOR, CHIP8_OP_XOR) \
+    X(ADD_REG, CHIP8_OP_ADD_REG) \
+    X(SUB, CHIP8_OP_SUB) \
+    X(SHR, CHIP8_OP_SHR) \
+    X(SUBN, CHIP8_OP_SUBN) \
+    X(SHL, CHIP8_OP_SHL) \
+    X(SNE_REG, CHIP8_OP_SNE_REG) \
+    X(SKP, CHIP8_OP_SKP) \
+    X(SKNP, CHIP8_OP_SKNP) \
+    X(LD_DT, CHIP8_OP_LD_DT) \
+    X(LD_KEY, CHIP8_OP_LD_KEY) \
+    X(LD_REG_DT, CHIP8_OP_LD_REG_DT) \
+    X(LD_REG_ST, CHIP8_OP_LD_REG_ST) \
+    X(ADD_REG_IX, CHIP8_OP_ADD_REG_IX) \
+    X(LD_SPRITE, CHIP8_OP_LD_SPRITE) \
+    X(LDS_BCD, CHIP8_OP_LDS_BCD) \
+    X(LDS_REGS, CHIP8_OP_LDS_REGS) \
+    X(LD_REGS, CHIP8_OP_LD_REGS) \
+    X(DRW, CHIP8_OP_DRW_NIBBLE)
+
+typedef enum {
+#define X(name, opcode) CHIP8_H_##name,
+    CHIP8_HANDLERS(X)
+#undef X
+    CHIP8_H_COUNT
+} chip8_handler;
+
+typedef struct {
+    uint16_t opcode; // CHIP8_OP_* value, CHIP8_OP_ILLEGAL if none match
+    uint16_t slab; // 12-bit address (NNN)
+    uint8_t byte; // 8-bit immediate (NN), or 4-bit (N) for nibble operands
+    uint8_t vx; // register index X
+    uint8_t vy; // register index Y
+    uint8_t handler; // chip8_handler id of the matching operation
+} chip8_decoded;
 
 /**
  * reserved symbols
  */
-char asm_reserved[][4] = {
-    "V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7", "V8", "V9",
-    "VA", "VB", "VC", "VD", "VE", "VF", "DT", "ST", "I", "[I]",
-    "F", "B", "K", "",
-};
+extern char asm_reserved[][4];
+
+/**
+ * interpreter cores
+ *
+ * the switch core is the straightforward reference
+ * implementation, the threaded core dispatches straight
+ * from handler to handler, the block core additionally
+ * replays pre-decoded basic blocks and the JIT translates
+ * hot blocks to x86-64; all of them must leave the machine
+ * in the same state
+ */
+typedef enum {
+    CHIP8_CORE_SWITCH,
+    CHIP8_CORE_THREADED,
+    CHIP8_CORE_BLOCK,
+    CHIP8_CORE_JIT,
+} chip8_core;
+
+/**
+ * idle loop detection
+ *
+ * a snapshot of the machine taken at a short backward jump,
+ * compared with the machine the next time it reaches the
+ * same jump. If nothing changed, the loop is spinning and
+ * will keep doing so until a timer ticks or a key changes
+ */
+typedef struct {
+    bool armed; // a snapshot is waiting to be compared
+    uint16_t pc; // address of the jump it was taken at
+    uint16_t wait; // backward jumps to let pass before the next snapshot
+    uint16_t backoff; // the current wait after a loop that did work
+    uint8_t rs1[CHIP8_GP_REGS];
+    uint16_t rs2[CHIP8_SP_REGS];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint16_t keys;
+    uint32_t rng;
+    uint32_t writes;
+} chip8_idle_probe;
+
+/**
+ * execution traces
+ *
+ * while a machine is traced, every instruction it runs is
+ * written as one fixed-size record into a ring buffer of its
+ * own, which a background thread drains to a file behind a
+ * chip8_trace_header. Records hold the instruction as fetched
+ * and decoded, and the registers after it ran, with a bit set
+ * in `changed` for each one it changed: bits 0-15 for V0-VF,
+ * CHIP8_TRACE_RS2(r) for the special-purpose ones other than
+ * PC, whose new value is the next record's `pc`
+ */
+#define CHIP8_TRACE_MAGIC "C8TR"
+#define CHIP8_TRACE_VERSION 1
+#define CHIP8_TRACE_RECORDS (1 << 16) // ring buffer capacity, a power of two
+#define CHIP8_TRACE_RS2(r) (1u << (CHIP8_GP_REGS + (r)))
+
+typedef struct {
+    char magic[4]; // CHIP8_TRACE_MAGIC
+    uint16_t version; // CHIP8_TRACE_VERSION
+    uint16_t size; // sizeof(chip8_trace_record)
+} chip8_trace_header;
+
+typedef struct {
+    uint64_t seq; // instructions run since tracing started, including ones skipped idle
+    uint16_t pc;
+    uint16_t word; // the instruction word as fetched
+    uint16_t opcode; // decoded fields, as in chip8_decoded
+    uint16_t slab;
+    uint8_t vx;
+    uint8_t vy;
+    uint8_t byte;
+    uint8_t sp; // registers after the instruction
+    uint32_t changed;
+    uint16_t ix;
+    uint8_t dt;
+    uint8_t st;
+    uint8_t v[CHIP8_GP_REGS];
+    uint16_t keys; // keypad the instruction saw
+    uint8_t halted;
+    uint8_t hires;
+} chip8_trace_record;
+
+/**
+ * execution profiles
+ *
+ * while a machine is profiled it counts the instructions it
+ * runs by opcode class (handler id) and by address, and the
+ * ones skipped in idle loops by the address of the loop. For
+ * every subroutine it counts the CALLs to it and the
+ * instructions from each CALL to the matching RET, counting
+ * the subroutines it calls and idle loops skipped through,
+ * and every distinct call site goes into a small hash table
+ * of edges. A shadow stack follows CALL and RET; calls still
+ * open when the profile is read have not been added to
+ * `inclusive` yet
+ */
+#define CHIP8_PROFILE_EDGES 256
+
+typedef struct {
+    uint16_t site; // address of the CALL
+    uint16_t target; // the subroutine called
+    uint64_t count;
+} chip8_profile_edge;
+
+typedef struct chip8_profile {
+    uint64_t executed;
+    uint64_t skipped; // instructions skipped idle
+    uint64_t ops[CHIP8_H_COUNT];
+    uint64_t pcs[CHIP8_MEMORY_CAPACITY];
+    uint64_t idle[CHIP8_MEMORY_CAPACITY];
+    uint64_t calls[CHIP8_MEMORY_CAPACITY];
+    uint64_t inclusive[CHIP8_MEMORY_CAPACITY];
+    chip8_profile_edge edges[CHIP8_PROFILE_EDGES];
+    uint64_t lost; // calls from sites that did not fit in `edges`
+    int depth;
+    uint16_t frames[CHIP8_STACK_SIZE]; // the shadow stack, subroutines entered
+    uint64_t entered[CHIP8_STACK_SIZE]; // and `executed` + `skipped` when each was
+} chip8_profile;
+
+/**
+ * saved states
+ *
+ * everything a program can see of a machine, captured to be
+ * restored into it or any other machine later. Main memory is
+ * a single reference counted copy, shared by every state saved
+ * or forked from it until one is saved with stores of its own.
+ * Each of its CHIP8_STATE_PAGES pages of 256 bytes carries a
+ * version, so a machine that remembers the copy it last saved
+ * or restored and the pages it has stored to since restores
+ * only the pages that differ, and saving over a copy nothing
+ * else holds copies only the pages it wrote. States on disk
+ * start with a chip8_state_header, followed by the registers,
+ * stack, keypad, RNG, display and memory, each written out as
+ * it is in memory
+ */
+#define CHIP8_STATE_MAGIC "C8SS"
+#define CHIP8_STATE_VERSION 1
+#define CHIP8_STATE_PAGE_SHIFT 8
+#define CHIP8_STATE_PAGES (CHIP8_MEMORY_CAPACITY >> CHIP8_STATE_PAGE_SHIFT)
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t size; // of what follows
+} chip8_state_header;
+
+typedef struct chip8_state {
+    uint8_t rs1[CHIP8_GP_REGS];
+    uint16_t rs2[CHIP8_SP_REGS];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint16_t keys;
+    uint32_t rng;
+    bool hires;
+    bool halted;
+    uint64_t display[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+    struct chip8_memory *memory; // main memory, shared copy-on-write
+} chip8_state;
+
+/**
+ * the machine
+ *
+ * all of the state of one CHIP-8 machine, so that any
+ * number of them can run side by side in one process
+ */
+typedef struct chip8_vm {
+    /**
+     * rs1: register set 1
+     * the 16 general purpose registers
+     */
+    uint8_t rs1[CHIP8_GP_REGS];
+
+    /**
+     * rs2: register set 2
+     * the program counter, index register
+     * stack pointer, delay timer and sound timer
+     */
+    uint16_t rs2[CHIP8_SP_REGS];
+
+    /**
+     * 4096 main memory
+     */
+    uint8_t memory[CHIP8_MEMORY_CAPACITY];
+
+    /**
+     * the 256-bit stack
+     */
+    uint16_t stack[CHIP8_STACK_SIZE];
+
+    /**
+     * the display, one bit per pixel
+     */
+    uint64_t display[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+    bool hires; // SUPER-CHIP 128x64 mode, switched by HIGH and LOW
+
+    uint16_t keys; // keypad, bit n is set while key n is held down
+    bool halted; // set by EXIT or an illegal instruction
+    uint32_t rng; // xorshift state behind RND
+    chip8_core core;
+
+    bool skip_idle; // fast-forward through idle loops, on by default
+    bool idle; // the last run ended spinning in an idle loop
+    uint64_t idled; // instructions fast-forwarded since the last reset
+    uint32_t writes; // bumped by every store to memory or the display
+    chip8_idle_probe probe;
+
+    uint64_t dirty; // pages of memory stored to since the last save or restore
+    struct chip8_memory *saved; // and what memory held then
+
+    struct chip8_block_cache *cache; // allocated on first use by the block core
+    struct chip8_jit *jit; // allocated when the JIT core is selected
+    struct chip8_trace *trace; // set while the machine is traced
+    chip8_profile *profile; // set while the machine is profiled
+} chip8_vm;
+
+/**
+ * initialize a machine: clear it, install the font and
+ * point PC at the program area. chip8_vm_reset does the
+ * same for a machine that is already initialized, keeping
+ * its core and caches
+ */
+void chip8_vm_init(chip8_vm *vm);
+void chip8_vm_reset(chip8_vm *vm);
+
+/**
+ * release the caches and JIT buffer held by a machine,
+ * and finish its trace
+ */
+void chip8_vm_free(chip8_vm *vm);
+
+/**
+ * select the interpreter core, returns false (and keeps
+ * the current core) if it is not available on this host
+ */
+bool chip8_vm_set_core(chip8_vm *vm, chip8_core core);
+
+/**
+ * load a program from a file or buffer into memory at 0x200
+ * and return the number of bytes loaded, 0 on error
+ */
+uint16_t chip8_vm_load(chip8_vm *vm, const char *path);
+uint16_t chip8_vm_load_buffer(chip8_vm *vm, const uint8_t *program, size_t size);
+
+/**
+ * execute a single instruction, returns false once halted
+ */
+bool chip8_vm_step(chip8_vm *vm);
+
+/**
+ * run at most `cycles` instructions (0 for no limit) on the
+ * selected core, stopping early if the program halts, and
+ * return the number executed
+ *
+ * a loop that goes round without changing anything, or a key
+ * wait with no key down, cannot make progress before the next
+ * timer tick or key change. With skip_idle set, the rest of
+ * the budget is then skipped in whole trips round the loop,
+ * leaving the machine exactly where spinning would have, and
+ * `idle` is set. With no limit the run returns as soon as the
+ * loop is found, so the caller can tick the timers or wait
+ */
+uint64_t chip8_vm_run(chip8_vm *vm, uint64_t cycles);
+
+/**
+ * advance the delay and sound timers by one 60 Hz frame
+ */
+void chip8_vm_tick(chip8_vm *vm);
+
+/**
+ * start tracing a machine to the file at `path`, returns false
+ * if it cannot be created. A traced machine runs on the switch
+ * core whatever core is selected; the others do not look for a
+ * trace at all. chip8_vm_trace_stop waits for every record to
+ * reach the file and closes it
+ */
+bool chip8_vm_trace_start(chip8_vm *vm, const char *path);
+void chip8_vm_trace_stop(chip8_vm *vm);
+
+/**
+ * start adding to the counts in `profile`, which should be
+ * zeroed first, or stop with NULL. Like a traced one, a
+ * profiled machine runs on the switch core
+ */
+void chip8_vm_profile(chip8_vm *vm, chip8_profile *profile);
+
+/**
+ * FNV-1a checksum of main memory
+ */
+uint32_t chip8_vm_checksum(const chip8_vm *vm);
+
+/**
+ * true if the pixel at (x, y) is lit, in the coordinates of
+ * the current resolution; they wrap around the edges of the
+ * display like sprites do
+ */
+bool chip8_vm_pixel(const chip8_vm *vm, int x, int y);
+
+/**
+ * print the registers and checksums of memory and display
+ */
+void chip8_vm_dump(const chip8_vm *vm, FILE *out);
+
+/**
+ * save the state of a machine, replacing whatever `state` held
+ * before; a state must be zeroed before it is first used.
+ * Returns false if out of memory, leaving `state` as it was
+ */
+bool chip8_vm_save(chip8_vm *vm, chip8_state *state);
+
+/**
+ * put a machine back into a saved state. The state is left
+ * as it was, to be restored again as often as needed
+ */
+void chip8_vm_restore(chip8_vm *vm, const chip8_state *state);
+
+/**
+ * start `clone` as a copy of `vm`, on the same core, sharing
+ * the memory of both with any states saved from either until
+ * one of them stores to it. Returns false if out of memory
+ */
+bool chip8_vm_fork(chip8_vm *vm, chip8_vm *clone);
+
+/**
+ * make `clone` a second reference to the same state, without
+ * copying its memory. The clone need not be zeroed
+ */
+void chip8_state_fork(const chip8_state *state, chip8_state *clone);
+
+/**
+ * drop the memory held by a state, leaving it as good as a
+ * zeroed one
+ */
+void chip8_state_release(chip8_state *state);
+
+/**
+ * write a state to a file, or read one back into a zeroed or
+ * released state; false on an I/O error, a file that is not a
+ * state of this version, or writing a state that was never
+ * saved into (zeroed or released)
+ */
+bool chip8_state_write(const chip8_state *state, FILE *out);
+bool chip8_state_read(chip8_state *state, FILE *in);
+
+/**
+ * the rewind buffer
+ *
+ * a history of a machine, one frame at a time, to step back
+ * through. Every `interval` frames a keyframe holds the whole
+ * machine; the frames in between hold only what changed since
+ * the frame before, as the XOR of the two, which is mostly
+ * zeros. Both are run-length encoded into one ring of
+ * `capacity` bytes, and when it is full the oldest keyframe
+ * and the frames that depend on it are dropped together.
+ * Going back to a frame decodes its keyframe and the deltas
+ * from there on, and no others
+ */
+#define CHIP8_REWIND_INTERVAL 60
+
+typedef struct {
+    uint64_t offset; // where the frame starts in the ring
+    uint32_t size;
+    bool key;
+} chip8_rewind_frame;
+
+typedef struct chip8_rewind {
+    uint8_t *data;
+    size_t capacity;
+    size_t head; // where the next frame goes
+    uint32_t interval;
+
+    chip8_rewind_frame *frames; // a ring of its own, oldest at `first`
+    size_t first;
+    size_t count;
+    size_t slots;
+    uint32_t since; // frames pushed since the last keyframe
+
+    struct chip8_image *last; // the frame pushed last, to take deltas against
+    struct chip8_image *next; // scratch space
+    uint8_t *encoded;
+} chip8_rewind;
+
+typedef struct {
+    uint64_t frames; // frames held
+    uint64_t keyframes;
+    size_t bytes; // taken by those frames in the ring
+    size_t capacity;
+} chip8_rewind_stats;
+
+/**
+ * set up a rewind buffer of `capacity` bytes, with a keyframe
+ * every `interval` frames; false if out of memory
+ */
+bool chip8_rewind_init(chip8_rewind *rewind, size_t capacity, uint32_t interval);
+void chip8_rewind_free(chip8_rewind *rewind);
+
+/**
+ * add the machine as it is now as the newest frame, dropping
+ * the oldest ones to make room. False only if one frame does
+ * not fit in the whole ring
+ */
+bool chip8_rewind_push(chip8_rewind *rewind, const chip8_vm *vm);
+
+/**
+ * put the machine back `back` frames before the newest one (0
+ * for the newest) and forget the frames after it, so pushing
+ * carries on from there. False if not that many frames are held
+ */
+bool chip8_rewind_seek(chip8_rewind *rewind, chip8_vm *vm, uint64_t back);
+
+/**
+ * how many frames the buffer holds and how much of it they take
+ */
+void chip8_rewind_measure(const chip8_rewind *rewind, chip8_rewind_stats *stats);
+
+/**
+ * input scripts
+ *
+ * the keypad over a run, as one `FRAME KEYS` line for every
+ * frame where it changed: from the start of frame FRAME on,
+ * the keypad holds the 16-bit mask KEYS. Blank lines and lines
+ * starting with # are skipped. Keys only change between
+ * frames, and frames are counted in instructions, so a script
+ * plays back the same on any core and at any speed. A whole
+ * script is read in before the run starts
+ */
+typedef struct {
+    uint64_t frame;
+    uint16_t keys;
+} chip8_input_event;
+
+typedef struct chip8_input {
+    chip8_input_event *events;
+    size_t count;
+    size_t capacity;
+    size_t next; // the next event to play back
+    uint16_t keys; // the keypad as last recorded
+} chip8_input;
+
+/**
+ * read a script into a zeroed input, or write one out; false
+ * on an I/O error or, reading, a line that is not FRAME KEYS
+ * in frame order
+ */
+bool chip8_input_load(chip8_input *input, const char *path);
+bool chip8_input_save(const chip8_input *input, const char *path);
+void chip8_input_free(chip8_input *input);
+
+/**
+ * note the keypad at the start of `frame`, adding an event if
+ * it changed; false if out of memory
+ */
+bool chip8_input_record(chip8_input *input, uint64_t frame, uint16_t keys);
+
+/**
+ * set the keypad of `vm` as the script has it at the start of
+ * `frame`, for frames played in order
+ */
+void chip8_input_play(chip8_input *input, chip8_vm *vm, uint64_t frame);
+
+/**
+ * the live keypad
+ *
+ * a thread of its own waits on the source with epoll and
+ * queues every change to the keypad; the machine takes them
+ * between frames, without a system call or a lock. The source
+ * is the terminal for "-", where the keys 1234/QWER/ASDF/ZXCV
+ * stand for the COSMAC VIP's 123C/456D/789E/A0BF; a Unix
+ * socket to listen on for "unix:PATH"; or otherwise a FIFO or
+ * file. Drivers on a socket or FIFO send words separated by
+ * whitespace: `+K` to press key K, `-K` to let go of it,
+ * `=MASK` to set all sixteen at once and `q` to end the run
+ */
+typedef struct chip8_keypad chip8_keypad;
+
+/**
+ * open `source` and start the thread, or NULL on failure
+ */
+chip8_keypad *chip8_keypad_start(const char *source);
+
+/**
+ * stop the thread and put the terminal back as it was
+ */
+void chip8_keypad_stop(chip8_keypad *keypad);
+
+/**
+ * bring `vm->keys` up to date with what has been queued,
+ * stopping short of letting go of a key pressed within the same
+ * call; false once the source has closed and the queue is empty
+ */
+bool chip8_keypad_poll(chip8_keypad *keypad, chip8_vm *vm);
+
+/**
+ * sleep until the keypad changes, for a machine waiting on a
+ * key; false if the source has closed instead
+ */
+bool chip8_keypad_wait(chip8_keypad *keypad);
+
+/**
+ * the terminal renderer
+ *
+ * draws the display on an ANSI terminal with Unicode half
+ * blocks, two pixels to a character cell, so the whole of the
+ * low resolution display fits in 64x16 cells. Only the runs of
+ * cells that changed since the last frame are drawn, and a
+ * frame goes out in a single write, which is what matters over
+ * a slow link. The counters say what that came to
+ */
+typedef struct {
+    int fd;
+    bool hires;             // the resolution on screen
+    bool shown;             // the screen holds a frame to diff against
+    uint32_t writes;        // vm->writes when it was drawn
+    uint64_t screen[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+    char *out;              // the frame being put together
+
+    uint64_t frames;        // frames drawn
+    uint64_t clean;         // frames skipped, nothing having changed
+    uint64_t bytes;         // bytes written
+    uint64_t syscalls;      // calls to write(2)
+} chip8_render;
+
+/**
+ * start drawing to `fd`; false if out of memory
+ */
+bool chip8_render_init(chip8_render *render, int fd);
+
+/**
+ * leave the cursor below the picture and free the buffer
+ */
+void chip8_render_free(chip8_render *render);
+
+/**
+ * draw the display of `vm` as it changed since the last call,
+ * at the end of a frame; false if the write failed
+ */
+bool chip8_render_frame(chip8_render *render, const chip8_vm *vm);
+
+/**
+ * the shared framebuffer
+ *
+ * a running machine publishes its display, registers and
+ * frame count once a frame into a POSIX shared memory segment,
+ * for viewers, recorders and agents in other processes to map
+ * read-only. The segment is guarded by a sequence lock: the
+ * machine never waits on a reader, and a reader that caught it
+ * mid-frame just copies the frame again. A segment is a 64-byte
+ * header ("C8FB", the version, the size of a frame and the
+ * sequence count, odd while a frame is being written) followed
+ * by a chip8_frame
+ */
+#define CHIP8_SHARED_MAGIC "C8FB"
+#define CHIP8_SHARED_VERSION 1
+
+typedef struct {
+    uint64_t frame;         // frames completed
+    uint64_t executed;      // instructions run
+    uint8_t rs1[CHIP8_GP_REGS];
+    uint16_t rs2[CHIP8_SP_REGS];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint16_t keys;
+    bool hires;
+    bool halted;
+    bool running;           // false once the machine has gone
+    uint64_t display[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+} chip8_frame;
+
+typedef struct chip8_shared chip8_shared;
+
+/**
+ * create the segment `name` (as for shm_open, "/name") and map
+ * it for publishing, or NULL on failure
+ */
+chip8_shared *chip8_shared_create(const char *name);
+
+/**
+ * publish the machine as it is at the end of a frame
+ */
+void chip8_shared_publish(chip8_shared *shared, const chip8_vm *vm, uint64_t frame, uint64_t executed);
+
+/**
+ * map the segment `name` read-only, or NULL if there is none
+ */
+chip8_shared *chip8_shared_open(const char *name);
+
+/**
+ * copy out the latest frame; false if the segment is not one
+ * this library can read
+ */
+bool chip8_shared_snapshot(const chip8_shared *shared, chip8_frame *frame);
+
+/**
+ * unmap the segment; the machine that created it marks it as
+ * no longer running and removes the name
+ */
+void chip8_shared_close(chip8_shared *shared);
+
+/**
+ * the frame scheduler
+ *
+ * machine time runs on a 60 Hz clock counted in instructions,
+ * not read off the wall: at `ips` instructions per second,
+ * frame k ends after instruction k * ips / 60, rounded down,
+ * and the timers tick there. A run therefore depends only on
+ * the rate, and the modes below leave a program in the same
+ * state, differing only in how long they take:
+ *
+ * - real time sleeps at the end of every frame until 1/60 s
+ *   of wall time has passed since the last one
+ * - fixed IPS sleeps every CHIP8_SCHED_SLICE_NS within the
+ *   frame as well, so instructions come at an even rate
+ * - turbo never sleeps, for headless and batch runs
+ *
+ * with a rate of 0 the timers stand still and a frame is the
+ * whole run
+ */
+#define CHIP8_SCHED_HZ 60
+#define CHIP8_SCHED_SLICE_NS 1000000
+
+typedef enum {
+    CHIP8_SCHED_TURBO,
+    CHIP8_SCHED_REALTIME,
+    CHIP8_SCHED_FIXED_IPS,
+} chip8_sched_mode;
+
+typedef struct {
+    chip8_sched_mode mode;
+    uint64_t ips;           // instructions per second of machine time
+    uint64_t executed;      // instructions run, the machine clock
+    uint64_t frames;        // frames completed, one timer tick each
+    struct timespec origin; // wall time at instruction 0
+} chip8_sched;
+
+/**
+ * start the clock at instruction 0, now
+ */
+void chip8_sched_init(chip8_sched *sched, chip8_sched_mode mode, uint64_t ips);
+
+/**
+ * run `vm` to the end of the current frame and tick its
+ * timers, pacing it as the mode says, or stop early after
+ * `cycles` instructions (0 for no limit) or when it halts, to
+ * carry on from there next time. Returns the number executed
+ */
+uint64_t chip8_sched_frame(chip8_sched *sched, chip8_vm *vm, uint64_t cycles);
+
+/**
+ * move the origin so that the machine time run so far ends
+ * now, after the machine has been stopped for a while; the
+ * pacing carries on from here instead of catching up
+ */
+void chip8_sched_rebase(chip8_sched *sched);
+
+/**
+ * the batch engine
+ *
+ * runs up to CHIP8_BATCH_LANES copies of one program side by
+ * side, each lane a machine of its own (own memory, stack,
+ * keypad and RNG seed). The V registers, I and PC of all lanes
+ * are kept in structure-of-arrays form, one column per lane, and
+ * lanes sitting at the same instruction execute it together with
+ * vector instructions. Lanes that branch apart are stepped in
+ * smaller groups, down to one lane, until they meet again
+ */
+#define CHIP8_BATCH_LANES 32
+
+/**
+ * lane i starts with the RNG of a freshly reset machine xored
+ * with i * CHIP8_BATCH_SEED, so a machine run on its own with
+ * the same seed matches the lane step for step
+ */
+#define CHIP8_BATCH_SEED 0x9E3779B9u
+
+typedef struct chip8_batch {
+    _Alignas(CHIP8_BATCH_LANES) uint8_t v[CHIP8_GP_REGS][CHIP8_BATCH_LANES];
+    _Alignas(CHIP8_BATCH_LANES) uint16_t ix[CHIP8_BATCH_LANES];
+    uint16_t pc[CHIP8_BATCH_LANES];
+
+    /**
+     * the lanes themselves, holding everything but the columns
+     * above; their keys and rng may be changed between runs, and
+     * chip8_batch_sync copies the columns back for inspection
+     */
+    chip8_vm *lanes;
+    int count;
+
+    uint64_t executed[CHIP8_BATCH_LANES]; // instructions run by each lane since the last reset
+
+    /**
+     * addresses where the lanes' memories may differ, so that
+     * instruction fetches there have to be checked per lane
+     */
+    uint8_t diverged[CHIP8_MEMORY_CAPACITY / 8];
+
+    /**
+     * lanes waiting at each address for the running group to
+     * reach them; all clear outside chip8_batch_run
+     */
+    uint32_t parked[CHIP8_MEMORY_CAPACITY];
+} chip8_batch;
+
+/**
+ * initialize a batch of `count` lanes, returns false if count is
+ * out of range or the lanes cannot be allocated. Every lane gets
+ * a different RNG seed, see CHIP8_BATCH_SEED
+ */
+bool chip8_batch_init(chip8_batch *batch, int count);
+void chip8_batch_reset(chip8_batch *batch);
+void chip8_batch_free(chip8_batch *batch);
+
+/**
+ * load the same program into every lane
+ */
+uint16_t chip8_batch_load_buffer(chip8_batch *batch, const uint8_t *program, size_t size);
+
+/**
+ * run every lane for at most `cycles` instructions (0 for no
+ * limit), stopping lanes that halt, and return the total number
+ * of instructions executed across lanes
+ */
+uint64_t chip8_batch_run(chip8_batch *batch, uint64_t cycles);
+
+/**
+ * advance the timers of every lane by one 60 Hz frame
+ */
+void chip8_batch_tick(chip8_batch *batch);
+
+/**
+ * copy the registers of every lane from the columns back into
+ * its machine
+ */
+void chip8_batch_sync(chip8_batch *batch);
+
+/**
+ * the assembler
+ *
+ * assembles source held in memory into a program image in
+ * memory, ready for chip8_vm_load_buffer, with the labels it
+ * defined. Nothing is printed and nothing is written to disk;
+ * what went wrong first is left in `error`. The source is
+ * lexed in place, and the assembler keeps no state between
+ * calls, so any number of threads may assemble at once.
+ *
+ * `INCLUDE FILE` assembles FILE, found next to the file that
+ * names it, in its place. Every file is assembled on its own,
+ * on as many threads as there are files to work on, and the
+ * pieces are then linked; labels are shared by all of them.
+ * With a cache directory, a file is only assembled again when
+ * its text has changed
+ */
+typedef struct {
+    int jobs; // threads to assemble with, 0 for one per CPU
+    const char *cache; // directory of assembled files, or NULL
+} chip8_asm_options;
+
+typedef struct {
+    char symbol[32];
+    uint16_t address;
+} chip8_asm_symbol;
+
+typedef struct {
+    uint8_t *image; // loaded at CHIP8_PROGRAM_START
+    size_t size;
+    chip8_asm_symbol *symbols; // in the order they were defined
+    int nsymbols;
+    int files; // assembled, includes and all
+    int cached; // of them, taken from the cache
+    bool unread; // a file given could not be read
+    char error[256]; // empty unless assembly failed
+} chip8_program;
+
+/**
+ * assemble `size` bytes of source, the file at `path`, or the
+ * `count` files at `paths` one after another, into a zeroed
+ * program; false on failure. Files are mapped rather than read
+ * where they can be. `options` may be NULL, for no cache. A
+ * program is freed either way
+ */
+bool chip8_asm_buffer(chip8_program *program, const char *source, size_t size);
+bool chip8_asm_file(chip8_program *program, const char *path);
+bool chip8_asm_files(chip8_program *program, const char *const *paths, int count, const chip8_asm_options *options);
+void chip8_asm_free(chip8_program *program);
 
 #endif // _CHIP8_H
@@ -1,198 +1,708 @@
 /************************************
- * chip8.c - implementation for CHIP-8 interpreter
+ * chip8.c - command line front end for the CHIP-8 interpreter
  *
  * Developer: Victor Nwosu
  ***********************************/
 
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "chip8.h"
 
 /**
- * load program from file into main memory
- * and return the number of bytes read
- * essentially the size of the program
+ * instructions per 60 Hz frame in real time, when no rate is
+ * given
  */
-uint16_t load_program(const char *path);
+#define CHIP8_IPF 10
 
-void decode(uint16_t *opcode, uint16_t *slab, uint8_t *byte, uint8_t *regs);
-void execute(uint16_t opcode, uint16_t slab, uint8_t byte, uint8_t regs);
+/**
+ * profile reports
+ *
+ * a symbol map written by chip8c -m names addresses after the
+ * nearest label at or below them. Only the hottest
+ * CHIP8_PROFILE_TOP addresses and subroutines are listed
+ */
+#define CHIP8_PROFILE_TOP 10
+
+typedef struct {
+    uint16_t address;
+    char label[32];
+} chip8_label;
+
+chip8_label *labels;
+int nlabels;
+
+bool load_program(chip8_vm *vm, const char *path, bool *source);
+bool load_map(const char *path);
+bool load_state(chip8_vm *vm, const char *path);
+bool save_state(chip8_vm *vm, const char *path);
+void report(const chip8_profile *profile, FILE *out);
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        printf("usage: %s FILE", argv[0]);
+    chip8_core core = CHIP8_CORE_THREADED;
+    uint64_t cycles = 0;
+    uint32_t ipf = 0;
+    uint64_t ips = 0;
+    bool idle = true;
+    bool realtime = false;
+    bool turbo = false;
+    bool stats = false;
+    bool state = false;
+    const char *trace = NULL;
+    const char *map = NULL;
+    const char *resume = NULL;
+    const char *snapshot = NULL;
+    size_t history = 0;
+    const char *play = NULL;
+    const char *record = NULL;
+    const char *live = NULL;
+    const char *screen = NULL;
+    const char *publish = NULL;
+    uint64_t back = 0;
+    bool profiling = false;
+    int opt;
+
+    static struct option options[] = {
+        { "back", required_argument, NULL, 'b' },
+        { "core", required_argument, NULL, 'c' },
+        { "dump", no_argument, NULL, 'd' },
+        { "ipf", required_argument, NULL, 'f' },
+        { "ips", required_argument, NULL, 'i' },
+        { "no-idle", no_argument, NULL, 'I' },
+        { "jit", no_argument, NULL, 'j' },
+        { "keys", required_argument, NULL, 'k' },
+        { "keypad", required_argument, NULL, 'K' },
+        { "load", required_argument, NULL, 'L' },
+        { "map", required_argument, NULL, 'm' },
+        { "cycles", required_argument, NULL, 'n' },
+        { "output", required_argument, NULL, 'o' },
+        { "profile", no_argument, NULL, 'p' },
+        { "publish", required_argument, NULL, 'P' },
+        { "realtime", no_argument, NULL, 'r' },
+        { "rewind", required_argument, NULL, 'R' },
+        { "stats", no_argument, NULL, 's' },
+        { "save", required_argument, NULL, 'S' },
+        { "trace", required_argument, NULL, 't' },
+        { "turbo", no_argument, NULL, 'T' },
+        { "record", required_argument, NULL, 'w' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while ((opt = getopt_long(argc, argv, "b:c:df:i:Ijk:K:L:m:n:o:pP:rR:sS:t:Tw:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'b':
+                back = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                if (strcmp(optarg, "switch") == 0) {
+                    core = CHIP8_CORE_SWITCH;
+                } else if (strcmp(optarg, "threaded") == 0) {
+                    core = CHIP8_CORE_THREADED;
+                } else if (strcmp(optarg, "block") == 0) {
+                    core = CHIP8_CORE_BLOCK;
+                } else if (strcmp(optarg, "jit") == 0) {
+                    core = CHIP8_CORE_JIT;
+                } else {
+                    printf("Unknown core: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                state = true;
+                break;
+            case 'f':
+                ipf = strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                ips = strtoull(optarg, NULL, 0);
+                break;
+            case 'I':
+                idle = false;
+                break;
+            case 'j':
+                core = CHIP8_CORE_JIT;
+                break;
+            case 'k':
+                play = optarg;
+                break;
+            case 'K':
+                live = optarg;
+                break;
+            case 'L':
+                resume = optarg;
+                break;
+            case 'm':
+                map = optarg;
+                profiling = true;
+                break;
+            case 'n':
+                cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                screen = optarg;
+                break;
+            case 'p':
+                profiling = true;
+                break;
+            case 'P':
+                publish = optarg;
+                break;
+            case 'r':
+                realtime = true;
+                break;
+            case 'R':
+                history = strtoull(optarg, NULL, 0) * 1024;
+                break;
+            case 's':
+                stats = true;
+                break;
+            case 'S':
+                snapshot = optarg;
+                break;
+            case 't':
+                trace = optarg;
+                break;
+            case 'T':
+                turbo = true;
+                break;
+            case 'w':
+                record = optarg;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1) {
+        printf("usage: %s [-b frames] [-c switch|threaded|block|jit] [-d] [-f ipf | -i ips] [-I] [-j] [-k SCRIPT] [-K SOURCE] [-L STATE] [-m MAP] [-n cycles] [-o OUT] [-p] [-P NAME] [-r] [-R KB] [-s] [-S STATE] [-t TRACE] [-T] [-w SCRIPT] FILE|SOURCE.ch8\n", argv[0]);
         return 1;
     }
 
-    if (load_program(argv[1]) == 0) {
-        printf("Error loading program");
+    chip8_vm vm;
+    chip8_vm_init(&vm);
+    vm.skip_idle = idle;
+
+    bool source;
+
+    if (!load_program(&vm, argv[optind], &source)) {
+        printf("Error loading program\n");
+        chip8_vm_free(&vm);
+        return 2;
+    }
+
+    if (!chip8_vm_set_core(&vm, core)) {
+        fprintf(stderr, "JIT is not available on this host, using the threaded core\n");
+        chip8_vm_set_core(&vm, CHIP8_CORE_THREADED);
+    }
+
+    if (resume != NULL && !load_state(&vm, resume)) {
+        printf("Error loading state %s\n", resume);
+        chip8_vm_free(&vm);
+        return 2;
+    }
+
+    if (trace != NULL && !chip8_vm_trace_start(&vm, trace)) {
+        printf("Error creating trace %s\n", trace);
+        chip8_vm_free(&vm);
+        return 2;
+    }
+
+    chip8_profile *profile = NULL;
+
+    if (profiling) {
+        char path[1024];
+
+        // without -m, use the labels of a program assembled from
+        // source, or look for the map chip8c -m leaves next to a ROM
+        if (map == NULL && !source) {
+            snprintf(path, sizeof(path), "%s.sym", argv[optind]);
+            load_map(path);
+        } else if (map != NULL && !load_map(map)) {
+            printf("Error loading symbol map %s\n", map);
+            chip8_vm_free(&vm);
+            return 2;
+        }
+
+        if ((profile = calloc(1, sizeof(chip8_profile))) == NULL) {
+            printf("Out of memory\n");
+            chip8_vm_free(&vm);
+            return 2;
+        }
+
+        chip8_vm_profile(&vm, profile);
+    }
+
+    chip8_input input = { 0 }, recorded = { 0 };
+
+    if (play != NULL && !chip8_input_load(&input, play)) {
+        printf("Error loading input script %s\n", play);
+        chip8_vm_free(&vm);
+        return 2;
+    }
+
+    // -i gives the rate directly and paces it evenly, -r paces
+    // whole frames, and -T drops the pacing but keeps the clock.
+    // Input scripts and the keypad count frames, so they need a
+    // clock too
+    chip8_sched_mode mode = ips != 0 ? CHIP8_SCHED_FIXED_IPS : realtime ? CHIP8_SCHED_REALTIME : CHIP8_SCHED_TURBO;
+
+    if (ips == 0) {
+        ips = (uint64_t) (ipf == 0 && (realtime || play != NULL || record != NULL || live != NULL) ? CHIP8_IPF : ipf) * CHIP8_SCHED_HZ;
+    }
+
+    if (turbo) {
+        mode = CHIP8_SCHED_TURBO;
+    }
+
+    chip8_rewind rewind = { 0 };
+
+    if (history != 0 && !chip8_rewind_init(&rewind, history, CHIP8_REWIND_INTERVAL)) {
+        printf("Out of memory\n");
+        chip8_vm_free(&vm);
+        return 2;
+    }
+
+    chip8_render render = { .fd = -1 };
+
+    // the display goes to the terminal for -, or to a file, which
+    // may be /dev/null for measuring the renderer
+    if (screen != NULL) {
+        int fd = strcmp(screen, "-") == 0 ? STDOUT_FILENO : open(screen, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd < 0 || !chip8_render_init(&render, fd)) {
+            printf("Error opening display %s\n", screen);
+            chip8_input_free(&input);
+            chip8_rewind_free(&rewind);
+            chip8_vm_free(&vm);
+            return 2;
+        }
+    }
+
+    chip8_shared *shared = NULL;
+
+    if (publish != NULL && (shared = chip8_shared_create(publish)) == NULL) {
+        printf("Error creating shared memory %s\n", publish);
+        chip8_render_free(&render);
+        chip8_input_free(&input);
+        chip8_rewind_free(&rewind);
+        chip8_vm_free(&vm);
+        return 2;
+    }
+
+    chip8_keypad *keypad = NULL;
+
+    if (live != NULL && (keypad = chip8_keypad_start(live)) == NULL) {
+        printf("Error opening keypad %s\n", live);
+        chip8_shared_close(shared);
+        chip8_render_free(&render);
+        chip8_input_free(&input);
+        chip8_rewind_free(&rewind);
+        chip8_vm_free(&vm);
         return 2;
     }
 
-    rs2[CHIP8_SP] = 0;
-    rs2[CHIP8_PC] = 0;
-    rs2[CHIP8_IX] = 0;
+    struct timespec start, end;
+    chip8_sched sched;
+    uint64_t executed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    chip8_sched_init(&sched, mode, ips);
+
+    // the history starts with the machine as loaded
+    if (history != 0) {
+        chip8_rewind_push(&rewind, &vm);
+    }
+
+    // a frame spent waiting is skipped over by chip8_vm_run, so
+    // turbo runs go straight on to the next tick, and paced ones
+    // sleep through the rest of the frame
+    while (!vm.halted && (cycles == 0 || executed < cycles)) {
+        // the keypad only changes between frames, and the script
+        // is all in memory, so playing it back costs no syscalls
+        if (play != NULL) {
+            chip8_input_play(&input, &vm, sched.frames);
+        }
+
+        // the live keypad is queued up in memory as well, and goes
+        // into the recording like any other
+        if (keypad != NULL && !chip8_keypad_poll(keypad, &vm)) {
+            break;
+        }
+
+        if (record != NULL && !chip8_input_record(&recorded, sched.frames, vm.keys)) {
+            printf("Out of memory recording input\n");
+            break;
+        }
+
+        uint64_t frames = sched.frames;
+
+        executed += chip8_sched_frame(&sched, &vm, cycles == 0 ? 0 : cycles - executed);
+
+        if (history != 0) {
+            chip8_rewind_push(&rewind, &vm);
+        }
+
+        // the display is drawn at vblank, or once for a run with no
+        // clock, where the whole run is one frame
+        if (render.fd >= 0 && (sched.frames != frames || ips == 0) && !chip8_render_frame(&render, &vm)) {
+            printf("Error writing display\n");
+            break;
+        }
+
+        // readers take it from there without holding up the machine
+        if (shared != NULL && (sched.frames != frames || ips == 0)) {
+            chip8_shared_publish(shared, &vm, sched.frames, executed);
+        }
+
+        bool waiting = vm.idle && cycles == 0 && vm.rs2[CHIP8_DL] == 0 && input.next == input.count;
+
+        // waiting on the keypad, and with the sound done, the time
+        // it waits makes no difference; sleep until a key comes
+        // instead of running idle frames, then carry on pacing from
+        // the time it came
+        if (keypad != NULL && waiting && vm.rs2[CHIP8_ST] == 0) {
+            if (!chip8_keypad_wait(keypad)) {
+                break;
+            }
+
+            chip8_sched_rebase(&sched);
+            continue;
+        }
+
+        // without a clock or a keypad nothing can wake it up again
+        if (ips == 0 || (waiting && mode == CHIP8_SCHED_TURBO && keypad == NULL)) {
+            break;
+        }
+    }
+
+    // put the terminal back before writing anything to it
+    chip8_keypad_stop(keypad);
+    chip8_shared_close(shared);
 
-    uint16_t *bits = (uint16_t *) memory;
+    if (render.fd >= 0) {
+        chip8_render_free(&render);
 
-    uint16_t opcode = 0x0000, slab = 0x000;
-    uint8_t regs = 0xFF, byte = 0x00;
+        if (render.fd != STDOUT_FILENO) {
+            close(render.fd);
+        }
+    }
 
-    // 0x00FD instruction exits the program
-    while (opcode != 0xFFFF) { 
-        // fetch
-        rs2[CHIP8_IX] = *(bits + rs2[CHIP8_PC]++);
+    // the time taken includes writing out the rest of the trace
+    chip8_vm_trace_stop(&vm);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-        // decode
-        decode(&opcode, &slab, &byte, &regs);
-        printf("0x%-10x | 0x%-10x | 0x%-10x | 0x%-10x | 0x%-10x | 0x%-10x\n", rs2[CHIP8_PC] - 1, rs2[CHIP8_IX], opcode, slab, byte, regs);
+    if (record != NULL && !chip8_input_save(&recorded, record)) {
+        printf("Error writing input script %s\n", record);
+    }
 
-        execute(opcode, slab, byte, regs);
+    if (back != 0 && !chip8_rewind_seek(&rewind, &vm, back)) {
+        printf("Cannot rewind %llu frames\n", (unsigned long long) back);
     }
+
+    if (snapshot != NULL && !save_state(&vm, snapshot)) {
+        printf("Error saving state %s\n", snapshot);
+    }
+
+    if (state) {
+        chip8_vm_dump(&vm, stdout);
+    }
+
+    if (stats) {
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        // instructions skipped idle cost next to nothing, so the
+        // rate is worked out from the ones actually executed
+        uint64_t skipped = vm.idled < executed ? vm.idled : executed;
+        uint64_t ran = executed - skipped;
+
+        fprintf(stderr, "%llu instructions executed, %llu skipped idle in %.3f s (%.2f MIPS)\n",
+            (unsigned long long) ran, (unsigned long long) skipped, elapsed, elapsed > 0 ? ran / elapsed / 1e6 : 0.0);
+        fprintf(stderr, "%llu frames\n", (unsigned long long) sched.frames);
+
+        if (history != 0) {
+            chip8_rewind_stats usage;
+            chip8_rewind_measure(&rewind, &usage);
+
+            // a minute of history at the size of the frames held now
+            fprintf(stderr, "rewind: %llu frames (%llu keyframes) in %zu of %zu KB, %.1f KB per minute\n",
+                (unsigned long long) usage.frames, (unsigned long long) usage.keyframes, usage.bytes / 1024,
+                usage.capacity / 1024, usage.frames ? (double) usage.bytes / usage.frames * CHIP8_SCHED_HZ * 60 / 1024 : 0.0);
+        }
+
+        if (render.fd >= 0) {
+            uint64_t drawn = render.frames;
+
+            fprintf(stderr, "display: %llu frames drawn, %llu unchanged, %.1f bytes and %.2f writes per frame drawn, %.0f frames/s\n",
+                (unsigned long long) drawn, (unsigned long long) render.clean,
+                drawn ? (double) render.bytes / drawn : 0.0, drawn ? (double) render.syscalls / drawn : 0.0,
+                elapsed > 0 ? drawn / elapsed : 0.0);
+        }
+    }
+
+    if (profile != NULL) {
+        report(profile, stderr);
+        free(profile);
+    }
+
+    free(labels);
+
+    chip8_input_free(&input);
+    chip8_input_free(&recorded);
+    chip8_rewind_free(&rewind);
+    chip8_vm_free(&vm);
+
+    return 0;
 }
 
-uint16_t load_program(const char *path) {
-    FILE *program = fopen(path, "rb");
+static int by_address(const void *a, const void *b) {
+    return ((const chip8_label *) a)->address - ((const chip8_label *) b)->address;
+}
+
+/**
+ * put the machine back into the state saved in a file by -S
+ */
+bool load_state(chip8_vm *vm, const char *path) {
+    FILE *in = fopen(path, "rb");
+    chip8_state state = { 0 };
+
+    if (in == NULL) {
+        return false;
+    }
+
+    bool loaded = chip8_state_read(&state, in);
+    fclose(in);
 
-    if (program == NULL) {
-        return 0;
+    if (loaded) {
+        chip8_vm_restore(vm, &state);
+        chip8_state_release(&state);
     }
 
-    return fread(memory, sizeof(uint8_t), CHIP8_MEMORY_CAPACITY, program);
+    return loaded;
 }
 
-void decode(uint16_t *opcode, uint16_t *slab, uint8_t *byte, uint8_t *regs) {
-    *regs = 0xFF;
-    uint16_t opc = 0xFFFF;
+bool save_state(chip8_vm *vm, const char *path) {
+    FILE *out = fopen(path, "wb");
+    chip8_state state = { 0 };
 
-    for (int i = 0; optab[i].mnemonic != NULL; i++) {
-        if (opc == *opcode) {
-            break;
+    if (out == NULL || !chip8_vm_save(vm, &state)) {
+        if (out != NULL) {
+            fclose(out);
+        }
+
+        return false;
+    }
+
+    bool saved = chip8_state_write(&state, out);
+    chip8_state_release(&state);
+
+    return fclose(out) == 0 && saved;
+}
+
+/**
+ * load a ROM, or assemble a .ch8 source file straight into
+ * memory, keeping its labels for the profile report
+ */
+bool load_program(chip8_vm *vm, const char *path, bool *source) {
+    size_t length = strlen(path);
+
+    *source = length >= 4 && strcmp(path + length - 4, ".ch8") == 0;
+
+    if (!*source) {
+        return chip8_vm_load(vm, path) != 0;
+    }
+
+    chip8_program program = { 0 };
+    bool loaded = chip8_asm_file(&program, path);
+
+    if (!loaded) {
+        printf("%s\n", program.error);
+    } else if ((loaded = chip8_vm_load_buffer(vm, program.image, program.size) != 0) && program.nsymbols > 0) {
+        labels = malloc(program.nsymbols * sizeof(chip8_label));
+
+        for (int i = 0; labels != NULL && i < program.nsymbols; i++) {
+            labels[i].address = program.symbols[i].address & CHIP8_ADDRESS_MASK;
+            strcpy(labels[i].label, program.symbols[i].symbol);
         }
 
-        opc = optab[i].mask & rs2[CHIP8_IX];
-        printf("0x%-10x | 0x%-10x | 0x%-10x\n", optab[i].mask, rs2[CHIP8_IX], opc);
-
-
-        switch (opc) {
-            case CHIP8_OP_CLS:            // 0x00E0
-            case CHIP8_OP_RET:            // 0x00EE
-            case CHIP8_OP_SCR:            // 0x00FB
-            case CHIP8_OP_SCL:            // 0x00FC
-            case CHIP8_OP_EXIT:           // 0x00FD
-            case CHIP8_OP_LOW:            // 0x00FE
-            case CHIP8_OP_HIGH:           // 0x00FF
-                *opcode = opc;
-                break;
-            case CHIP8_OP_JP:             // 0x1000
-            case CHIP8_OP_CALL:           // 0x2000
-            case CHIP8_OP_LD_ADDR:        // 0xA000
-            case CHIP8_OP_JP_V0:          // 0xB000
-                *slab = (optab[i].mask ^ 0xFFFF) & rs2[CHIP8_IX];
-                *opcode = opc;
-                break;
-            case CHIP8_OP_SE_BYTE:        // 0x3000
-            case CHIP8_OP_SNE_BYTE:       // 0x4000
-            case CHIP8_OP_LD_BYTE:        // 0x6000
-            case CHIP8_OP_ADD_BYTE:       // 0x7000
-            case CHIP8_OP_RND_BYTE:       // 0xC000
-                *byte = 0x00FF & rs2[CHIP8_IX];
-                *regs = ((0x0F00 & rs2[CHIP8_IX]) >> 4) | 0x0F;
-                *opcode = opc;
-                break;
-            case CHIP8_OP_SE_REG:         // 0x5000
-            case CHIP8_OP_LD_REG:         // 0x8000
-            case CHIP8_OP_OR:             // 0x8001
-            case CHIP8_OP_AND:            // 0x8002
-            case CHIP8_OP_XOR:            // 0x8003
-            case CHIP8_OP_ADD_REG:        // 0x8004
-            case CHIP8_OP_SUB:            // 0x8005
-            case CHIP8_OP_SHR:            // 0x8006
-            case CHIP8_OP_SUBN:           // 0x8007
-            case CHIP8_OP_SHL:            // 0x800E
-            case CHIP8_OP_SNE_REG:        // 0x9000
-                *regs = (0x0FF0 & rs2[CHIP8_IX]) >> 4;
-                *opcode = opc;
-                break;
-            case CHIP8_OP_SKP:            // 0xE09E
-            case CHIP8_OP_SKNP:           // 0xE0A1
-            case CHIP8_OP_LD_DT:          // 0xF007
-            case CHIP8_OP_LD_KEY:         // 0xF00A
-            case CHIP8_OP_LD_REG_DT:      // 0xF015
-            case CHIP8_OP_LD_REG_ST:      // 0xF018
-            case CHIP8_OP_ADD_REG_IX:     // 0xF01E
-            case CHIP8_OP_LD_SPRITE:      // 0xF029
-            case CHIP8_OP_LDS_BCD:        // 0xF033
-            case CHIP8_OP_LDS_REGS:       // 0xF055
-            case CHIP8_OP_LD_REGS:        // 0xF065
-                *regs = ((0x0F00 & rs2[CHIP8_IX]) >> 4) | 0x0F;
-                *opcode = opc;
-                break;
-            case CHIP8_OP_SCD:            // 0x00C0
-                *byte = 0x000F & rs2[CHIP8_IX];
-                *opcode = opc;
-                break;
-            case CHIP8_OP_DRW_NIBBLE:     // 0xD000
-                *byte = 0x000F & rs2[CHIP8_IX];
-                *regs = (0x0FF0 & rs2[CHIP8_IX]) >> 4;
-                *opcode = opc;
-                break;
-            default:                      // Illegal instruction
-                *opcode = 0xFFFF;
-                *slab = 0xFFF;
-                *byte = 0xFF;
+        nlabels = labels != NULL ? program.nsymbols : 0;
+        qsort(labels, nlabels, sizeof(chip8_label), by_address);
+    }
+
+    chip8_asm_free(&program);
+
+    return loaded;
+}
+
+/**
+ * read a symbol map written by chip8c -m, replacing any labels
+ * kept from a program assembled from source
+ */
+bool load_map(const char *path) {
+    FILE *in = fopen(path, "r");
+    int capacity = 0;
+    unsigned address;
+    char label[32];
+
+    if (in == NULL) {
+        return false;
+    }
+
+    // the table is grown from nothing, so whatever it held goes
+    free(labels);
+    labels = NULL;
+    nlabels = 0;
+
+    bool loaded = true;
+
+    while (fscanf(in, "%x %31s", &address, label) == 2) {
+        if (nlabels >= capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            chip8_label *grown = realloc(labels, capacity * sizeof(chip8_label));
+
+            if (grown == NULL) {
+                // keep what was read so far; the table is still sorted below
+                printf("Out of memory\n");
+                loaded = false;
                 break;
+            }
+
+            labels = grown;
         }
+
+        labels[nlabels].address = address & CHIP8_ADDRESS_MASK;
+        strcpy(labels[nlabels++].label, label);
     }
+
+    fclose(in);
+    qsort(labels, nlabels, sizeof(chip8_label), by_address);
+
+    return loaded;
 }
 
-void execute(uint16_t opcode, uint16_t slab, uint8_t byte, uint8_t regs) {
-    switch (opcode) {
-        case CHIP8_OP_CLS:            // 0x00E0
-        case CHIP8_OP_RET:            // 0x00EE
-        case CHIP8_OP_SCR:            // 0x00FB
-        case CHIP8_OP_SCL:            // 0x00FC
-        case CHIP8_OP_LOW:            // 0x00FE
-        case CHIP8_OP_HIGH:           // 0x00FF
-            break;
-        case CHIP8_OP_JP:             // 0x1000
-        case CHIP8_OP_CALL:           // 0x2000
-        case CHIP8_OP_LD_ADDR:        // 0xA000
-        case CHIP8_OP_JP_V0:          // 0xB000
-            break;
-        case CHIP8_OP_SE_BYTE:        // 0x3000
-        case CHIP8_OP_SNE_BYTE:       // 0x4000
-        case CHIP8_OP_LD_BYTE:        // 0x6000
-        case CHIP8_OP_ADD_BYTE:       // 0x7000
-        case CHIP8_OP_RND_BYTE:       // 0xC000
-            break;
-        case CHIP8_OP_SE_REG:         // 0x5000
-        case CHIP8_OP_LD_REG:         // 0x8000
-        case CHIP8_OP_OR:             // 0x8001
-        case CHIP8_OP_AND:            // 0x8002
-        case CHIP8_OP_XOR:            // 0x8003
-        case CHIP8_OP_ADD_REG:        // 0x8004
-        case CHIP8_OP_SUB:            // 0x8005
-        case CHIP8_OP_SHR:            // 0x8006
-        case CHIP8_OP_SUBN:           // 0x8007
-        case CHIP8_OP_SHL:            // 0x800E
-        case CHIP8_OP_SNE_REG:        // 0x9000
-            break;
-        case CHIP8_OP_SKP:            // 0xE09E
-        case CHIP8_OP_SKNP:           // 0xE0A1
-        case CHIP8_OP_LD_DT:          // 0xF007
-        case CHIP8_OP_LD_KEY:         // 0xF00A
-        case CHIP8_OP_LD_REG_DT:      // 0xF015
-        case CHIP8_OP_LD_REG_ST:      // 0xF018
-        case CHIP8_OP_ADD_REG_IX:     // 0xF01E
-        case CHIP8_OP_LD_SPRITE:      // 0xF029
-        case CHIP8_OP_LDS_BCD:        // 0xF033
-        case CHIP8_OP_LDS_REGS:       // 0xF055
-        case CHIP8_OP_LD_REGS:        // 0xF065
-            break;
-        case CHIP8_OP_SCD:            // 0x00C0
-            break;
-        case CHIP8_OP_DRW_NIBBLE:     // 0xD000
-            break;
+/**
+ * `address` as `label` or `label+offset` after the nearest
+ * label at or below it, or in hex if there is none
+ */
+static const char *symbolize(uint16_t address, char *text, size_t size) {
+    int lo = 0, hi = nlabels;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (labels[mid].address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        snprintf(text, size, "0x%03x", address);
+    } else if (labels[lo - 1].address == address) {
+        snprintf(text, size, "%s", labels[lo - 1].label);
+    } else {
+        snprintf(text, size, "%s+%d", labels[lo - 1].label, address - labels[lo - 1].address);
+    }
+
+    return text;
+}
+
+/**
+ * indexes of the `top` largest of `count` counters, largest
+ * first, leaving out zeros; returns how many there are
+ */
+static int hottest(const uint64_t *counts, int count, int *index, int top) {
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (counts[i] == 0 || (n == top && counts[i] <= counts[index[n - 1]])) {
+            continue;
+        }
+
+        int j = n < top ? n++ : n - 1;
+
+        for (; j > 0 && counts[index[j - 1]] < counts[i]; j--) {
+            index[j] = index[j - 1];
+        }
+
+        index[j] = i;
+    }
+
+    return n;
+}
+
+void report(const chip8_profile *profile, FILE *out) {
+    static const char *classes[CHIP8_H_COUNT] = {
+#define X(name, opcode) #name,
+        CHIP8_HANDLERS(X)
+#undef X
+    };
+
+    double total = profile->executed > 0 ? profile->executed : 1;
+    int index[CHIP8_H_COUNT > CHIP8_PROFILE_TOP ? CHIP8_H_COUNT : CHIP8_PROFILE_TOP];
+    char text[48], site[48];
+    int n;
+
+    fprintf(out, "\nprofile: %llu instructions run, %llu skipped idle\n",
+        (unsigned long long) profile->executed, (unsigned long long) profile->skipped);
+
+    fprintf(out, "\n%-24s %12s %7s\n", "opcode class", "count", "%");
+    n = hottest(profile->ops, CHIP8_H_COUNT, index, CHIP8_H_COUNT);
+
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "%-24s %12llu %6.2f%%\n", classes[index[i]],
+            (unsigned long long) profile->ops[index[i]], profile->ops[index[i]] * 100 / total);
+    }
+
+    fprintf(out, "\n%-24s %12s %7s\n", "address", "count", "%");
+    n = hottest(profile->pcs, CHIP8_MEMORY_CAPACITY, index, CHIP8_PROFILE_TOP);
+
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "%-24s %12llu %6.2f%%\n", symbolize(index[i], text, sizeof(text)),
+            (unsigned long long) profile->pcs[index[i]], profile->pcs[index[i]] * 100 / total);
+    }
+
+    n = hottest(profile->idle, CHIP8_MEMORY_CAPACITY, index, CHIP8_PROFILE_TOP);
+
+    if (n > 0) {
+        fprintf(out, "\n%-24s %12s\n", "idle loop", "skipped");
+    }
+
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "%-24s %12llu\n", symbolize(index[i], text, sizeof(text)), (unsigned long long) profile->idle[index[i]]);
+    }
+
+    n = hottest(profile->inclusive, CHIP8_MEMORY_CAPACITY, index, CHIP8_PROFILE_TOP);
+
+    if (n > 0) {
+        fprintf(out, "\n%-24s %12s %12s %7s\n", "subroutine", "calls", "inclusive", "%");
+    }
+
+    for (int i = 0; i < n; i++) {
+        uint16_t target = index[i];
+
+        fprintf(out, "%-24s %12llu %12llu %6.2f%%\n", symbolize(target, text, sizeof(text)),
+            (unsigned long long) profile->calls[target], (unsigned long long) profile->inclusive[target],
+            profile->inclusive[target] * 100 / (total + profile->skipped));
+
+        // and where it was called from
+        for (int j = 0; j < CHIP8_PROFILE_EDGES; j++) {
+            const chip8_profile_edge *e = &profile->edges[j];
+
+            if (e->count > 0 && e->target == target) {
+                fprintf(out, "  from %-17s %12llu\n", symbolize(e->site, site, sizeof(site)), (unsigned long long) e->count);
+            }
+        }
+    }
+
+    if (profile->lost > 0) {
+        fprintf(out, "%llu calls from call sites that did not fit in the table\n", (unsigned long long) profile->lost);
     }
 }
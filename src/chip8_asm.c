@@ -0,0 +1,1428 @@
+/************************************
+ * chip8_asm.c - the assembler, from source in memory
+ *               to a program image in memory
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8_internal.h"
+
+/**
+ * the symbol table
+ *
+ * labels in the order they were defined, for the map, and an
+ * open addressing hash table over them for looking them up.
+ * A slot holds an index into `symbols`, or -1 when empty. A
+ * label defined twice resolves to its last definition
+ */
+typedef struct {
+    chip8_asm_symbol *symbols;
+    int count;
+    int capacity;
+    int32_t *slots;
+    int nslots; // a power of two, kept over twice `count`
+} chip8_symtab;
+
+/**
+ * the mnemonic index
+ *
+ * every mnemonic once, with the optab entries that share it in
+ * table order, so a line only tries the operand variants of its
+ * own mnemonic. Reserved symbols are in it too, with no
+ * variants. It is built from optab the first time anything is
+ * assembled, and only read after that
+ */
+#define CHIP8_ASM_VARIANTS 16
+#define CHIP8_ASM_KEYWORDS 128
+
+typedef struct {
+    const char *name;
+    uint8_t count;
+    uint8_t variants[CHIP8_ASM_VARIANTS];
+} chip8_keyword;
+
+static chip8_keyword keywords[CHIP8_ASM_KEYWORDS];
+static pthread_once_t keywords_once = PTHREAD_ONCE_INIT;
+
+/**
+ * the source, mapped read-only, or read into memory when it
+ * cannot be mapped, like a pipe. Nothing is copied out of it
+ * while it is lexed
+ */
+typedef struct {
+    const char *text;
+    size_t size;
+    bool mapped;
+} chip8_source;
+
+/**
+ * a token: where it starts in the source, and how long it is
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} chip8_span;
+
+/**
+ * a line with something on it
+ *
+ * tokens are split on spaces, tabs and commas, and a comment
+ * runs from a semicolon to the end of the line. `text` covers
+ * the first token to the end of the last, for messages and for
+ * labels, which may have spaces in them. A mnemonic takes three
+ * operands at most, and any more are ignored
+ */
+#define CHIP8_ASM_TOKENS 4
+
+typedef struct {
+    int number; // from 1
+    uint32_t start; // where the line starts in the source
+    chip8_span text;
+    chip8_span tokens[CHIP8_ASM_TOKENS]; // the mnemonic, then the operands
+    int count;
+} chip8_line;
+
+typedef struct {
+    const chip8_source *source;
+    size_t pos;
+    int line;
+} chip8_lexer;
+
+/**
+ * fragments
+ *
+ * every file is assembled on its own, by whichever thread gets
+ * to it first, into a fragment that can be placed anywhere in
+ * the program: its bytes, cut into chunks at its INCLUDE lines,
+ * the labels it defines and the address operands it leaves to
+ * be filled in once all the labels are known (fixups). Labels
+ * and fixups are kept by their offset into the fragment's bytes
+ * and the chunk they are in. An operand that is a number is in
+ * the bytes already, and stays unless a label of the same name
+ * turns up. A fragment depends on nothing but the text of its
+ * file, so it can be cached under the hash of that text
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t chunk;
+    uint16_t base; // the word without the address
+    int line;
+    int column;
+    char symbol[32];
+} chip8_fixup;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t chunk;
+    char symbol[32];
+} chip8_label;
+
+/**
+ * the bytes up to `end`, then the file named on `line`, if any
+ */
+#define CHIP8_ASM_PATH 256
+#define CHIP8_ASM_ERROR 256 // as chip8_program has it
+
+typedef struct {
+    uint32_t end;
+    int line;
+    char include[CHIP8_ASM_PATH];
+} chip8_chunk;
+
+typedef struct chip8_fragment {
+    char *path; // as named, includes are found next to it
+    char *real; // the file it is, for telling includes apart
+    const char *text; // source given in memory, not read from `path`
+    size_t size;
+
+    uint8_t *bytes;
+    size_t nbytes, bytes_capacity;
+    chip8_fixup *fixups;
+    size_t nfixups, fixups_capacity;
+    chip8_label *labels;
+    size_t nlabels, labels_capacity;
+    chip8_chunk *chunks;
+    size_t nchunks, chunks_capacity;
+    struct chip8_fragment **targets; // the fragment each chunk includes
+
+    bool cached; // taken from the cache rather than assembled
+    bool unread; // the file could not be read
+    bool failed;
+    bool linking; // being laid out, to catch a file including itself
+    char error[CHIP8_ASM_ERROR];
+} chip8_fragment;
+
+/**
+ * the build
+ *
+ * fragments in the order they were found, the roots first. A
+ * thread takes the next one that has not been assembled, and
+ * queues the files it includes that are not there yet. Threads
+ * beyond the first are only started while there is more
+ * queued than there are threads waiting for work
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    chip8_fragment **fragments;
+    int count;
+    size_t capacity;
+    int next; // the next fragment to assemble
+    int busy; // threads assembling one
+    int waiting; // threads with nothing to do yet
+    pthread_t *threads;
+    int nthreads, jobs;
+    bool started; // the roots are all queued
+    const char *cache;
+    bool failed; // out of memory, or a thread could not be started
+} chip8_build;
+
+/**
+ * the program being linked, with every address operand to be
+ * filled in where it landed
+ */
+typedef struct {
+    uint32_t offset;
+    const chip8_fixup *fixup;
+    const chip8_fragment *fragment;
+} chip8_patch;
+
+typedef struct {
+    uint8_t *bytes;
+    size_t size, capacity;
+    chip8_patch *patches;
+    size_t npatches, patches_capacity;
+    chip8_symtab symtab;
+} chip8_image;
+
+/**
+ * cached fragments
+ *
+ * one file per fragment in the cache directory, named after the
+ * 64-bit FNV-1a hash of the source it was assembled from: this
+ * header, then the bytes, fixups, labels and chunks as they are
+ * in memory. A file that does not match the source it is looked
+ * up for is ignored, and replaced
+ */
+#define CHIP8_ASM_CACHE_MAGIC "C8FR"
+#define CHIP8_ASM_CACHE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    uint64_t size; // of the source
+    uint32_t nbytes, nfixups, nlabels, nchunks;
+} chip8_cache_header;
+
+/**
+ * leave a message in `error`, a program's or a fragment's
+ */
+static bool fail(char *error, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(error, CHIP8_ASM_ERROR, format, args);
+    va_end(args);
+
+    return false;
+}
+
+/**
+ * FNV-1a
+ */
+static uint32_t hash(const char *symbol, size_t length) {
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (uint8_t) symbol[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+/**
+ * whether the string `name` is the `length` characters at `symbol`
+ */
+static bool same(const char *name, const char *symbol, size_t length) {
+    return strncmp(name, symbol, length) == 0 && name[length] == '\0';
+}
+
+/**
+ * the slot `symbol` is in, or the empty one it would go in
+ */
+static chip8_keyword *keyword_slot(const char *symbol, size_t length) {
+    uint32_t i = hash(symbol, length);
+
+    while (keywords[i % CHIP8_ASM_KEYWORDS].name != NULL && !same(keywords[i % CHIP8_ASM_KEYWORDS].name, symbol, length)) {
+        i++;
+    }
+
+    return &keywords[i % CHIP8_ASM_KEYWORDS];
+}
+
+static void index_keywords(void) {
+    for (int i = 0; optab[i].mnemonic != NULL; i++) {
+        chip8_keyword *k = keyword_slot(optab[i].mnemonic, strlen(optab[i].mnemonic));
+
+        k->name = optab[i].mnemonic;
+        k->variants[k->count++] = i;
+    }
+
+    for (int i = 0; strcmp(asm_reserved[i], "") != 0; i++) {
+        keyword_slot(asm_reserved[i], strlen(asm_reserved[i]))->name = asm_reserved[i];
+    }
+}
+
+static const chip8_keyword *keyword(const char *symbol, size_t length) {
+    const chip8_keyword *k = keyword_slot(symbol, length);
+
+    return k->name != NULL ? k : NULL;
+}
+
+static bool reserved(const char *symbol, size_t length) {
+    return keyword(symbol, length) != NULL;
+}
+
+/**
+ * the slot `symbol` is in, or the empty one it would go in
+ */
+static int32_t *symbol_slot(const chip8_symtab *symtab, const char *symbol, size_t length) {
+    uint32_t mask = symtab->nslots - 1;
+    uint32_t i = hash(symbol, length) & mask;
+
+    while (symtab->slots[i] >= 0 && !same(symtab->symbols[symtab->slots[i]].symbol, symbol, length)) {
+        i = (i + 1) & mask;
+    }
+
+    return &symtab->slots[i];
+}
+
+static bool define(chip8_symtab *symtab, const char *symbol, size_t length, uint16_t address) {
+    if (symtab->count >= symtab->capacity) {
+        int capacity = symtab->capacity == 0 ? 64 : symtab->capacity * 2;
+        chip8_asm_symbol *symbols = realloc(symtab->symbols, capacity * sizeof(chip8_asm_symbol));
+
+        if (symbols == NULL) {
+            return false;
+        }
+
+        symtab->symbols = symbols;
+        symtab->capacity = capacity;
+    }
+
+    // keep the table under half full, rehashing into one twice the size
+    if (2 * (symtab->count + 1) > symtab->nslots) {
+        int nslots = symtab->nslots == 0 ? 128 : symtab->nslots * 2;
+        int32_t *slots = malloc(nslots * sizeof(int32_t));
+
+        if (slots == NULL) {
+            return false;
+        }
+
+        free(symtab->slots);
+        symtab->slots = slots;
+        symtab->nslots = nslots;
+        memset(slots, 0xFF, nslots * sizeof(int32_t));
+
+        for (int i = 0; i < symtab->count; i++) {
+            const char *defined = symtab->symbols[i].symbol;
+
+            *symbol_slot(symtab, defined, strlen(defined)) = i;
+        }
+    }
+
+    chip8_asm_symbol *entry = &symtab->symbols[symtab->count];
+
+    snprintf(entry->symbol, sizeof(entry->symbol), "%.*s", (int) length, symbol);
+    entry->address = address;
+    *symbol_slot(symtab, symbol, length) = symtab->count++;
+
+    return true;
+}
+
+static long lookup(const chip8_symtab *symtab, const char *symbol, size_t length) {
+    if (symtab->nslots == 0) {
+        return -1;
+    }
+
+    int32_t index = *symbol_slot(symtab, symbol, length);
+
+    return index >= 0 ? symtab->symbols[index].address : -1;
+}
+
+static bool load(const char *path, chip8_source *source) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    memset(source, 0, sizeof(*source));
+
+    if (fd < 0) {
+        return false;
+    }
+
+    // spans are 32-bit offsets into the source
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size > UINT32_MAX) {
+        close(fd);
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (text != MAP_FAILED) {
+            madvise(text, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+
+            source->text = text;
+            source->size = st.st_size;
+            source->mapped = true;
+
+            return true;
+        }
+    }
+
+    size_t capacity = 0;
+    char *text = NULL;
+
+    for (;;) {
+        if (source->size == capacity) {
+            capacity = capacity == 0 ? 65536 : capacity * 2;
+
+            char *grown = capacity <= UINT32_MAX ? realloc(text, capacity) : NULL;
+
+            if (grown == NULL) {
+                free(text);
+                close(fd);
+                return false;
+            }
+
+            text = grown;
+        }
+
+        ssize_t n = read(fd, text + source->size, capacity - source->size);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            free(text);
+            close(fd);
+            return false;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        source->size += n;
+    }
+
+    close(fd);
+    source->text = text;
+
+    return true;
+}
+
+static void unload(chip8_source *source) {
+    if (source->mapped) {
+        munmap((void *) source->text, source->size);
+    } else {
+        free((void *) source->text);
+    }
+
+    source->text = NULL;
+}
+
+/**
+ * what each byte is to the lexer: part of a token (0), a
+ * separator, or the start of a comment. A NUL ends the line
+ * as it would a string
+ */
+#define CHIP8_LEX_SEPARATOR 1
+#define CHIP8_LEX_COMMENT 2
+
+static const uint8_t lex_class[256] = {
+    ['\0'] = CHIP8_LEX_COMMENT,
+    ['\t'] = CHIP8_LEX_SEPARATOR,
+    ['\r'] = CHIP8_LEX_SEPARATOR,
+    [' '] = CHIP8_LEX_SEPARATOR,
+    [','] = CHIP8_LEX_SEPARATOR,
+    [';'] = CHIP8_LEX_COMMENT,
+};
+
+/**
+ * the next line with a token on it; false at the end of the
+ * source
+ */
+static bool lex(chip8_lexer *lexer, chip8_line *line) {
+    const char *text = lexer->source->text;
+    size_t size = lexer->source->size;
+
+    while (lexer->pos < size) {
+        size_t pos = lexer->pos;
+        const char *newline = memchr(text + pos, '\n', size - pos);
+        size_t end = newline != NULL ? (size_t) (newline - text) : size;
+
+        lexer->pos = end + 1;
+        line->number = ++lexer->line;
+        line->start = pos;
+        line->count = 0;
+
+        while (pos < end) {
+            uint8_t class = lex_class[(uint8_t) text[pos]];
+
+            if (class == CHIP8_LEX_COMMENT) {
+                break;
+            }
+
+            if (class == CHIP8_LEX_SEPARATOR) {
+                pos++;
+                continue;
+            }
+
+            size_t from = pos;
+
+            while (pos < end && lex_class[(uint8_t) text[pos]] == 0) {
+                pos++;
+            }
+
+            if (line->count == 0) {
+                line->text.offset = from;
+            }
+
+            if (line->count < CHIP8_ASM_TOKENS) {
+                line->tokens[line->count++] = (chip8_span) { from, pos - from };
+            }
+
+            line->text.length = pos - line->text.offset;
+        }
+
+        if (line->count > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * the value of a hex digit, or -1
+ */
+static int digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    c |= 0x20;
+
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/**
+ * parse a whole operand as a hex number no larger than `max`;
+ * a register name or a symbol like DT is not a number. What
+ * strtol takes in base 16 is taken: a sign, then a 0x that has
+ * digits after it, then the digits
+ */
+static bool number(const char *text, size_t length, long max, long *val) {
+    bool negative = false;
+    unsigned long n = 0;
+    size_t i = 0;
+
+    if (i < length && (text[i] == '+' || text[i] == '-')) {
+        negative = text[i++] == '-';
+    }
+
+    if (length - i > 2 && text[i] == '0' && (text[i + 1] | 0x20) == 'x' && digit(text[i + 2]) >= 0) {
+        i += 2;
+    }
+
+    if (i == length) {
+        return false;
+    }
+
+    for (; i < length; i++) {
+        int d = digit(text[i]);
+
+        if (d < 0 || (n = n * 16 + d) > (unsigned long) max) {
+            return false;
+        }
+    }
+
+    // -0 is 0, and is as good as any
+    if (negative && n != 0) {
+        return false;
+    }
+
+    *val = (long) n;
+
+    return true;
+}
+
+/**
+ * translate one instruction; an address operand is handed back
+ * in `label`, with the instruction without it in `base`, for
+ * the caller to fix up. The address is the last operand of
+ * every instruction that takes one
+ */
+static uint16_t assemble(const char *text, const chip8_line *line, const chip8_span **label, uint16_t *base) {
+    const chip8_keyword *k = keyword(text + line->tokens[0].offset, line->tokens[0].length);
+
+    for (int v = 0; k != NULL && v < k->count; v++) {
+        int i = k->variants[v];
+
+        // DB 0x00 translates to 0, so validity is tracked on its own
+        uint16_t translation = optab[i].opcode;
+        bool valid = true;
+
+        *label = NULL;
+
+        for (int j = 0; j < 3 && valid; j++) {
+            const chip8_span *operand = j + 1 < line->count ? &line->tokens[j + 1] : NULL;
+            const char *op = operand != NULL ? text + operand->offset : NULL;
+            size_t len = operand != NULL ? operand->length : 0;
+            long val = -1;
+
+            switch (optab[i].operands[j]) {
+                case CHIP8_OP_NONE: {
+                    valid = operand == NULL;
+                    break;
+                }
+                case CHIP8_OP_REG0: {
+                    valid = operand != NULL && same("V0", op, len);
+                    break;
+                }
+                case CHIP8_OP_REG4:
+                case CHIP8_OP_REG8: {
+                    if (operand == NULL || len != 2 || op[0] != 'V' || (val = digit(op[1])) < 0) {
+                        valid = false;
+                        break;
+                    }
+
+                    translation |= CHIP8_OP_REG8 == optab[i].operands[j]
+                                    ? (uint16_t) (val << 8)
+                                    : (uint16_t) (val << 4);
+
+                    break;
+                }
+                case CHIP8_OP_NIBBLE:
+                case CHIP8_OP_BYTE: {
+                    valid = operand != NULL && number(op, len, CHIP8_OP_NIBBLE == optab[i].operands[j] ? 0xF : 0xFF, &val);
+
+                    if (valid) {
+                        translation |= (uint16_t) val;
+                    }
+
+                    break;
+                }
+                case CHIP8_OP_SLAB: {
+                    // a label, perhaps one further on, or a number; either
+                    // is kept as the fixup's symbol, so neither may be longer
+                    if (operand == NULL || len > 30 || reserved(op, len)) {
+                        valid = false;
+                        break;
+                    }
+
+                    if (!number(op, len, CHIP8_ADDRESS_MASK, &val)) {
+                        val = 0;
+                    }
+
+                    *label = operand;
+                    *base = translation;
+                    translation |= (uint16_t) val;
+
+                    break;
+                }
+                case CHIP8_OP_DT: {
+                    valid = operand != NULL && same("DT", op, len);
+                    break;
+                }
+                case CHIP8_OP_ST: {
+                    valid = operand != NULL && same("ST", op, len);
+                    break;
+                }
+                case CHIP8_OP_IX: {
+                    valid = operand != NULL && same("I", op, len);
+                    break;
+                }
+                case CHIP8_OP_IXR: {
+                    valid = operand != NULL && same("[I]", op, len);
+                    break;
+                }
+                case CHIP8_OP_BCD: {
+                    valid = operand != NULL && same("B", op, len);
+                    break;
+                }
+                case CHIP8_OP_SPRITE: {
+                    valid = operand != NULL && same("F", op, len);
+                    break;
+                }
+                case CHIP8_OP_HF: {
+                    valid = operand != NULL && same("HF", op, len);
+                    break;
+                }
+                case CHIP8_OP_KEY: {
+                    valid = operand != NULL && same("K", op, len);
+                    break;
+                }
+                case CHIP8_OP_NULL: {
+                    valid = operand != NULL && number(op, len, 0, &val);
+                    break;
+                }
+                default:
+                    valid = false;
+                    break;
+            }
+        }
+
+        if (valid) {
+            return translation;
+        }
+    }
+
+    return 0xFFFF;
+}
+
+/**
+ * make room for one more of `count` items of `size` bytes
+ */
+static bool grow(void **items, size_t *capacity, size_t count, size_t size, size_t initial) {
+    if (count < *capacity) {
+        return true;
+    }
+
+    size_t grown = *capacity == 0 ? initial : *capacity * 2;
+    void *resized = realloc(*items, grown * size);
+
+    if (resized == NULL) {
+        return false;
+    }
+
+    *items = resized;
+    *capacity = grown;
+
+    return true;
+}
+
+static bool emit(chip8_fragment *fragment, const uint8_t *bytes, size_t size) {
+    if (fragment->nbytes + size > fragment->bytes_capacity) {
+        size_t capacity = fragment->bytes_capacity == 0 ? CHIP8_MEMORY_CAPACITY : fragment->bytes_capacity * 2;
+        uint8_t *grown = realloc(fragment->bytes, capacity);
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        fragment->bytes = grown;
+        fragment->bytes_capacity = capacity;
+    }
+
+    memcpy(&fragment->bytes[fragment->nbytes], bytes, size);
+    fragment->nbytes += size;
+
+    return true;
+}
+
+/**
+ * end the chunk at the bytes so far, naming the file to
+ * include after it, if any
+ */
+static bool cut(chip8_fragment *fragment, int line, const char *include, size_t length) {
+    if (!grow((void **) &fragment->chunks, &fragment->chunks_capacity, fragment->nchunks, sizeof(chip8_chunk), 16)) {
+        return false;
+    }
+
+    chip8_chunk *chunk = &fragment->chunks[fragment->nchunks++];
+
+    // zeroed, so the same source always caches to the same bytes
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->end = fragment->nbytes;
+    chunk->line = line;
+    memcpy(chunk->include, include, length);
+
+    return true;
+}
+
+static bool translate(chip8_fragment *fragment, const chip8_source *source) {
+    const char *text = source->text;
+    const char *path = fragment->path;
+    chip8_lexer lexer = { source, 0, 0 };
+    chip8_line line;
+
+    while (lex(&lexer, &line)) {
+        const char *stripped = text + line.text.offset;
+        int linelen = line.text.length;
+        const chip8_span *mnemonic = &line.tokens[0];
+
+        if (stripped[linelen - 1] == ':') {
+            if (linelen - 1 > 30) {
+                return fail(fragment->error, "Label %.*s exceeds maximum length of 32 characters on line %d of %s", linelen, stripped, line.number, path);
+            }
+
+            if (reserved(stripped, linelen - 1)) {
+                return fail(fragment->error, "Label %.*s is a reserved symbol on line %d of %s", linelen - 1, stripped, line.number, path);
+            }
+
+            if (!grow((void **) &fragment->labels, &fragment->labels_capacity, fragment->nlabels, sizeof(chip8_label), 64)) {
+                return fail(fragment->error, "Out of memory");
+            }
+
+            chip8_label *label = &fragment->labels[fragment->nlabels++];
+
+            memset(label, 0, sizeof(*label));
+            memcpy(label->symbol, stripped, linelen - 1);
+            label->offset = fragment->nbytes;
+            label->chunk = fragment->nchunks;
+
+            continue;
+        }
+
+        if (same("INCLUDE", text + mnemonic->offset, mnemonic->length)) {
+            if (line.count != 2 || line.tokens[1].length >= CHIP8_ASM_PATH) {
+                return fail(fragment->error, "INCLUDE takes one file name on line %d of %s: %.*s", line.number, path, linelen, stripped);
+            }
+
+            if (!cut(fragment, line.number, text + line.tokens[1].offset, line.tokens[1].length)) {
+                return fail(fragment->error, "Out of memory");
+            }
+
+            continue;
+        }
+
+        const chip8_span *label = NULL;
+        uint16_t base = 0;
+        uint16_t translation = assemble(text, &line, &label, &base);
+
+        if (translation == 0xFFFF) {
+            return fail(fragment->error, "Unrecognized instruction or directive on line %d of %s: %.*s", line.number, path, linelen, stripped);
+        }
+
+        if (label != NULL) {
+            if (!grow((void **) &fragment->fixups, &fragment->fixups_capacity, fragment->nfixups, sizeof(chip8_fixup), 256)) {
+                return fail(fragment->error, "Out of memory");
+            }
+
+            chip8_fixup *fixup = &fragment->fixups[fragment->nfixups++];
+
+            memset(fixup, 0, sizeof(*fixup));
+            fixup->offset = fragment->nbytes;
+            fixup->chunk = fragment->nchunks;
+            fixup->base = base;
+            fixup->line = line.number;
+            fixup->column = label->offset - line.start + 1;
+            memcpy(fixup->symbol, text + label->offset, label->length < sizeof(fixup->symbol) ? label->length : sizeof(fixup->symbol) - 1);
+        }
+
+        bool emitted;
+
+        if (same("DB", text + mnemonic->offset, mnemonic->length)) {
+            uint8_t translation_cast = (uint8_t) translation;
+            emitted = emit(fragment, &translation_cast, sizeof(uint8_t));
+        } else {
+            // CHIP-8 instructions are stored big-endian
+            uint8_t translation_bytes[2] = { translation >> 8, translation & 0xFF };
+            emitted = emit(fragment, translation_bytes, sizeof(translation_bytes));
+        }
+
+        if (!emitted) {
+            return fail(fragment->error, "Out of memory");
+        }
+    }
+
+    return true;
+}
+
+/**
+ * 64-bit FNV-1a, naming a source in the cache
+ */
+static uint64_t digest(const char *text, size_t size) {
+    uint64_t h = 14695981039346656037ull;
+
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ (uint8_t) text[i]) * 1099511628211ull;
+    }
+
+    return h;
+}
+
+static bool cache_load(const char *cache, uint64_t key, size_t size, chip8_fragment *fragment) {
+    char path[PATH_MAX];
+    chip8_cache_header header;
+
+    snprintf(path, sizeof(path), "%s/%016llx.c8o", cache, (unsigned long long) key);
+
+    FILE *in = fopen(path, "rb");
+
+    if (in == NULL) {
+        return false;
+    }
+
+    bool loaded = fread(&header, sizeof(header), 1, in) == 1
+        && memcmp(header.magic, CHIP8_ASM_CACHE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == CHIP8_ASM_CACHE_VERSION && header.hash == key && header.size == size
+        && header.nchunks > 0;
+
+    if (loaded) {
+        fragment->bytes = malloc(header.nbytes + 1);
+        fragment->fixups = malloc((header.nfixups + 1) * sizeof(chip8_fixup));
+        fragment->labels = malloc((header.nlabels + 1) * sizeof(chip8_label));
+        fragment->chunks = malloc(header.nchunks * sizeof(chip8_chunk));
+
+        loaded = fragment->bytes != NULL && fragment->fixups != NULL && fragment->labels != NULL && fragment->chunks != NULL
+            && fread(fragment->bytes, 1, header.nbytes, in) == header.nbytes
+            && fread(fragment->fixups, sizeof(chip8_fixup), header.nfixups, in) == header.nfixups
+            && fread(fragment->labels, sizeof(chip8_label), header.nlabels, in) == header.nlabels
+            && fread(fragment->chunks, sizeof(chip8_chunk), header.nchunks, in) == header.nchunks;
+    }
+
+    fclose(in);
+
+    fragment->nbytes = loaded ? header.nbytes : 0;
+    fragment->nfixups = loaded ? header.nfixups : 0;
+    fragment->nlabels = loaded ? header.nlabels : 0;
+    fragment->nchunks = loaded ? header.nchunks : 0;
+
+    // a file that is not what it should be is assembled over
+    for (size_t i = 0; loaded && i < fragment->nchunks; i++) {
+        fragment->chunks[i].include[CHIP8_ASM_PATH - 1] = '\0';
+        loaded = fragment->chunks[i].end <= fragment->nbytes && (i == 0 || fragment->chunks[i].end >= fragment->chunks[i - 1].end);
+    }
+
+    // labels and fixups are linked relative to the start of their
+    // chunk, so one outside it would land outside the image
+    for (size_t i = 0; loaded && i < fragment->nlabels; i++) {
+        const chip8_label *l = &fragment->labels[i];
+
+        fragment->labels[i].symbol[sizeof(fragment->labels[i].symbol) - 1] = '\0';
+        loaded = l->chunk < fragment->nchunks && (i == 0 || l->chunk >= fragment->labels[i - 1].chunk)
+            && l->offset >= (l->chunk == 0 ? 0 : fragment->chunks[l->chunk - 1].end)
+            && l->offset <= fragment->chunks[l->chunk].end;
+    }
+
+    for (size_t i = 0; loaded && i < fragment->nfixups; i++) {
+        const chip8_fixup *f = &fragment->fixups[i];
+
+        fragment->fixups[i].symbol[sizeof(fragment->fixups[i].symbol) - 1] = '\0';
+        loaded = f->chunk < fragment->nchunks && (i == 0 || f->chunk >= fragment->fixups[i - 1].chunk)
+            && f->offset >= (f->chunk == 0 ? 0 : fragment->chunks[f->chunk - 1].end)
+            && (uint64_t) f->offset + 2 <= fragment->chunks[f->chunk].end;
+    }
+
+    if (!loaded) {
+        free(fragment->bytes);
+        free(fragment->fixups);
+        free(fragment->labels);
+        free(fragment->chunks);
+
+        fragment->bytes = NULL;
+        fragment->fixups = NULL;
+        fragment->labels = NULL;
+        fragment->chunks = NULL;
+        fragment->nbytes = fragment->nfixups = fragment->nlabels = fragment->nchunks = 0;
+    }
+
+    fragment->bytes_capacity = fragment->nbytes;
+    fragment->fixups_capacity = fragment->nfixups;
+    fragment->labels_capacity = fragment->nlabels;
+    fragment->chunks_capacity = fragment->nchunks;
+
+    return loaded;
+}
+
+/**
+ * written to a file of its own and renamed into place, so
+ * builds running at the same time never see half a fragment
+ */
+static void cache_store(const char *cache, uint64_t key, size_t size, const chip8_fragment *fragment) {
+    char path[PATH_MAX], temp[PATH_MAX];
+    chip8_cache_header header = {
+        .magic = CHIP8_ASM_CACHE_MAGIC,
+        .version = CHIP8_ASM_CACHE_VERSION,
+        .hash = key,
+        .size = size,
+        .nbytes = fragment->nbytes,
+        .nfixups = fragment->nfixups,
+        .nlabels = fragment->nlabels,
+        .nchunks = fragment->nchunks,
+    };
+
+    snprintf(path, sizeof(path), "%s/%016llx.c8o", cache, (unsigned long long) key);
+    snprintf(temp, sizeof(temp), "%s/.%016llx.XXXXXX", cache, (unsigned long long) key);
+
+    int fd = mkstemp(temp);
+    FILE *out = fd >= 0 ? fdopen(fd, "wb") : NULL;
+
+    if (out == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp);
+        }
+
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1
+        && fwrite(fragment->bytes, 1, fragment->nbytes, out) == fragment->nbytes
+        && fwrite(fragment->fixups, sizeof(chip8_fixup), fragment->nfixups, out) == fragment->nfixups
+        && fwrite(fragment->labels, sizeof(chip8_label), fragment->nlabels, out) == fragment->nlabels
+        && fwrite(fragment->chunks, sizeof(chip8_chunk), fragment->nchunks, out) == fragment->nchunks;
+
+    if (fclose(out) != 0 || !written || rename(temp, path) != 0) {
+        unlink(temp);
+    }
+}
+
+static void *helper(void *arg);
+
+/**
+ * another thread, while there is more queued than there are
+ * threads waiting to take it; called with the lock held
+ */
+static void spawn(chip8_build *build) {
+    while (build->count - build->next > build->waiting && build->nthreads < build->jobs - 1) {
+        if (pthread_create(&build->threads[build->nthreads], NULL, helper, build) != 0) {
+            break;
+        }
+
+        build->nthreads++;
+        build->waiting++; // until it takes something
+    }
+}
+
+/**
+ * the fragment for the file at `path`, queued to be assembled
+ * if it is new; NULL if there is no such file, or no memory.
+ * Takes `path`. A root is queued even if it cannot be found,
+ * to fail when it is read
+ */
+static chip8_fragment *intern(chip8_build *build, char *path, bool root) {
+    char *real = realpath(path, NULL);
+
+    if (real == NULL && root) {
+        real = strdup(path);
+    }
+
+    if (real == NULL) {
+        free(path);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&build->lock);
+
+    for (int i = 0; i < build->count; i++) {
+        if (build->fragments[i]->real != NULL && strcmp(build->fragments[i]->real, real) == 0) {
+            chip8_fragment *found = build->fragments[i];
+
+            pthread_mutex_unlock(&build->lock);
+            free(path);
+            free(real);
+
+            return found;
+        }
+    }
+
+    chip8_fragment *fragment = calloc(1, sizeof(chip8_fragment));
+
+    if (fragment == NULL || !grow((void **) &build->fragments, &build->capacity, build->count, sizeof(chip8_fragment *), 16)) {
+        build->failed = true;
+        pthread_mutex_unlock(&build->lock);
+        free(fragment);
+        free(path);
+        free(real);
+
+        return NULL;
+    }
+
+    fragment->path = path;
+    fragment->real = real;
+    build->fragments[build->count++] = fragment;
+
+    if (build->started) {
+        spawn(build);
+    }
+
+    pthread_cond_signal(&build->work);
+    pthread_mutex_unlock(&build->lock);
+
+    return fragment;
+}
+
+/**
+ * find the files the fragment includes, next to it, and queue
+ * the ones not seen yet. One that cannot be found is the
+ * fragment's error, on its line, and ends it there
+ */
+static void include(chip8_build *build, chip8_fragment *fragment) {
+    const char *slash = strrchr(fragment->path, '/');
+    int dir = slash != NULL ? (int) (slash - fragment->path) + 1 : 0;
+
+    if ((fragment->targets = calloc(fragment->nchunks + 1, sizeof(chip8_fragment *))) == NULL) {
+        fragment->failed = true;
+        fragment->nchunks = 0;
+        fail(fragment->error, "Out of memory");
+        return;
+    }
+
+    for (size_t i = 0; i < fragment->nchunks; i++) {
+        chip8_chunk *chunk = &fragment->chunks[i];
+        size_t size = dir + strlen(chunk->include) + 1;
+        char *path;
+
+        if (chunk->include[0] == '\0') {
+            continue;
+        }
+
+        if ((path = malloc(size)) != NULL) {
+            snprintf(path, size, "%.*s%s", chunk->include[0] == '/' ? 0 : dir, fragment->path, chunk->include);
+        }
+
+        if (path == NULL || (fragment->targets[i] = intern(build, path, false)) == NULL) {
+            fail(fragment->error, "Error opening file %s included on line %d of %s", chunk->include, chunk->line, fragment->path);
+            fragment->failed = true;
+            chunk->include[0] = '\0';
+            fragment->nchunks = i + 1;
+            return;
+        }
+    }
+}
+
+static void process(chip8_build *build, chip8_fragment *fragment) {
+    chip8_source source = { fragment->text, fragment->size, false };
+    bool file = fragment->text == NULL;
+
+    if (file && !load(fragment->path, &source)) {
+        fragment->unread = fragment->failed = true;
+        fail(fragment->error, "Error opening file %s", fragment->path);
+        return;
+    }
+
+    uint64_t key = build->cache != NULL && file ? digest(source.text, source.size) : 0;
+
+    fragment->cached = build->cache != NULL && file && cache_load(build->cache, key, source.size, fragment);
+
+    if (!fragment->cached) {
+        fragment->failed = !translate(fragment, &source);
+
+        // the last chunk runs to the end, or to the line that failed
+        if (!cut(fragment, 0, "", 0)) {
+            fragment->failed = true;
+            fragment->nchunks = 0;
+            fail(fragment->error, "Out of memory");
+        }
+
+        if (!fragment->failed && build->cache != NULL && file) {
+            cache_store(build->cache, key, source.size, fragment);
+        }
+    }
+
+    if (file) {
+        unload(&source);
+    }
+
+    include(build, fragment);
+}
+
+static void *worker(void *arg) {
+    chip8_build *build = arg;
+
+    pthread_mutex_lock(&build->lock);
+
+    for (;;) {
+        if (build->next < build->count) {
+            chip8_fragment *fragment = build->fragments[build->next++];
+
+            build->busy++;
+            pthread_mutex_unlock(&build->lock);
+            process(build, fragment);
+            pthread_mutex_lock(&build->lock);
+            build->busy--;
+            continue;
+        }
+
+        // nothing queued, and nobody left to queue anything
+        if (build->busy == 0) {
+            break;
+        }
+
+        build->waiting++;
+        pthread_cond_wait(&build->work, &build->lock);
+        build->waiting--;
+    }
+
+    pthread_cond_broadcast(&build->work);
+    pthread_mutex_unlock(&build->lock);
+
+    return NULL;
+}
+
+/**
+ * a thread started by spawn(), which counted it as waiting
+ */
+static void *helper(void *arg) {
+    chip8_build *build = arg;
+
+    pthread_mutex_lock(&build->lock);
+    build->waiting--;
+    pthread_mutex_unlock(&build->lock);
+
+    return worker(build);
+}
+
+/**
+ * lay the fragment out at the end of the image, with the files
+ * it includes where it includes them, and define its labels in
+ * the order they are in the source
+ */
+static bool link_fragment(chip8_program *program, chip8_image *image, chip8_fragment *fragment) {
+    size_t label = 0, fixup = 0;
+    uint32_t from = 0;
+
+    if (fragment->linking) {
+        return fail(program->error, "%s includes itself", fragment->path);
+    }
+
+    fragment->linking = true;
+
+    for (uint32_t c = 0; c < fragment->nchunks; c++) {
+        const chip8_chunk *chunk = &fragment->chunks[c];
+        size_t base = image->size;
+        size_t size = chunk->end - from;
+
+        if (image->size + size > image->capacity) {
+            size_t capacity = image->capacity == 0 ? CHIP8_MEMORY_CAPACITY : image->capacity;
+
+            while (capacity < image->size + size) {
+                capacity *= 2;
+            }
+
+            uint8_t *grown = realloc(image->bytes, capacity);
+
+            if (grown == NULL) {
+                return fail(program->error, "Out of memory");
+            }
+
+            image->bytes = grown;
+            image->capacity = capacity;
+        }
+
+        memcpy(&image->bytes[base], &fragment->bytes[from], size);
+        image->size += size;
+
+        for (; label < fragment->nlabels && fragment->labels[label].chunk == c; label++) {
+            const chip8_label *l = &fragment->labels[label];
+
+            if (!define(&image->symtab, l->symbol, strlen(l->symbol), CHIP8_PROGRAM_START + base + l->offset - from)) {
+                return fail(program->error, "Out of memory");
+            }
+        }
+
+        for (; fixup < fragment->nfixups && fragment->fixups[fixup].chunk == c; fixup++) {
+            if (!grow((void **) &image->patches, &image->patches_capacity, image->npatches, sizeof(chip8_patch), 256)) {
+                return fail(program->error, "Out of memory");
+            }
+
+            image->patches[image->npatches++] = (chip8_patch) {
+                base + fragment->fixups[fixup].offset - from, &fragment->fixups[fixup], fragment
+            };
+        }
+
+        if (fragment->targets[c] != NULL && !link_fragment(program, image, fragment->targets[c])) {
+            return false;
+        }
+
+        from = chunk->end;
+    }
+
+    fragment->linking = false;
+
+    if (fragment->failed) {
+        return fail(program->error, "%s", fragment->error);
+    }
+
+    return true;
+}
+
+/**
+ * fill in the address operands now that every label is known;
+ * a label wins over a number of the same name, as it would have
+ * had it been defined first
+ */
+static bool resolve(chip8_program *program, chip8_image *image) {
+    for (size_t i = 0; i < image->npatches; i++) {
+        const chip8_patch *patch = &image->patches[i];
+        const chip8_fixup *fixup = patch->fixup;
+        size_t length = strlen(fixup->symbol);
+        long val = lookup(&image->symtab, fixup->symbol, length);
+
+        if (val == -1 && !number(fixup->symbol, length, CHIP8_ADDRESS_MASK, &val)) {
+            return fail(program->error, "Undefined label %s on line %d, column %d of %s",
+                fixup->symbol, fixup->line, fixup->column, patch->fragment->path);
+        }
+
+        uint16_t translation = fixup->base | (uint16_t) val;
+
+        image->bytes[patch->offset] = translation >> 8;
+        image->bytes[patch->offset + 1] = translation & 0xFF;
+    }
+
+    return true;
+}
+
+/**
+ * assemble every file from the roots on, then link the roots
+ * one after another
+ */
+static bool build_program(chip8_program *program, chip8_build *build, chip8_fragment **roots, int nroots, const chip8_asm_options *options) {
+    chip8_image image = { 0 };
+    bool built = !build->failed || fail(program->error, "Out of memory");
+
+    pthread_once(&keywords_once, index_keywords);
+
+    if (built && options != NULL && options->cache != NULL && mkdir(options->cache, 0755) != 0 && errno != EEXIST) {
+        built = fail(program->error, "Error creating cache %s", options->cache);
+    }
+
+    if (built) {
+        build->cache = options != NULL ? options->cache : NULL;
+
+        pthread_mutex_lock(&build->lock);
+        build->started = true;
+        build->waiting++; // this thread, which is about to take the first
+        spawn(build);
+        build->waiting--;
+        pthread_mutex_unlock(&build->lock);
+
+        worker(build);
+
+        for (int i = 0; i < build->nthreads; i++) {
+            pthread_join(build->threads[i], NULL);
+        }
+
+        built = !build->failed || fail(program->error, "Out of memory");
+    }
+
+    for (int i = 0; built && i < nroots; i++) {
+        if (!(built = link_fragment(program, &image, roots[i]))) {
+            program->unread = roots[i]->unread;
+        }
+    }
+
+    built = built && resolve(program, &image);
+
+    program->image = image.bytes;
+    program->size = image.size;
+    program->symbols = image.symtab.symbols;
+    program->nsymbols = image.symtab.count;
+    program->files = build->count;
+
+    for (int i = 0; i < build->count; i++) {
+        chip8_fragment *fragment = build->fragments[i];
+
+        program->cached += fragment->cached;
+
+        free(fragment->path);
+        free(fragment->real);
+        free(fragment->bytes);
+        free(fragment->fixups);
+        free(fragment->labels);
+        free(fragment->chunks);
+        free(fragment->targets);
+        free(fragment);
+    }
+
+    free(build->fragments);
+    free(build->threads);
+    free(image.patches);
+    free(image.symtab.slots);
+    pthread_mutex_destroy(&build->lock);
+    pthread_cond_destroy(&build->work);
+
+    return built;
+}
+
+static void start(chip8_build *build, const chip8_asm_options *options) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(build, 0, sizeof(*build));
+    pthread_mutex_init(&build->lock, NULL);
+    pthread_cond_init(&build->work, NULL);
+
+    build->jobs = options != NULL && options->jobs > 0 ? options->jobs : (cpus > 0 ? cpus : 1);
+    build->threads = calloc(build->jobs, sizeof(pthread_t));
+    build->failed = build->threads == NULL;
+}
+
+bool chip8_asm_buffer(chip8_program *program, const char *source, size_t size) {
+    chip8_build build;
+    chip8_fragment *root = calloc(1, sizeof(chip8_fragment));
+
+    if ((uint64_t) size > UINT32_MAX) {
+        free(root);
+        return fail(program->error, "Source too large");
+    }
+
+    start(&build, NULL);
+
+    // not a file, so not cached; it includes from the working directory
+    if (root == NULL || (root->path = strdup("<buffer>")) == NULL
+            || !grow((void **) &build.fragments, &build.capacity, 0, sizeof(chip8_fragment *), 16)) {
+        build.failed = true;
+        free(root != NULL ? root->path : NULL);
+        free(root);
+        root = NULL;
+    } else {
+        root->text = source;
+        root->size = size;
+        build.fragments[build.count++] = root;
+    }
+
+    return build_program(program, &build, &root, root != NULL, NULL);
+}
+
+bool chip8_asm_files(chip8_program *program, const char *const *paths, int count, const chip8_asm_options *options) {
+    chip8_build build;
+    chip8_fragment **roots = calloc(count > 0 ? count : 1, sizeof(chip8_fragment *));
+
+    start(&build, options);
+
+    // a file given twice is one fragment, linked twice
+    for (int i = 0; !build.failed && roots != NULL && i < count; i++) {
+        char *path = strdup(paths[i]);
+
+        if (path == NULL || (roots[i] = intern(&build, path, true)) == NULL) {
+            build.failed = true;
+        }
+    }
+
+    build.failed |= roots == NULL;
+
+    bool built = build_program(program, &build, roots, count, options);
+
+    free(roots);
+
+    return built;
+}
+
+bool chip8_asm_file(chip8_program *program, const char *path) {
+    return chip8_asm_files(program, &path, 1, NULL);
+}
+
+void chip8_asm_free(chip8_program *program) {
+    free(program->image);
+    free(program->symbols);
+
+    program->image = NULL;
+    program->symbols = NULL;
+}
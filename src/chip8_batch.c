@@ -0,0 +1,482 @@
+/************************************
+ * chip8_batch.c - lockstep execution of a batch of
+ *                 CHIP-8 machines in SIMD lanes
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_internal.h"
+
+/**
+ * one byte per lane; GCC lowers operations on these to AVX2 or
+ * SSE2 instructions, and the vector comparisons give 0xFF in
+ * every lane where they hold
+ */
+typedef uint8_t chip8_lanes __attribute__((vector_size(CHIP8_BATCH_LANES)));
+
+// rows are accessed without assuming the batch itself was allocated aligned
+typedef uint8_t chip8_row __attribute__((vector_size(CHIP8_BATCH_LANES), aligned(1)));
+
+#define ROW(batch, reg) (*(chip8_row *) (batch)->v[reg])
+
+static inline bool diverged(const chip8_batch *batch, uint16_t addr) {
+    return batch->diverged[addr >> 3] & (1 << (addr & 7));
+}
+
+static void diverge(chip8_batch *batch, uint16_t addr, uint16_t len) {
+    for (int i = 0; i < len; i++) {
+        uint16_t a = (addr + i) & CHIP8_ADDRESS_MASK;
+        batch->diverged[a >> 3] |= 1 << (a & 7);
+    }
+}
+
+/**
+ * move a lane's registers between its machine and the columns
+ */
+static void gather(chip8_batch *batch, int lane) {
+    chip8_vm *vm = &batch->lanes[lane];
+
+    for (int r = 0; r < CHIP8_GP_REGS; r++) {
+        batch->v[r][lane] = vm->rs1[r];
+    }
+
+    batch->pc[lane] = vm->rs2[CHIP8_PC];
+    batch->ix[lane] = vm->rs2[CHIP8_IX];
+}
+
+static void scatter(chip8_batch *batch, int lane) {
+    chip8_vm *vm = &batch->lanes[lane];
+
+    for (int r = 0; r < CHIP8_GP_REGS; r++) {
+        vm->rs1[r] = batch->v[r][lane];
+    }
+
+    vm->rs2[CHIP8_PC] = batch->pc[lane];
+    vm->rs2[CHIP8_IX] = batch->ix[lane];
+}
+
+bool chip8_batch_init(chip8_batch *batch, int count) {
+    if (count < 1 || count > CHIP8_BATCH_LANES) {
+        return false;
+    }
+
+    if ((batch->lanes = calloc(count, sizeof(chip8_vm))) == NULL) {
+        return false;
+    }
+
+    batch->count = count;
+
+    for (int i = 0; i < count; i++) {
+        chip8_vm_init(&batch->lanes[i]);
+    }
+
+    chip8_batch_reset(batch);
+
+    return true;
+}
+
+void chip8_batch_reset(chip8_batch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        chip8_vm_reset(&batch->lanes[i]);
+        batch->lanes[i].rng ^= i * CHIP8_BATCH_SEED;
+        batch->executed[i] = 0;
+        gather(batch, i);
+    }
+
+    memset(batch->diverged, 0, sizeof(batch->diverged));
+    memset(batch->parked, 0, sizeof(batch->parked));
+}
+
+void chip8_batch_free(chip8_batch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        chip8_vm_free(&batch->lanes[i]);
+    }
+
+    free(batch->lanes);
+    batch->lanes = NULL;
+    batch->count = 0;
+}
+
+uint16_t chip8_batch_load_buffer(chip8_batch *batch, const uint8_t *program, size_t size) {
+    uint16_t loaded = 0;
+
+    for (int i = 0; i < batch->count; i++) {
+        loaded = chip8_vm_load_buffer(&batch->lanes[i], program, size);
+        gather(batch, i);
+    }
+
+    return loaded;
+}
+
+void chip8_batch_tick(chip8_batch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        chip8_vm_tick(&batch->lanes[i]);
+    }
+}
+
+void chip8_batch_sync(chip8_batch *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        scatter(batch, i);
+    }
+}
+
+/**
+ * expand a lane bitmask into 0xFF/0x00 bytes for blending
+ */
+static inline void lane_mask(chip8_lanes *m, uint32_t mask) {
+    chip8_lanes bit, byte;
+
+    for (int i = 0; i < CHIP8_BATCH_LANES; i++) {
+        bit[i] = 1 << (i & 7);
+        byte[i] = mask >> (i & ~7);
+    }
+
+    *m = (chip8_lanes) ((byte & bit) != 0);
+}
+
+static inline uint32_t lane_bits(const chip8_lanes *m) {
+    uint32_t mask = 0;
+
+    for (int i = 0; i < CHIP8_BATCH_LANES; i++) {
+        mask |= (uint32_t) ((*m)[i] & 1) << i;
+    }
+
+    return mask;
+}
+
+static inline bool lanes_zero(const chip8_lanes *m) {
+    uint64_t words[CHIP8_BATCH_LANES / 8];
+    memcpy(words, m, sizeof(words));
+
+    uint64_t any = 0;
+
+    for (int i = 0; i < CHIP8_BATCH_LANES / 8; i++) {
+        any |= words[i];
+    }
+
+    return any == 0;
+}
+
+/**
+ * a group of lanes at the same pc, stepped together
+ *
+ * `k` instructions have been run by every lane in `mask` since
+ * their budgets were last brought up to date, and `n` is the
+ * smallest budget among them
+ */
+typedef struct {
+    uint32_t mask;
+    chip8_lanes m;
+    uint64_t k;
+    uint64_t n;
+} chip8_group;
+
+/**
+ * settle the budgets of the group, all of it now at `pc`, let
+ * the lanes in `join` in, and drop the lanes that have run out
+ */
+static inline __attribute__((always_inline))
+void settle(chip8_batch *batch, chip8_group *g, uint64_t *left, uint16_t pc, uint32_t join) {
+    g->n = UINT64_MAX;
+
+    for (uint32_t rest = g->mask | join; rest != 0; rest &= rest - 1) {
+        int lane = __builtin_ctz(rest);
+        uint64_t k = join >> lane & 1 ? 0 : g->k;
+
+        g->mask |= 1u << lane;
+        batch->pc[lane] = pc;
+        batch->executed[lane] += k;
+        left[lane] -= k;
+
+        if (left[lane] == 0) {
+            g->mask &= ~(1u << lane);
+        } else if (left[lane] < g->n) {
+            g->n = left[lane];
+        }
+    }
+
+    g->k = 0;
+    lane_mask(&g->m, g->mask);
+}
+
+/**
+ * take `lanes`, whose pc has already been set, out of the
+ * group; those that can still run wait at their pc
+ */
+static inline __attribute__((always_inline))
+void leave(chip8_batch *batch, chip8_group *g, uint64_t *left, uint32_t lanes) {
+    for (uint32_t rest = lanes; rest != 0; rest &= rest - 1) {
+        int lane = __builtin_ctz(rest);
+
+        batch->executed[lane] += g->k;
+        left[lane] -= g->k;
+
+        // a lane only halts on the reference core, and always
+        // leaves the group when it does
+        if (batch->lanes[lane].halted) {
+            left[lane] = 0;
+        } else if (left[lane] != 0) {
+            batch->parked[batch->pc[lane]] |= 1u << lane;
+        }
+    }
+
+    g->mask &= ~lanes;
+    lane_mask(&g->m, g->mask);
+}
+
+/**
+ * run the lanes in `mask`, all at `pc`, until every one of them
+ * has halted or used up its budget. Lanes that branch away from
+ * the rest are parked where they went, and join again when the
+ * group reaches them
+ */
+CHIP8_TARGET_CLONES
+static void run_group(chip8_batch *batch, uint32_t mask, uint16_t pc, uint64_t *left) {
+    chip8_group g = { .mask = mask, .k = 0 };
+
+    settle(batch, &g, left, pc, 0);
+
+    while (g.mask != 0) {
+        if (g.k == g.n) {
+            settle(batch, &g, left, pc, 0);
+            continue;
+        }
+
+        int leader = __builtin_ctz(g.mask);
+        uint16_t word = fetch(&batch->lanes[leader], pc);
+
+        // lanes whose copy of this instruction was rewritten wait their turn
+        if (diverged(batch, pc) || diverged(batch, (pc + 1) & CHIP8_ADDRESS_MASK)) {
+            uint32_t other = 0;
+
+            for (uint32_t rest = g.mask & (g.mask - 1); rest != 0; rest &= rest - 1) {
+                int lane = __builtin_ctz(rest);
+
+                if (fetch(&batch->lanes[lane], pc) != word) {
+                    batch->pc[lane] = pc;
+                    other |= 1u << lane;
+                }
+            }
+
+            leave(batch, &g, left, other);
+        }
+
+        const chip8_decoded *d = decode(word);
+        chip8_lanes x = ROW(batch, d->vx);
+        chip8_lanes y = ROW(batch, d->vy);
+        chip8_lanes m = g.m;
+        chip8_lanes zero = { 0 };
+        chip8_lanes r, flag = zero, taken, stayed;
+        bool has_flag = false;
+
+        g.k++;
+
+        switch (d->handler) {
+            case CHIP8_H_LD_BYTE:
+                r = zero + d->byte;
+                break;
+            case CHIP8_H_ADD_BYTE:
+                r = x + d->byte;
+                break;
+            case CHIP8_H_LD_REG:
+                r = y;
+                break;
+            case CHIP8_H_OR:
+                r = x | y;
+                break;
+            case CHIP8_H_AND:
+                r = x & y;
+                break;
+            case CHIP8_H_XOR:
+                r = x ^ y;
+                break;
+            case CHIP8_H_ADD_REG:
+                r = x + y;
+                flag = (chip8_lanes) (r < x) & 1;
+                has_flag = true;
+                break;
+            case CHIP8_H_SUB:
+                r = x - y;
+                flag = (chip8_lanes) (x >= y) & 1;
+                has_flag = true;
+                break;
+            case CHIP8_H_SHR:
+                r = x >> 1;
+                flag = x & 1;
+                has_flag = true;
+                break;
+            case CHIP8_H_SUBN:
+                r = y - x;
+                flag = (chip8_lanes) (y >= x) & 1;
+                has_flag = true;
+                break;
+            case CHIP8_H_SHL:
+                r = x << 1;
+                flag = x >> 7;
+                has_flag = true;
+                break;
+            case CHIP8_H_SE_BYTE:
+                taken = (chip8_lanes) (x == d->byte);
+                goto skip;
+            case CHIP8_H_SNE_BYTE:
+                taken = (chip8_lanes) (x != d->byte);
+                goto skip;
+            case CHIP8_H_SE_REG:
+                taken = (chip8_lanes) (x == y);
+                goto skip;
+            case CHIP8_H_SNE_REG:
+                taken = (chip8_lanes) (x != y);
+                goto skip;
+            case CHIP8_H_JP:
+                pc = d->slab;
+                goto next;
+            case CHIP8_H_LD_ADDR:
+                for (uint32_t rest = g.mask; rest != 0; rest &= rest - 1) {
+                    batch->ix[__builtin_ctz(rest)] = d->slab;
+                }
+
+                pc = (pc + 2) & CHIP8_ADDRESS_MASK;
+                goto next;
+            case CHIP8_H_RND_BYTE:
+                for (uint32_t rest = g.mask; rest != 0; rest &= rest - 1) {
+                    int lane = __builtin_ctz(rest);
+                    batch->v[d->vx][lane] = rnd(&batch->lanes[lane]) & d->byte;
+                }
+
+                pc = (pc + 2) & CHIP8_ADDRESS_MASK;
+                goto next;
+            default:
+                goto scalar;
+        }
+
+        // masked write-back, the flag last as in the reference core
+        ROW(batch, d->vx) = (r & m) | (x & ~m);
+
+        if (has_flag) {
+            ROW(batch, CHIP8_VF) = (flag & m) | (ROW(batch, CHIP8_VF) & ~m);
+        }
+
+        pc = (pc + 2) & CHIP8_ADDRESS_MASK;
+        goto next;
+
+skip:
+        taken &= m;
+        stayed = taken ^ m;
+
+        if (lanes_zero(&taken)) {
+            pc = (pc + 2) & CHIP8_ADDRESS_MASK;
+        } else if (lanes_zero(&stayed)) {
+            pc = (pc + 4) & CHIP8_ADDRESS_MASK;
+        } else {
+            // the lanes that skipped wait two bytes ahead
+            uint32_t skipped = lane_bits(&taken);
+
+            for (uint32_t rest = skipped; rest != 0; rest &= rest - 1) {
+                batch->pc[__builtin_ctz(rest)] = (pc + 4) & CHIP8_ADDRESS_MASK;
+            }
+
+            leave(batch, &g, left, skipped);
+            pc = (pc + 2) & CHIP8_ADDRESS_MASK;
+        }
+
+        goto next;
+
+scalar:
+        // everything else runs lane by lane on the reference core
+        {
+            uint16_t low = CHIP8_MEMORY_CAPACITY;
+            bool uniform = true;
+
+            for (uint32_t rest = g.mask; rest != 0; rest &= rest - 1) {
+                int lane = __builtin_ctz(rest);
+                chip8_vm *vm = &batch->lanes[lane];
+
+                batch->pc[lane] = (pc + 2) & CHIP8_ADDRESS_MASK;
+                scatter(batch, lane);
+                execute(vm, d);
+                gather(batch, lane);
+
+                if (d->handler == CHIP8_H_LDS_BCD || d->handler == CHIP8_H_LDS_REGS) {
+                    diverge(batch, vm->rs2[CHIP8_IX], d->handler == CHIP8_H_LDS_BCD ? 3 : d->vx + 1);
+                }
+
+                uniform &= !vm->halted && (low == CHIP8_MEMORY_CAPACITY || batch->pc[lane] == low);
+
+                if (!vm->halted && batch->pc[lane] < low) {
+                    low = batch->pc[lane];
+                }
+            }
+
+            if (!uniform) {
+                // carry on with the lanes furthest behind
+                uint32_t away = 0;
+
+                for (uint32_t rest = g.mask; rest != 0; rest &= rest - 1) {
+                    int lane = __builtin_ctz(rest);
+
+                    if (batch->lanes[lane].halted || batch->pc[lane] != low) {
+                        away |= 1u << lane;
+                    }
+                }
+
+                leave(batch, &g, left, away);
+
+                if (g.mask == 0) {
+                    break;
+                }
+            }
+
+            pc = low;
+        }
+
+next:
+        // pick up lanes waiting here
+        if (batch->parked[pc] != 0) {
+            settle(batch, &g, left, pc, batch->parked[pc]);
+            batch->parked[pc] = 0;
+        }
+    }
+}
+
+uint64_t chip8_batch_run(chip8_batch *batch, uint64_t cycles) {
+    uint64_t left[CHIP8_BATCH_LANES] = { 0 };
+    uint64_t before = 0, after = 0;
+
+    for (int i = 0; i < batch->count; i++) {
+        before += batch->executed[i];
+
+        if (!batch->lanes[i].halted) {
+            left[i] = cycles == 0 ? UINT64_MAX : cycles;
+            batch->parked[batch->pc[i]] |= 1u << i;
+        }
+    }
+
+    for (;;) {
+        uint16_t pc = CHIP8_MEMORY_CAPACITY;
+
+        // the lanes furthest behind go first, so that the ones
+        // that went ahead can be caught up with and joined
+        for (int i = 0; i < batch->count; i++) {
+            if (left[i] != 0 && batch->pc[i] < pc) {
+                pc = batch->pc[i];
+            }
+        }
+
+        if (pc == CHIP8_MEMORY_CAPACITY) {
+            break;
+        }
+
+        uint32_t mask = batch->parked[pc];
+        batch->parked[pc] = 0;
+        run_group(batch, mask, pc, left);
+    }
+
+    for (int i = 0; i < batch->count; i++) {
+        after += batch->executed[i];
+    }
+
+    return after - before;
+}
@@ -0,0 +1,706 @@
+/************************************
+ * chip8_fleet.c - run many headless CHIP-8 machines
+ *                 across a work-stealing thread pool
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+/**
+ * the manifest
+ *
+ * one job per line: `ROM CYCLES [SCRIPT|-] [COPIES]`. ROMs and
+ * input scripts are read once, up front, and shared read-only
+ * by every worker. Input scripts are the ones chip8 -w records,
+ * played back a frame at a time, so a recorded session replays
+ * here to the same state
+ */
+#define CHIP8_FLEET_LINE 1024
+#define CHIP8_FLEET_IPF 10
+
+typedef struct {
+    char path[CHIP8_FLEET_LINE];
+    uint8_t data[CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START];
+    uint16_t size;
+} fleet_rom;
+
+typedef struct {
+    char path[CHIP8_FLEET_LINE];
+    chip8_input input;
+} fleet_script;
+
+typedef struct {
+    const fleet_rom *rom;
+    const fleet_script *script; // NULL for no input
+    uint64_t cycles;
+} fleet_job;
+
+/**
+ * the unit of work: one job, or with -l a run of consecutive
+ * jobs on the same ROM and budget without input scripts, which
+ * are run together as the lanes of a batch
+ */
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} fleet_task;
+
+typedef struct {
+    uint64_t executed;
+    uint64_t skipped; // fast-forwarded idle, not in `executed`
+    uint64_t frames;
+    uint64_t elapsed; // nanoseconds
+    uint32_t checksum;
+    bool halted;
+} fleet_result;
+
+/**
+ * the work queues
+ *
+ * every worker starts with a contiguous range of task ids, packed
+ * as head << 32 | tail into a single atomic word. The owner takes
+ * tasks from the head; an idle worker steals the back half of
+ * someone else's range. Both sides claim tasks with one CAS, and
+ * tasks are only ever handed out once, so a worker can quit as
+ * soon as it finds every range empty
+ */
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+    uint64_t jobs;
+    uint64_t steals;
+} fleet_queue;
+
+typedef struct {
+    int id;
+    chip8_core core;
+} fleet_worker;
+
+fleet_job *jobs;
+fleet_task *tasks;
+fleet_result *results;
+fleet_queue *queues;
+int workers;
+uint32_t ipf = CHIP8_FLEET_IPF;
+int lanes = 1;
+bool skip_idle = true;
+
+bool parse_manifest(const char *path, fleet_rom **roms, int *nroms, fleet_script **scripts, int *nscripts, int *njobs);
+void * work(void *arg);
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t pack(uint32_t head, uint32_t tail) {
+    return (uint64_t) head << 32 | tail;
+}
+
+int main(int argc, char **argv) {
+    chip8_core core = CHIP8_CORE_THREADED;
+    bool quiet = false;
+    int opt;
+
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    static struct option options[] = {
+        { "core", required_argument, NULL, 'c' },
+        { "ipf", required_argument, NULL, 'f' },
+        { "no-idle", no_argument, NULL, 'I' },
+        { "lanes", required_argument, NULL, 'l' },
+        { "quiet", no_argument, NULL, 'q' },
+        { "threads", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while ((opt = getopt_long(argc, argv, "c:f:Il:qt:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                if (strcmp(optarg, "switch") == 0) {
+                    core = CHIP8_CORE_SWITCH;
+                } else if (strcmp(optarg, "threaded") == 0) {
+                    core = CHIP8_CORE_THREADED;
+                } else if (strcmp(optarg, "block") == 0) {
+                    core = CHIP8_CORE_BLOCK;
+                } else if (strcmp(optarg, "jit") == 0) {
+                    core = CHIP8_CORE_JIT;
+                } else {
+                    printf("Unknown core: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                ipf = strtoul(optarg, NULL, 0);
+                break;
+            case 'I':
+                skip_idle = false;
+                break;
+            case 'l':
+                lanes = atoi(optarg);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 't':
+                workers = atoi(optarg);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1 || workers < 1 || ipf < 1 || lanes < 1 || lanes > CHIP8_BATCH_LANES) {
+        printf("usage: %s [-c switch|threaded|block|jit] [-f ipf] [-I] [-l lanes] [-q] [-t threads] MANIFEST\n", argv[0]);
+        return 1;
+    }
+
+    fleet_rom *roms = NULL;
+    fleet_script *scripts = NULL;
+    int nroms = 0, nscripts = 0, njobs = 0;
+
+    if (!parse_manifest(argv[optind], &roms, &nroms, &scripts, &nscripts, &njobs)) {
+        return 2;
+    }
+
+    int ntasks = 0;
+
+    if ((tasks = calloc(njobs > 0 ? njobs : 1, sizeof(fleet_task))) == NULL) {
+        printf("Out of memory\n");
+        return 2;
+    }
+
+    for (int i = 0; i < njobs; i++) {
+        fleet_task *last = ntasks > 0 ? &tasks[ntasks - 1] : NULL;
+        const fleet_job *first = last != NULL ? &jobs[last->first] : NULL;
+
+        if (first != NULL && (int) last->count < lanes && jobs[i].script == NULL && first->script == NULL
+                && jobs[i].rom == first->rom && jobs[i].cycles == first->cycles) {
+            last->count++;
+        } else {
+            tasks[ntasks].first = i;
+            tasks[ntasks++].count = 1;
+        }
+    }
+
+    if (workers > ntasks) {
+        workers = ntasks > 0 ? ntasks : 1;
+    }
+
+    results = calloc(njobs > 0 ? njobs : 1, sizeof(fleet_result));
+    queues = aligned_alloc(64, workers * sizeof(fleet_queue));
+    fleet_worker *pool = calloc(workers, sizeof(fleet_worker));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+
+    if (results == NULL || queues == NULL || pool == NULL || threads == NULL) {
+        printf("Out of memory\n");
+        return 2;
+    }
+
+    // deal the tasks out in contiguous ranges, the stealing evens out the rest
+    for (int i = 0; i < workers; i++) {
+        atomic_init(&queues[i].range, pack((uint64_t) ntasks * i / workers, (uint64_t) ntasks * (i + 1) / workers));
+        queues[i].jobs = 0;
+        queues[i].steals = 0;
+        pool[i].id = i;
+        pool[i].core = core;
+    }
+
+    uint64_t start = now();
+
+    for (int i = 0; i < workers; i++) {
+        pthread_create(&threads[i], NULL, work, &pool[i]);
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    double elapsed = (now() - start) / 1e9;
+    uint64_t executed = 0, skipped = 0, frames = 0;
+
+    if (!quiet) {
+        printf("%-6s %-24s %12s %12s %12s %10s %10s %10s %12s %-8s\n",
+            "job", "rom", "cycles", "executed", "skipped", "frames", "ms", "MIPS", "fps", "state");
+    }
+
+    for (int i = 0; i < njobs; i++) {
+        fleet_result *r = &results[i];
+        double seconds = r->elapsed / 1e9;
+
+        executed += r->executed;
+        skipped += r->skipped;
+        frames += r->frames;
+
+        if (quiet) {
+            continue;
+        }
+
+        printf("%-6d %-24s %12llu %12llu %12llu %10llu %10.3f %10.2f %12.0f %08x%s\n",
+            i, jobs[i].rom->path, (unsigned long long) jobs[i].cycles, (unsigned long long) r->executed,
+            (unsigned long long) r->skipped, (unsigned long long) r->frames, seconds * 1e3,
+            seconds > 0 ? r->executed / seconds / 1e6 : 0.0,
+            seconds > 0 ? r->frames / seconds : 0.0,
+            r->checksum, r->halted ? " HALTED" : "");
+    }
+
+    for (int i = 0; i < workers; i++) {
+        fprintf(stderr, "worker %d: %llu jobs, %llu steals\n",
+            i, (unsigned long long) queues[i].jobs, (unsigned long long) queues[i].steals);
+    }
+
+    fprintf(stderr, "%d jobs on %d threads in %.3f s: %llu instructions (%.2f MIPS), %llu skipped idle, "
+        "%llu frames (%.0f fps)\n", njobs, workers, elapsed, (unsigned long long) executed,
+        elapsed > 0 ? executed / elapsed / 1e6 : 0.0, (unsigned long long) skipped, (unsigned long long) frames,
+        elapsed > 0 ? frames / elapsed : 0.0);
+
+    for (int i = 0; i < nscripts; i++) {
+        chip8_input_free(&scripts[i].input);
+    }
+
+    free(threads);
+    free(pool);
+    free(queues);
+    free(results);
+    free(tasks);
+    free(jobs);
+    free(scripts);
+    free(roms);
+
+    return 0;
+}
+
+/**
+ * take the next task from our own range
+ */
+static bool take(fleet_queue *q, uint32_t *task) {
+    uint64_t range = atomic_load_explicit(&q->range, memory_order_relaxed);
+    uint32_t head, tail;
+
+    do {
+        head = range >> 32;
+        tail = (uint32_t) range;
+
+        if (head >= tail) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&q->range, &range, pack(head + 1, tail)));
+
+    *task = head;
+
+    return true;
+}
+
+/**
+ * move the back half of a victim's range to our own (empty) range
+ * and take its first task
+ */
+static bool steal(fleet_queue *q, fleet_queue *victim, uint32_t *task) {
+    uint64_t range = atomic_load_explicit(&victim->range, memory_order_relaxed);
+    uint32_t head, tail, half;
+
+    do {
+        head = range >> 32;
+        tail = (uint32_t) range;
+
+        if (head >= tail) {
+            return false;
+        }
+
+        half = (tail - head + 1) / 2;
+    } while (!atomic_compare_exchange_weak(&victim->range, &range, pack(head, tail - half)));
+
+    *task = tail - half;
+    atomic_store(&q->range, pack(tail - half + 1, tail));
+    q->steals++;
+
+    return true;
+}
+
+/**
+ * the memory checksum with the registers, stack and display
+ * folded in, so runs that differ only in those are told apart
+ */
+static uint32_t state_hash(const chip8_vm *vm) {
+    uint32_t hash = chip8_vm_checksum(vm);
+    const uint8_t *regs[] = { vm->rs1, (const uint8_t *) vm->rs2, (const uint8_t *) vm->stack, (const uint8_t *) vm->display };
+    size_t sizes[] = { sizeof(vm->rs1), sizeof(vm->rs2), sizeof(vm->stack), sizeof(vm->display) };
+
+    for (int i = 0; i < 4; i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            hash = (hash ^ regs[i][j]) * 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+/**
+ * run one job on a worker's machine, a frame at a time on the
+ * same turbo clock as chip8, with the keypad changing between frames
+ */
+static void run(chip8_vm *vm, uint32_t id) {
+    const fleet_job *job = &jobs[id];
+    fleet_result *r = &results[id];
+    chip8_input input = { 0 };
+    uint64_t start = now();
+
+    // the events are shared, only the place in them is our own
+    if (job->script != NULL) {
+        input = job->script->input;
+        input.next = 0;
+    }
+
+    chip8_vm_reset(vm);
+    chip8_vm_load_buffer(vm, job->rom->data, job->rom->size);
+    vm->rng ^= id * CHIP8_BATCH_SEED;
+
+    chip8_sched sched;
+    chip8_sched_init(&sched, CHIP8_SCHED_TURBO, (uint64_t) ipf * CHIP8_SCHED_HZ);
+
+    while (!vm->halted && sched.executed < job->cycles) {
+        chip8_input_play(&input, vm, sched.frames);
+
+        if (chip8_sched_frame(&sched, vm, job->cycles - sched.executed) == 0) {
+            break;
+        }
+    }
+
+    // instructions skipped idle cost next to nothing, so they are
+    // counted apart and left out of the rate, as chip8 -s does
+    r->skipped = vm->idled < sched.executed ? vm->idled : sched.executed;
+    r->executed = sched.executed - r->skipped;
+    r->frames = sched.frames;
+    r->elapsed = now() - start;
+    r->checksum = state_hash(vm);
+    r->halted = vm->halted;
+}
+
+/**
+ * run the jobs of a task as the lanes of a batch, frame by frame;
+ * every lane ends up exactly where its job would on its own
+ */
+static void run_batch(chip8_batch *batch, const fleet_task *task) {
+    const fleet_job *job = &jobs[task->first];
+    uint64_t frames[CHIP8_BATCH_LANES] = { 0 };
+    uint64_t done = 0;
+    uint64_t start = now();
+
+    chip8_batch_reset(batch);
+    chip8_batch_load_buffer(batch, job->rom->data, job->rom->size);
+
+    // reseed each lane the way its job is seeded on its own
+    for (uint32_t i = 0; i < task->count; i++) {
+        batch->lanes[i].rng ^= (i * CHIP8_BATCH_SEED) ^ ((task->first + i) * CHIP8_BATCH_SEED);
+    }
+
+    while (done < job->cycles) {
+        uint64_t slice = ipf - done % ipf;
+        uint64_t before[CHIP8_BATCH_LANES];
+        bool running = false;
+
+        if (job->cycles - done < slice) {
+            slice = job->cycles - done;
+        }
+
+        memcpy(before, batch->executed, sizeof(before));
+        chip8_batch_run(batch, slice);
+        done += slice;
+
+        // only lanes that ran the whole slice see the frame end
+        for (uint32_t i = 0; i < task->count; i++) {
+            if (batch->executed[i] - before[i] == slice) {
+                running |= !batch->lanes[i].halted;
+
+                if (done % ipf == 0) {
+                    chip8_vm_tick(&batch->lanes[i]);
+                    frames[i]++;
+                }
+            }
+        }
+
+        if (!running) {
+            break;
+        }
+    }
+
+    uint64_t elapsed = now() - start;
+
+    chip8_batch_sync(batch);
+
+    for (uint32_t i = 0; i < task->count; i++) {
+        fleet_result *r = &results[task->first + i];
+
+        r->executed = batch->executed[i];
+        r->skipped = 0; // lanes run every instruction
+        r->frames = frames[i];
+        r->elapsed = elapsed;
+        r->checksum = state_hash(&batch->lanes[i]);
+        r->halted = batch->lanes[i].halted;
+    }
+}
+
+void * work(void *arg) {
+    fleet_worker *self = arg;
+    fleet_queue *q = &queues[self->id];
+    chip8_vm *vm = malloc(sizeof(chip8_vm));
+    chip8_batch *batch = NULL;
+    uint32_t task;
+
+    // one machine per worker, reset between jobs so its
+    // block cache and JIT buffer are only allocated once
+    if (vm == NULL) {
+        return NULL;
+    }
+
+    chip8_vm_init(vm);
+    vm->skip_idle = skip_idle;
+
+    if (!chip8_vm_set_core(vm, self->core)) {
+        chip8_vm_set_core(vm, CHIP8_CORE_THREADED);
+    }
+
+    for (;;) {
+        if (!take(q, &task)) {
+            bool stolen = false;
+
+            for (int i = 1; i < workers && !stolen; i++) {
+                stolen = steal(q, &queues[(self->id + i) % workers], &task);
+            }
+
+            if (!stolen) {
+                break;
+            }
+        }
+
+        const fleet_task *t = &tasks[task];
+
+        // batches are sized to the task, and kept for the next one
+        if (t->count > 1 && batch != NULL && batch->count != (int) t->count) {
+            chip8_batch_free(batch);
+            free(batch);
+            batch = NULL;
+        }
+
+        if (t->count > 1 && batch == NULL && (batch = malloc(sizeof(chip8_batch))) != NULL
+                && !chip8_batch_init(batch, t->count)) {
+            free(batch);
+            batch = NULL;
+        }
+
+        if (t->count > 1 && batch != NULL) {
+            run_batch(batch, t);
+        } else {
+            for (uint32_t i = 0; i < t->count; i++) {
+                run(vm, t->first + i);
+            }
+        }
+
+        q->jobs += t->count;
+    }
+
+    if (batch != NULL) {
+        chip8_batch_free(batch);
+        free(batch);
+    }
+
+    chip8_vm_free(vm);
+    free(vm);
+
+    return NULL;
+}
+
+/**
+ * find an already loaded ROM or read it from disk
+ */
+static const fleet_rom * load_rom(const char *path, fleet_rom **roms, int *count, int *capacity) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp((*roms)[i].path, path) == 0) {
+            return &(*roms)[i];
+        }
+    }
+
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 8;
+        fleet_rom *grown = realloc(*roms, *capacity * sizeof(fleet_rom));
+
+        if (grown == NULL) {
+            return NULL;
+        }
+
+        *roms = grown;
+    }
+
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        printf("Error loading program: %s\n", path);
+        return NULL;
+    }
+
+    fleet_rom *rom = &(*roms)[(*count)++];
+    strncpy(rom->path, path, sizeof(rom->path) - 1);
+    rom->path[sizeof(rom->path) - 1] = '\0';
+    rom->size = fread(rom->data, sizeof(uint8_t), sizeof(rom->data), file);
+    fclose(file);
+
+    return rom;
+}
+
+/**
+ * find an already loaded input script or read it from disk
+ */
+static const fleet_script * load_script(const char *path, fleet_script **scripts, int *count, int *capacity) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp((*scripts)[i].path, path) == 0) {
+            return &(*scripts)[i];
+        }
+    }
+
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 8;
+        fleet_script *grown = realloc(*scripts, *capacity * sizeof(fleet_script));
+
+        if (grown == NULL) {
+            return NULL;
+        }
+
+        *scripts = grown;
+    }
+
+    fleet_script *script = &(*scripts)[*count];
+
+    strncpy(script->path, path, sizeof(script->path) - 1);
+    script->path[sizeof(script->path) - 1] = '\0';
+    memset(&script->input, 0, sizeof(script->input));
+
+    if (!chip8_input_load(&script->input, path)) {
+        printf("Error loading input script %s\n", path);
+        return NULL;
+    }
+
+    (*count)++;
+
+    return script;
+}
+
+/**
+ * a whole decimal count, with no sign, no leading blanks and
+ * nothing after it, so `-5` and `010` are not read as 2^64 - 5
+ * and octal 8
+ */
+static bool parse_count(const char *text, unsigned long long *value) {
+    char *end;
+
+    if (*text < '0' || *text > '9') {
+        return false;
+    }
+
+    errno = 0;
+    *value = strtoull(text, &end, 10);
+
+    return errno == 0 && *end == '\0';
+}
+
+bool parse_manifest(const char *path, fleet_rom **roms, int *nroms, fleet_script **scripts, int *nscripts, int *njobs) {
+    FILE *file = fopen(path, "r");
+    char line[CHIP8_FLEET_LINE];
+    int lineno = 0;
+    int rom_capacity = 0, script_capacity = 0, job_capacity = 0;
+
+    if (file == NULL) {
+        printf("Error opening manifest: %s\n", path);
+        return false;
+    }
+
+    // ROMs and scripts are remembered by index while the arrays may
+    // still move, and only turned into pointers once parsing is done
+    typedef struct { int rom, script; uint64_t cycles; } entry;
+    entry *entries = NULL;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char rom[CHIP8_FLEET_LINE], script[CHIP8_FLEET_LINE] = "-";
+        char cycles_text[CHIP8_FLEET_LINE], copies_text[CHIP8_FLEET_LINE] = "1";
+        unsigned long long cycles, copies;
+
+        lineno++;
+
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+
+        int fields = sscanf(line, "%1023s %1023s %1023s %1023s", rom, cycles_text, script, copies_text);
+
+        if (fields < 2 || !parse_count(cycles_text, &cycles) || !parse_count(copies_text, &copies)
+                || cycles == 0 || copies == 0) {
+            printf("%s:%d: expected ROM CYCLES [SCRIPT|-] [COPIES]\n", path, lineno);
+            goto fail;
+        }
+
+        const fleet_rom *r = load_rom(rom, roms, nroms, &rom_capacity);
+        const fleet_script *s = NULL;
+
+        if (r == NULL) {
+            goto fail;
+        }
+
+        if (strcmp(script, "-") != 0 && (s = load_script(script, scripts, nscripts, &script_capacity)) == NULL) {
+            goto fail;
+        }
+
+        for (unsigned long long i = 0; i < copies; i++) {
+            if (*njobs == job_capacity) {
+                job_capacity = job_capacity ? job_capacity * 2 : 64;
+                entry *grown = realloc(entries, job_capacity * sizeof(entry));
+
+                if (grown == NULL) {
+                    goto fail;
+                }
+
+                entries = grown;
+            }
+
+            entries[*njobs].rom = r - *roms;
+            entries[*njobs].script = s != NULL ? s - *scripts : -1;
+            entries[*njobs].cycles = cycles;
+            (*njobs)++;
+        }
+    }
+
+    fclose(file);
+
+    if ((jobs = calloc(*njobs > 0 ? *njobs : 1, sizeof(fleet_job))) == NULL) {
+        free(entries);
+        return false;
+    }
+
+    for (int i = 0; i < *njobs; i++) {
+        jobs[i].rom = &(*roms)[entries[i].rom];
+        jobs[i].script = entries[i].script >= 0 ? &(*scripts)[entries[i].script] : NULL;
+        jobs[i].cycles = entries[i].cycles;
+    }
+
+    free(entries);
+
+    return true;
+
+fail:
+    fclose(file);
+    free(entries);
+
+    return false;
+}
@@ -0,0 +1,184 @@
+/************************************
+ * chip8_handlers.h - instruction handlers shared by
+ *                    the threaded interpreter cores
+ *
+ * Developer: Victor Nwosu
+ *
+ * Not a regular header: it is included in the middle of
+ * a core's function body. The including core provides
+ * HANDLER(name), DISPATCH(), SKIP_IF(cond), UNDO() to hand
+ * back the budget of an instruction it stops in front of,
+ * an `out` label, and the locals vm, v, mem, pc, ix, sp and d.
+ ***********************************/
+
+    HANDLER(SCR)
+        scroll_right(vm);
+        DISPATCH();
+    HANDLER(SCL)
+        scroll_left(vm);
+        DISPATCH();
+    HANDLER(LOW)
+        set_hires(vm, false);
+        DISPATCH();
+    HANDLER(HIGH)
+        set_hires(vm, true);
+        DISPATCH();
+    HANDLER(SCD)
+        scroll_down(vm, d->byte);
+        DISPATCH();
+    HANDLER(CLS)
+        memset(vm->display, 0, sizeof(vm->display));
+        vm->writes++;
+        DISPATCH();
+    HANDLER(DRW)
+        v[CHIP8_VF] = draw(vm, v[d->vx], v[d->vy], ix, d->byte);
+        DISPATCH();
+    HANDLER(SKP)
+        SKIP_IF(vm->keys & (1 << (v[d->vx] & 0xF)));
+        DISPATCH();
+    HANDLER(SKNP)
+        SKIP_IF(!(vm->keys & (1 << (v[d->vx] & 0xF))));
+        DISPATCH();
+    HANDLER(LD_KEY)
+        // wait by running this instruction again until a key is down
+        if (vm->keys == 0) {
+            pc = (pc - 2) & CHIP8_ADDRESS_MASK;
+
+            // which does nothing until the keys change
+            if (vm->skip_idle) {
+                vm->idle = true;
+                UNDO();
+                goto out;
+            }
+        } else {
+            v[d->vx] = first_key(vm->keys);
+        }
+        DISPATCH();
+    HANDLER(RET)
+        sp = (sp - 1) & (CHIP8_STACK_SIZE - 1);
+        pc = vm->stack[sp];
+        DISPATCH();
+    HANDLER(EXIT)
+    HANDLER(ILLEGAL)
+        vm->halted = true;
+        goto out;
+    HANDLER(JP)
+        // a short way back: maybe a loop spinning in place
+        if ((uint16_t) (pc - 2 - d->slab) < CHIP8_IDLE_SPAN && idle_poll(vm)) {
+            vm->rs2[CHIP8_IX] = ix;
+            vm->rs2[CHIP8_SP] = sp;
+
+            if (idle_check(vm, (pc - 2) & CHIP8_ADDRESS_MASK)) {
+                pc = (pc - 2) & CHIP8_ADDRESS_MASK;
+                UNDO();
+                goto out;
+            }
+        }
+        pc = d->slab;
+        DISPATCH();
+    HANDLER(CALL)
+        vm->stack[sp] = pc;
+        sp = (sp + 1) & (CHIP8_STACK_SIZE - 1);
+        pc = d->slab;
+        DISPATCH();
+    HANDLER(LD_ADDR)
+        ix = d->slab;
+        DISPATCH();
+    HANDLER(JP_V0)
+        pc = (d->slab + v[CHIP8_V0]) & CHIP8_ADDRESS_MASK;
+        DISPATCH();
+    HANDLER(SE_BYTE)
+        SKIP_IF(v[d->vx] == d->byte);
+        DISPATCH();
+    HANDLER(SNE_BYTE)
+        SKIP_IF(v[d->vx] != d->byte);
+        DISPATCH();
+    HANDLER(LD_BYTE)
+        v[d->vx] = d->byte;
+        DISPATCH();
+    HANDLER(ADD_BYTE)
+        v[d->vx] += d->byte;
+        DISPATCH();
+    HANDLER(RND_BYTE)
+        v[d->vx] = rnd(vm) & d->byte;
+        DISPATCH();
+    HANDLER(SE_REG)
+        SKIP_IF(v[d->vx] == v[d->vy]);
+        DISPATCH();
+    HANDLER(SNE_REG)
+        SKIP_IF(v[d->vx] != v[d->vy]);
+        DISPATCH();
+    HANDLER(LD_REG)
+        v[d->vx] = v[d->vy];
+        DISPATCH();
+    HANDLER(OR)
+        v[d->vx] |= v[d->vy];
+        DISPATCH();
+    HANDLER(AND)
+        v[d->vx] &= v[d->vy];
+        DISPATCH();
+    HANDLER(XOR)
+        v[d->vx] ^= v[d->vy];
+        DISPATCH();
+    HANDLER(ADD_REG) {
+        uint16_t sum = v[d->vx] + v[d->vy];
+        v[d->vx] = (uint8_t) sum;
+        v[CHIP8_VF] = sum > 0xFF;
+        DISPATCH();
+    }
+    HANDLER(SUB) {
+        uint8_t flag = v[d->vx] >= v[d->vy];
+        v[d->vx] -= v[d->vy];
+        v[CHIP8_VF] = flag;
+        DISPATCH();
+    }
+    HANDLER(SHR) {
+        uint8_t flag = v[d->vx] & 0x01;
+        v[d->vx] >>= 1;
+        v[CHIP8_VF] = flag;
+        DISPATCH();
+    }
+    HANDLER(SUBN) {
+        uint8_t flag = v[d->vy] >= v[d->vx];
+        v[d->vx] = v[d->vy] - v[d->vx];
+        v[CHIP8_VF] = flag;
+        DISPATCH();
+    }
+    HANDLER(SHL) {
+        uint8_t flag = v[d->vx] >> 7;
+        v[d->vx] <<= 1;
+        v[CHIP8_VF] = flag;
+        DISPATCH();
+    }
+    HANDLER(LD_DT)
+        v[d->vx] = (uint8_t) vm->rs2[CHIP8_DL];
+        DISPATCH();
+    HANDLER(LD_REG_DT)
+        vm->rs2[CHIP8_DL] = v[d->vx];
+        DISPATCH();
+    HANDLER(LD_REG_ST)
+        vm->rs2[CHIP8_ST] = v[d->vx];
+        DISPATCH();
+    HANDLER(ADD_REG_IX)
+        ix = (ix + v[d->vx]) & CHIP8_ADDRESS_MASK;
+        DISPATCH();
+    HANDLER(LD_SPRITE)
+        ix = CHIP8_FONT_START + (v[d->vx] & 0x0F) * CHIP8_FONT_SPRITE_SIZE;
+        DISPATCH();
+    HANDLER(LDS_BCD)
+        mem[ix] = v[d->vx] / 100;
+        mem[(ix + 1) & CHIP8_ADDRESS_MASK] = v[d->vx] / 10 % 10;
+        mem[(ix + 2) & CHIP8_ADDRESS_MASK] = v[d->vx] % 10;
+        invalidate(vm, ix, 3);
+        DISPATCH();
+    HANDLER(LDS_REGS)
+        for (int i = 0; i <= d->vx; i++) {
+            mem[(ix + i) & CHIP8_ADDRESS_MASK] = v[i];
+        }
+        invalidate(vm, ix, d->vx + 1);
+        DISPATCH();
+    HANDLER(LD_REGS)
+        for (int i = 0; i <= d->vx; i++) {
+            v[i] = mem[(ix + i) & CHIP8_ADDRESS_MASK];
+        }
+        DISPATCH();
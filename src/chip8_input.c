@@ -0,0 +1,142 @@
+/************************************
+ * chip8_input.c - keypad input scripts, recorded and
+ *                 played back a frame at a time
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_internal.h"
+
+#define CHIP8_INPUT_LINE 256
+
+static bool append(chip8_input *input, uint64_t frame, uint16_t keys) {
+    if (input->count == input->capacity) {
+        size_t capacity = input->capacity ? input->capacity * 2 : 16;
+        chip8_input_event *grown = realloc(input->events, capacity * sizeof(chip8_input_event));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        input->events = grown;
+        input->capacity = capacity;
+    }
+
+    input->events[input->count].frame = frame;
+    input->events[input->count].keys = keys;
+    input->count++;
+
+    return true;
+}
+
+/**
+ * one `FRAME KEYS` line: the frame a decimal count with no sign,
+ * the keys a 16-bit mask in C notation (hex with 0x)
+ */
+static bool parse_event(const char *line, uint64_t *frame, uint16_t *keys) {
+    const char *p = line + strspn(line, " \t");
+    char *end;
+
+    if (*p < '0' || *p > '9') {
+        return false;
+    }
+
+    errno = 0;
+    unsigned long long f = strtoull(p, &end, 10);
+
+    if (errno != 0 || (*end != ' ' && *end != '\t')) {
+        return false;
+    }
+
+    p = end + strspn(end, " \t");
+
+    if (*p < '0' || *p > '9') {
+        return false;
+    }
+
+    unsigned long k = strtoul(p, &end, 0);
+
+    if (errno != 0 || k > 0xFFFF || end[strspn(end, " \t\r\n")] != '\0') {
+        return false;
+    }
+
+    *frame = f;
+    *keys = (uint16_t) k;
+
+    return true;
+}
+
+bool chip8_input_load(chip8_input *input, const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[CHIP8_INPUT_LINE];
+
+    if (file == NULL) {
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        uint64_t frame;
+        uint16_t keys;
+
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+
+        if (!parse_event(line, &frame, &keys)
+                || (input->count > 0 && frame < input->events[input->count - 1].frame)
+                || !append(input, frame, keys)) {
+            fclose(file);
+            chip8_input_free(input);
+            return false;
+        }
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+bool chip8_input_save(const chip8_input *input, const char *path) {
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "# FRAME KEYS\n");
+
+    for (size_t i = 0; i < input->count; i++) {
+        fprintf(file, "%llu 0x%04x\n", (unsigned long long) input->events[i].frame, input->events[i].keys);
+    }
+
+    return fclose(file) == 0;
+}
+
+void chip8_input_free(chip8_input *input) {
+    free(input->events);
+    memset(input, 0, sizeof(*input));
+}
+
+bool chip8_input_record(chip8_input *input, uint64_t frame, uint16_t keys) {
+    if (keys == input->keys) {
+        return true;
+    }
+
+    if (!append(input, frame, keys)) {
+        return false;
+    }
+
+    input->keys = keys;
+
+    return true;
+}
+
+void chip8_input_play(chip8_input *input, chip8_vm *vm, uint64_t frame) {
+    while (input->next < input->count && input->events[input->next].frame <= frame) {
+        vm->keys = input->events[input->next++].keys;
+    }
+}
@@ -0,0 +1,271 @@
+/************************************
+ * chip8_internal.h - declarations shared by the
+ *                    interpreter library sources
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#ifndef _CHIP8_INTERNAL_H
+#define _CHIP8_INTERNAL_H
+
+#include "chip8.h"
+
+/**
+ * use GCC labels-as-values for direct-threaded dispatch
+ * when available, otherwise fall back to a dense switch
+ * over the handler ids
+ */
+#if defined(__GNUC__) && !defined(CHIP8_NO_COMPUTED_GOTO)
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+
+/**
+ * the JIT targets x86-64 Linux only
+ */
+#if defined(__x86_64__) && defined(__linux__)
+#define CHIP8_JIT 1
+#else
+#define CHIP8_JIT 0
+#endif
+
+/**
+ * hot loops built from GCC vector extensions are compiled
+ * twice on x86-64, for AVX2 and for baseline SSE2, and the
+ * right one is picked when the library is loaded
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define CHIP8_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define CHIP8_TARGET_CLONES
+#endif
+
+/**
+ * blocks and pages
+ *
+ * straight-line runs of instructions, up to and including
+ * the first branch, are the unit of the block cache and of
+ * the JIT. Memory is split into 64-byte pages to track which
+ * parts of it hold cached code
+ */
+#define CHIP8_BLOCK_MAX_OPS 32
+#define CHIP8_PAGE_SHIFT 6
+#define CHIP8_PAGES (CHIP8_MEMORY_CAPACITY >> CHIP8_PAGE_SHIFT)
+
+/**
+ * add `delta` to the count of every page covered by the
+ * `size` bytes at `start`, wrapping around the end of memory
+ */
+static inline void pages_add(uint16_t *pages, uint16_t start, uint16_t size, int delta) {
+    uint16_t last = (start + size - 1) & CHIP8_ADDRESS_MASK;
+
+    for (int page = start >> CHIP8_PAGE_SHIFT; ; page = (page + 1) % CHIP8_PAGES) {
+        pages[page] += delta;
+
+        if (page == last >> CHIP8_PAGE_SHIFT) {
+            break;
+        }
+    }
+}
+
+/**
+ * a mask with a bit set for every page of 1 << `shift` bytes
+ * covered by the `len` bytes at `addr`, wrapping around the
+ * end of memory, for at most 64 pages
+ */
+static inline uint64_t pages_mask(uint16_t addr, uint16_t len, unsigned shift) {
+    unsigned first = addr >> shift;
+    unsigned last = ((addr + len - 1) & CHIP8_ADDRESS_MASK) >> shift;
+    uint64_t from = ~0ull << first, to = ~0ull >> (63 - last);
+
+    return first <= last ? from & to : (from | to) & (~0ull >> (64 - (CHIP8_MEMORY_CAPACITY >> shift)));
+}
+
+/**
+ * true if any page covered by the `len` bytes at `addr`
+ * has a non-zero count
+ */
+static inline bool pages_used(const uint16_t *pages, uint16_t addr, uint16_t len) {
+    uint16_t last = (addr + len - 1) & CHIP8_ADDRESS_MASK;
+
+    for (int page = addr >> CHIP8_PAGE_SHIFT; ; page = (page + 1) % CHIP8_PAGES) {
+        if (pages[page] != 0) {
+            return true;
+        }
+
+        if (page == last >> CHIP8_PAGE_SHIFT) {
+            return false;
+        }
+    }
+}
+
+/**
+ * the decode table, indexed by instruction word,
+ * shared read-only by every machine
+ */
+extern chip8_decoded dectab[CHIP8_DECODE_TABLE_SIZE];
+
+static inline uint16_t fetch(const chip8_vm *vm, uint16_t pc) {
+    return (vm->memory[pc] << 8) | vm->memory[(pc + 1) & CHIP8_ADDRESS_MASK];
+}
+
+static inline const chip8_decoded *decode(uint16_t word) {
+    return &dectab[word];
+}
+
+/**
+ * xorshift32, behind RND
+ */
+static inline uint8_t rnd(chip8_vm *vm) {
+    vm->rng ^= vm->rng << 13;
+    vm->rng ^= vm->rng >> 17;
+    vm->rng ^= vm->rng << 5;
+
+    return (uint8_t) vm->rng;
+}
+
+/**
+ * the lowest numbered key held down in a non-zero keypad mask
+ */
+static inline uint8_t first_key(uint16_t keys) {
+    uint8_t key = 0;
+
+    while (!(keys & 1)) {
+        keys >>= 1;
+        key++;
+    }
+
+    return key;
+}
+
+/**
+ * idle loops
+ *
+ * only backward jumps of less than CHIP8_IDLE_SPAN bytes are
+ * looked at. A loop found to be doing work is looked at again
+ * after twice as many trips round it as last time, up to
+ * CHIP8_IDLE_BACKOFF
+ */
+#define CHIP8_IDLE_SPAN 16
+#define CHIP8_IDLE_BACKOFF 64
+
+/**
+ * true if the backward jump the core is at should be checked;
+ * cheap enough to ask on every trip round a loop
+ */
+static inline bool idle_poll(chip8_vm *vm) {
+    if (!vm->skip_idle) {
+        return false;
+    }
+
+    if (vm->probe.wait != 0) {
+        vm->probe.wait--;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * compare the machine, about to take the backward jump at `pc`,
+ * with the snapshot from its last trip round, or take one. On a
+ * match `idle` is set and the core should stop at `pc`, without
+ * running the jump. Cores that keep registers in locals write
+ * them back first
+ */
+bool idle_check(chip8_vm *vm, uint16_t pc);
+
+/**
+ * the SUPER-CHIP display, see chip8_vm.c: high resolution
+ * and 16x16 sprites, switching resolution, and scrolling
+ * down `n` rows or 4 pixels right or left
+ */
+uint8_t draw_wide(chip8_vm *vm, uint8_t x, uint8_t y, uint16_t ix, uint8_t n);
+void set_hires(chip8_vm *vm, bool hires);
+void scroll_down(chip8_vm *vm, uint8_t n);
+void scroll_right(chip8_vm *vm);
+void scroll_left(chip8_vm *vm);
+
+/**
+ * DXYN: XOR the `n`-byte sprite at `ix` onto the display at
+ * (x, y), a whole row per step, wrapping around the edges.
+ * Returns 1 if any lit pixel was turned off, for VF. This is
+ * the low resolution case; the rest goes to draw_wide
+ */
+static inline uint8_t draw(chip8_vm *vm, uint8_t x, uint8_t y, uint16_t ix, uint8_t n) {
+    unsigned shift = x & (CHIP8_DISPLAY_WIDTH - 1);
+    uint64_t hit = 0;
+
+    if (vm->hires || n == 0) {
+        return draw_wide(vm, x, y, ix, n);
+    }
+
+    for (int i = 0; i < n; i++) {
+        uint64_t sprite = (uint64_t) vm->memory[(ix + i) & CHIP8_ADDRESS_MASK] << 56;
+        uint64_t *row = &vm->display[(y + i) & (CHIP8_DISPLAY_HEIGHT - 1)][0];
+
+        // rotate rather than shift, so the right edge wraps to the left
+        sprite = (sprite >> shift) | (sprite << (-shift & 63));
+        hit |= *row & sprite;
+        *row ^= sprite;
+    }
+
+    vm->writes++;
+
+    return hit != 0;
+}
+
+/**
+ * true for instructions that end a block: anything that
+ * branches, halts or waits, and stores into memory, which
+ * may rewrite the rest of the block
+ */
+bool ends_block(const chip8_decoded *d);
+
+/**
+ * the reference switch core, also used to single-step
+ * whatever the faster cores do not handle themselves
+ */
+void execute(chip8_vm *vm, const chip8_decoded *d);
+uint64_t run_switch(chip8_vm *vm, uint64_t cycles);
+
+/**
+ * drop cached and translated code overlapping the `len`
+ * bytes at `addr`; called for every store into main memory
+ */
+void invalidate(chip8_vm *vm, uint16_t addr, uint16_t len);
+
+/**
+ * the tracer, see chip8_tracer.c: run one instruction on the
+ * reference core and record it, and count the instructions
+ * skipped in an idle loop so that the records stay numbered
+ * by instruction
+ */
+void trace_step(chip8_vm *vm, uint16_t pc, uint16_t word, const chip8_decoded *d);
+void trace_skip(chip8_vm *vm, uint64_t skipped);
+
+/**
+ * the profiler, see chip8_profiler.c: count the instruction
+ * about to run at `pc`, and `skipped` instructions of the idle
+ * loop at `head`
+ */
+void profile_step(chip8_vm *vm, uint16_t pc, const chip8_decoded *d);
+void profile_skip(chip8_vm *vm, uint16_t head, uint64_t skipped);
+
+/**
+ * saved states, see chip8_state.c: let go of the memory a
+ * machine holds, when it is freed
+ */
+void state_detach(chip8_vm *vm);
+
+/**
+ * the x86-64 JIT, see chip8_jit.c
+ */
+bool jit_init(chip8_vm *vm);
+void jit_free(chip8_vm *vm);
+void jit_flush(chip8_vm *vm);
+void jit_invalidate(chip8_vm *vm, uint16_t addr, uint16_t len);
+uint64_t run_jit(chip8_vm *vm, uint64_t cycles);
+
+#endif // _CHIP8_INTERNAL_H
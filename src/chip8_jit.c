@@ -0,0 +1,560 @@
+/************************************
+ * chip8_jit.c - x86-64 JIT for CHIP-8 basic blocks
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include "chip8_internal.h"
+
+#if CHIP8_JIT
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * the x86-64 JIT
+ *
+ * hot blocks are translated into machine code in an mmap'd
+ * buffer, which is never writable and executable at once: the
+ * pages a block goes on are made writable while it is emitted
+ * and executable again before it runs. While translated code runs, rbx points at
+ * rs1, r12 at rs2, r13 at memory, r14 at the entry table and r15 holds
+ * the remaining instruction budget. Every address has an entry
+ * in the entry table, either translated code or the exit stub, and
+ * blocks chain to each other by jumping through it. Instructions
+ * the JIT does not handle, stores among them, are interpreted.
+ */
+#define CHIP8_JIT_BUFFER_SIZE (1 << 20)
+#define CHIP8_JIT_MAX_OP_CODE 320 // LD Vx, [I] with x = F is the longest, at 295 bytes
+#define CHIP8_JIT_MAX_BLOCK_CODE (CHIP8_JIT_MAX_OP_CODE * CHIP8_BLOCK_MAX_OPS + 64)
+#define CHIP8_JIT_THRESHOLD 8
+#define CHIP8_JIT_NEVER UINT8_MAX
+
+typedef struct {
+    uint8_t *v;
+    uint16_t *rs2;
+    uint8_t *mem;
+    void **table;
+    uint16_t *stack;
+    uint64_t budget;
+    uint16_t pc;
+} chip8_jit_ctx;
+
+typedef struct {
+    uint16_t size; // bytes of memory covered, 0 if not translated
+    uint16_t count; // number of instructions
+} chip8_jit_block;
+
+typedef struct chip8_jit {
+    uint8_t *buf; // the mmap'd code buffer
+    uint8_t *ptr; // where the next block is emitted
+    uint8_t *end;
+    uint8_t *code; // first byte after the entry and exit stubs
+    uint8_t *exit;
+    bool failed; // code could not be made executable again
+    void (*enter)(chip8_jit_ctx *ctx);
+    void *table[CHIP8_MEMORY_CAPACITY]; // entry point per address
+    chip8_jit_block blocks[CHIP8_MEMORY_CAPACITY];
+    uint8_t heat[CHIP8_MEMORY_CAPACITY]; // interpreted executions per address
+    uint16_t pages[CHIP8_PAGES]; // translated blocks per page
+} chip8_jit;
+
+#define EMIT(...) do { \
+        const uint8_t bytes_[] = { __VA_ARGS__ }; \
+        memcpy(jit->ptr, bytes_, sizeof(bytes_)); \
+        jit->ptr += sizeof(bytes_); \
+    } while (0)
+
+static bool jit_supported(const chip8_decoded *d);
+static bool jit_polls(const chip8_vm *vm, uint16_t pc, const chip8_decoded *d);
+static bool jit_compile(chip8_vm *vm, uint16_t start);
+static void jit_evict(chip8_jit *jit, uint16_t start);
+
+bool jit_init(chip8_vm *vm) {
+    if (vm->jit != NULL) {
+        return true;
+    }
+
+    chip8_jit *jit = calloc(1, sizeof(chip8_jit));
+
+    if (jit == NULL) {
+        return false;
+    }
+
+    jit->buf = mmap(NULL, CHIP8_JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (jit->buf == MAP_FAILED) {
+        free(jit);
+        return false;
+    }
+
+    jit->ptr = jit->buf;
+    jit->end = jit->buf + CHIP8_JIT_BUFFER_SIZE;
+
+    // entry trampoline: save callee-saved registers, load the
+    // context into them and jump to the code for ctx->pc
+    jit->enter = (void (*)(chip8_jit_ctx *)) jit->ptr;
+    EMIT(0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx, rbp, r12-r15
+    EMIT(0x48, 0x83, 0xEC, 0x08);                                     // sub rsp, 8
+    EMIT(0x48, 0x89, 0xFD);                                           // mov rbp, rdi
+    EMIT(0x48, 0x8B, 0x5D, offsetof(chip8_jit_ctx, v));               // mov rbx, [rbp + v]
+    EMIT(0x4C, 0x8B, 0x65, offsetof(chip8_jit_ctx, rs2));             // mov r12, [rbp + rs2]
+    EMIT(0x4C, 0x8B, 0x6D, offsetof(chip8_jit_ctx, mem));             // mov r13, [rbp + mem]
+    EMIT(0x4C, 0x8B, 0x75, offsetof(chip8_jit_ctx, table));           // mov r14, [rbp + table]
+    EMIT(0x4C, 0x8B, 0x7D, offsetof(chip8_jit_ctx, budget));          // mov r15, [rbp + budget]
+    EMIT(0x0F, 0xB7, 0x45, offsetof(chip8_jit_ctx, pc));              // movzx eax, word [rbp + pc]
+    EMIT(0x41, 0xFF, 0x24, 0xC6);                                     // jmp [r14 + rax * 8]
+
+    // exit stub: every address without translated code points here,
+    // with eax holding the address the interpreter resumes from
+    jit->exit = jit->ptr;
+    EMIT(0x4C, 0x89, 0x7D, offsetof(chip8_jit_ctx, budget));          // mov [rbp + budget], r15
+    EMIT(0x66, 0x89, 0x45, offsetof(chip8_jit_ctx, pc));              // mov [rbp + pc], ax
+    EMIT(0x48, 0x83, 0xC4, 0x08);                                     // add rsp, 8
+    EMIT(0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B); // pop r15-r12, rbp, rbx
+    EMIT(0xC3);                                                       // ret
+
+    jit->code = jit->ptr;
+
+    // a host that refuses executable code gets the interpreter
+    if (mprotect(jit->buf, CHIP8_JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        munmap(jit->buf, CHIP8_JIT_BUFFER_SIZE);
+        free(jit);
+        return false;
+    }
+
+    vm->jit = jit;
+    jit_flush(vm);
+
+    return true;
+}
+
+void jit_flush(chip8_vm *vm) {
+    chip8_jit *jit = vm->jit;
+
+    for (int i = 0; i < CHIP8_MEMORY_CAPACITY; i++) {
+        jit->table[i] = jit->exit;
+        jit->blocks[i].size = 0;
+        jit->blocks[i].count = 0;
+        jit->heat[i] = 0;
+    }
+
+    memset(jit->pages, 0, sizeof(jit->pages));
+    jit->ptr = jit->code;
+}
+
+static bool jit_supported(const chip8_decoded *d) {
+    switch (d->handler) {
+        case CHIP8_H_JP:
+        case CHIP8_H_CALL:
+        case CHIP8_H_RET:
+        case CHIP8_H_JP_V0:
+        case CHIP8_H_SE_BYTE:
+        case CHIP8_H_SNE_BYTE:
+        case CHIP8_H_SE_REG:
+        case CHIP8_H_SNE_REG:
+        case CHIP8_H_LD_BYTE:
+        case CHIP8_H_ADD_BYTE:
+        case CHIP8_H_LD_REG:
+        case CHIP8_H_OR:
+        case CHIP8_H_AND:
+        case CHIP8_H_XOR:
+        case CHIP8_H_ADD_REG:
+        case CHIP8_H_SUB:
+        case CHIP8_H_SUBN:
+        case CHIP8_H_SHR:
+        case CHIP8_H_SHL:
+        case CHIP8_H_LD_ADDR:
+        case CHIP8_H_ADD_REG_IX:
+        case CHIP8_H_LD_SPRITE:
+        case CHIP8_H_LD_DT:
+        case CHIP8_H_LD_REG_DT:
+        case CHIP8_H_LD_REG_ST:
+        case CHIP8_H_LD_REGS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * true for a short jump back over nothing but loads and tests,
+ * the shape of a loop polling the delay timer or the keypad.
+ * Those jumps are left to the interpreter, which notices when
+ * such a loop is spinning in place
+ */
+static bool jit_polls(const chip8_vm *vm, uint16_t pc, const chip8_decoded *d) {
+    if (d->handler != CHIP8_H_JP || (uint16_t) (pc - d->slab) >= CHIP8_IDLE_SPAN) {
+        return false;
+    }
+
+    for (uint16_t at = d->slab; at != pc; at = (at + 2) & CHIP8_ADDRESS_MASK) {
+        switch (decode(fetch(vm, at))->handler) {
+            case CHIP8_H_LD_DT:
+            case CHIP8_H_LD_BYTE:
+            case CHIP8_H_LD_REG:
+            case CHIP8_H_LD_ADDR:
+            case CHIP8_H_LD_SPRITE:
+            case CHIP8_H_LD_REGS:
+            case CHIP8_H_AND:
+            case CHIP8_H_OR:
+            case CHIP8_H_SE_BYTE:
+            case CHIP8_H_SNE_BYTE:
+            case CHIP8_H_SE_REG:
+            case CHIP8_H_SNE_REG:
+            case CHIP8_H_SKP:
+            case CHIP8_H_SKNP:
+            case CHIP8_H_JP:
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static void emit32(chip8_jit *jit, uint32_t value) {
+    memcpy(jit->ptr, &value, sizeof(value));
+    jit->ptr += sizeof(value);
+}
+
+static void patch32(uint8_t *at, uint8_t *target) {
+    int32_t rel = (int32_t) (target - (at + 4));
+    memcpy(at, &rel, sizeof(rel));
+}
+
+/**
+ * leave the block for `target`, going through the entry table
+ * so that evicting the target unlinks every block chained to it
+ */
+static void emit_chain(chip8_jit *jit, uint16_t target) {
+    EMIT(0xB8);                                     // mov eax, target
+    emit32(jit, target);
+    EMIT(0x41, 0xFF, 0xA6);                         // jmp [r14 + target * 8]
+    emit32(jit, target * sizeof(void *));
+}
+
+/**
+ * skip instructions: branch to `next + 2` on `jcc`, else to `next`
+ */
+static void emit_skip(chip8_jit *jit, uint8_t jcc, uint16_t next) {
+    EMIT(0x0F, jcc);
+    uint8_t *taken = jit->ptr;
+    emit32(jit, 0);
+    emit_chain(jit, next);
+    patch32(taken, jit->ptr);
+    emit_chain(jit, (next + 2) & CHIP8_ADDRESS_MASK);
+}
+
+/**
+ * store the low 16 bits of eax into rs2[reg]
+ */
+static void emit_store_rs2(chip8_jit *jit, uint8_t reg) {
+    EMIT(0x66, 0x41, 0x89, 0x44, 0x24, reg * 2);    // mov [r12 + reg * 2], ax
+}
+
+static void emit_op(chip8_jit *jit, const chip8_decoded *d, uint16_t next) {
+    uint8_t x = d->vx, y = d->vy, vf = CHIP8_VF;
+
+    switch (d->handler) {
+        case CHIP8_H_LD_BYTE:
+            EMIT(0xC6, 0x43, x, d->byte);           // mov byte [rbx + x], nn
+            break;
+        case CHIP8_H_ADD_BYTE:
+            EMIT(0x80, 0x43, x, d->byte);           // add byte [rbx + x], nn
+            break;
+        case CHIP8_H_LD_REG:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x88, 0x43, x);                    // mov [rbx + x], al
+            break;
+        case CHIP8_H_OR:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x08, 0x43, x);                    // or [rbx + x], al
+            break;
+        case CHIP8_H_AND:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x20, 0x43, x);                    // and [rbx + x], al
+            break;
+        case CHIP8_H_XOR:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x30, 0x43, x);                    // xor [rbx + x], al
+            break;
+        case CHIP8_H_ADD_REG:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x00, 0x43, x);                    // add [rbx + x], al
+            EMIT(0x0F, 0x92, 0x43, vf);             // setc [rbx + vf]
+            break;
+        case CHIP8_H_SUB:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x28, 0x43, x);                    // sub [rbx + x], al
+            EMIT(0x0F, 0x93, 0x43, vf);             // setnc [rbx + vf]
+            break;
+        case CHIP8_H_SUBN:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x2A, 0x43, x);                    // sub al, [rbx + x]
+            EMIT(0x88, 0x43, x);                    // mov [rbx + x], al
+            EMIT(0x0F, 0x93, 0x43, vf);             // setnc [rbx + vf]
+            break;
+        case CHIP8_H_SHR:
+            EMIT(0xD0, 0x6B, x);                    // shr byte [rbx + x], 1
+            EMIT(0x0F, 0x92, 0x43, vf);             // setc [rbx + vf]
+            break;
+        case CHIP8_H_SHL:
+            EMIT(0xD0, 0x63, x);                    // shl byte [rbx + x], 1
+            EMIT(0x0F, 0x92, 0x43, vf);             // setc [rbx + vf]
+            break;
+        case CHIP8_H_LD_ADDR:
+            EMIT(0x66, 0x41, 0xC7, 0x44, 0x24, CHIP8_IX * 2, d->slab & 0xFF, d->slab >> 8); // mov word [r12 + ix], nnn
+            break;
+        case CHIP8_H_ADD_REG_IX:
+            EMIT(0x0F, 0xB6, 0x43, x);              // movzx eax, byte [rbx + x]
+            EMIT(0x66, 0x41, 0x03, 0x44, 0x24, CHIP8_IX * 2); // add ax, [r12 + ix]
+            EMIT(0x25);                             // and eax, 0xFFF
+            emit32(jit, CHIP8_ADDRESS_MASK);
+            emit_store_rs2(jit, CHIP8_IX);
+            break;
+        case CHIP8_H_LD_SPRITE:
+            EMIT(0x0F, 0xB6, 0x43, x);              // movzx eax, byte [rbx + x]
+            EMIT(0x83, 0xE0, 0x0F);                 // and eax, 0xF
+            EMIT(0x6B, 0xC0, CHIP8_FONT_SPRITE_SIZE); // imul eax, eax, size
+            EMIT(0x05);                             // add eax, font
+            emit32(jit, CHIP8_FONT_START);
+            emit_store_rs2(jit, CHIP8_IX);
+            break;
+        case CHIP8_H_LD_DT:
+            EMIT(0x41, 0x0F, 0xB7, 0x44, 0x24, CHIP8_DL * 2); // movzx eax, word [r12 + dl]
+            EMIT(0x88, 0x43, x);                    // mov [rbx + x], al
+            break;
+        case CHIP8_H_LD_REG_DT:
+        case CHIP8_H_LD_REG_ST:
+            EMIT(0x0F, 0xB6, 0x43, x);              // movzx eax, byte [rbx + x]
+            emit_store_rs2(jit, d->handler == CHIP8_H_LD_REG_DT ? CHIP8_DL : CHIP8_ST);
+            break;
+        case CHIP8_H_LD_REGS:
+            EMIT(0x41, 0x0F, 0xB7, 0x4C, 0x24, CHIP8_IX * 2); // movzx ecx, word [r12 + ix]
+
+            for (int i = 0; i <= x; i++) {
+                EMIT(0x8D, 0x51, i);                // lea edx, [rcx + i]
+                EMIT(0x81, 0xE2);                   // and edx, 0xFFF
+                emit32(jit, CHIP8_ADDRESS_MASK);
+                EMIT(0x41, 0x0F, 0xB6, 0x44, 0x15, 0x00); // movzx eax, byte [r13 + rdx]
+                EMIT(0x88, 0x43, i);                // mov [rbx + i], al
+            }
+            break;
+        case CHIP8_H_JP:
+            emit_chain(jit, d->slab);
+            break;
+        case CHIP8_H_JP_V0:
+            EMIT(0x0F, 0xB6, 0x43, CHIP8_V0);       // movzx eax, byte [rbx + v0]
+            EMIT(0x05);                             // add eax, nnn
+            emit32(jit, d->slab);
+            EMIT(0x25);                             // and eax, 0xFFF
+            emit32(jit, CHIP8_ADDRESS_MASK);
+            EMIT(0x41, 0xFF, 0x24, 0xC6);           // jmp [r14 + rax * 8]
+            break;
+        case CHIP8_H_CALL:
+            EMIT(0x41, 0x0F, 0xB7, 0x4C, 0x24, CHIP8_SP * 2); // movzx ecx, word [r12 + sp]
+            EMIT(0x48, 0x8B, 0x55, offsetof(chip8_jit_ctx, stack)); // mov rdx, [rbp + stack]
+            EMIT(0x66, 0xC7, 0x04, 0x4A, next & 0xFF, next >> 8); // mov word [rdx + rcx * 2], next
+            EMIT(0xFF, 0xC1);                       // inc ecx
+            EMIT(0x83, 0xE1, CHIP8_STACK_SIZE - 1); // and ecx, 0xF
+            EMIT(0x66, 0x41, 0x89, 0x4C, 0x24, CHIP8_SP * 2); // mov [r12 + sp], cx
+            emit_chain(jit, d->slab);
+            break;
+        case CHIP8_H_RET:
+            EMIT(0x41, 0x0F, 0xB7, 0x4C, 0x24, CHIP8_SP * 2); // movzx ecx, word [r12 + sp]
+            EMIT(0xFF, 0xC9);                       // dec ecx
+            EMIT(0x83, 0xE1, CHIP8_STACK_SIZE - 1); // and ecx, 0xF
+            EMIT(0x66, 0x41, 0x89, 0x4C, 0x24, CHIP8_SP * 2); // mov [r12 + sp], cx
+            EMIT(0x48, 0x8B, 0x55, offsetof(chip8_jit_ctx, stack)); // mov rdx, [rbp + stack]
+            EMIT(0x0F, 0xB7, 0x04, 0x4A);           // movzx eax, word [rdx + rcx * 2]
+            EMIT(0x41, 0xFF, 0x24, 0xC6);           // jmp [r14 + rax * 8]
+            break;
+        case CHIP8_H_SE_BYTE:
+        case CHIP8_H_SNE_BYTE:
+            EMIT(0x80, 0x7B, x, d->byte);           // cmp byte [rbx + x], nn
+            emit_skip(jit, d->handler == CHIP8_H_SE_BYTE ? 0x84 : 0x85, next); // je / jne
+            break;
+        case CHIP8_H_SE_REG:
+        case CHIP8_H_SNE_REG:
+            EMIT(0x8A, 0x43, y);                    // mov al, [rbx + y]
+            EMIT(0x38, 0x43, x);                    // cmp [rbx + x], al
+            emit_skip(jit, d->handler == CHIP8_H_SE_REG ? 0x84 : 0x85, next); // je / jne
+            break;
+    }
+}
+
+static bool jit_compile(chip8_vm *vm, uint16_t start) {
+    chip8_jit *jit = vm->jit;
+    chip8_decoded ops[CHIP8_BLOCK_MAX_OPS];
+    uint16_t count = 0;
+    uint16_t pc = start;
+    bool terminated = false;
+
+    while (count < CHIP8_BLOCK_MAX_OPS && pc < CHIP8_MEMORY_CAPACITY - 1) {
+        const chip8_decoded *d = decode(fetch(vm, pc));
+
+        // leave anything we cannot translate to the interpreter
+        if (!jit_supported(d) || (vm->skip_idle && jit_polls(vm, pc, d))) {
+            break;
+        }
+
+        ops[count++] = *d;
+        pc += 2;
+
+        if (ends_block(d)) {
+            terminated = true;
+            break;
+        }
+    }
+
+    if (count == 0) {
+        return false;
+    }
+
+    if (jit->end - jit->ptr < CHIP8_JIT_MAX_BLOCK_CODE) {
+        jit_flush(vm);
+    }
+
+    // the pages the block may take, writable only while it is
+    // emitted; nothing else runs on this machine meanwhile
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uint8_t *from = (uint8_t *) ((uintptr_t) jit->ptr & ~(page - 1));
+    size_t span = (uintptr_t) (jit->ptr + CHIP8_JIT_MAX_BLOCK_CODE) - (uintptr_t) from;
+
+    if (mprotect(from, span, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+
+    uint8_t *code = jit->ptr;
+
+    EMIT(0x49, 0x83, 0xEF, count);                  // sub r15, count
+    EMIT(0x0F, 0x82);                               // jb bail
+    uint8_t *bail = jit->ptr;
+    emit32(jit, 0);
+
+    for (int i = 0; i < count; i++) {
+        emit_op(jit, &ops[i], (start + 2 * (i + 1)) & CHIP8_ADDRESS_MASK);
+    }
+
+    if (!terminated) {
+        emit_chain(jit, pc & CHIP8_ADDRESS_MASK);
+    }
+
+    // not enough budget left for the whole block: hand back to the
+    // interpreter, which single-steps what remains
+    patch32(bail, jit->ptr);
+    EMIT(0x49, 0x83, 0xC7, count);                  // add r15, count
+    EMIT(0xB8);                                     // mov eax, start
+    emit32(jit, start);
+    EMIT(0xE9);                                     // jmp exit
+    emit32(jit, 0);
+    patch32(jit->ptr - 4, jit->exit);
+
+    if (mprotect(from, span, PROT_READ | PROT_EXEC) != 0) {
+        jit->failed = true;
+        return false;
+    }
+
+    jit->table[start] = code;
+    jit->blocks[start].size = count * 2;
+    jit->blocks[start].count = count;
+
+    pages_add(jit->pages, start, count * 2, 1);
+
+    return true;
+}
+
+static void jit_evict(chip8_jit *jit, uint16_t start) {
+    pages_add(jit->pages, start, jit->blocks[start].size, -1);
+
+    // the code itself is reclaimed by the next flush; resetting the
+    // entry unlinks every block that chains here
+    jit->table[start] = jit->exit;
+    jit->blocks[start].size = 0;
+    jit->blocks[start].count = 0;
+    jit->heat[start] = 0;
+}
+
+void jit_invalidate(chip8_vm *vm, uint16_t addr, uint16_t len) {
+    chip8_jit *jit = vm->jit;
+
+    // a block overlapping the write starts at most one block size before
+    // it; with nothing translated on the pages only the marks need resetting
+    int first = pages_used(jit->pages, addr, len) ? 1 - 2 * CHIP8_BLOCK_MAX_OPS : -1;
+
+    for (int i = first; i < len; i++) {
+        uint16_t start = (addr + i) & CHIP8_ADDRESS_MASK;
+
+        if (jit->blocks[start].size != 0 && (i >= 0 || jit->blocks[start].size > -i)) {
+            jit_evict(jit, start);
+        }
+
+        // the rewritten instructions may be translatable now
+        if (i >= -1 && jit->heat[start] == CHIP8_JIT_NEVER) {
+            jit->heat[start] = 0;
+        }
+    }
+}
+
+void jit_free(chip8_vm *vm) {
+    if (vm->jit == NULL) {
+        return;
+    }
+
+    munmap(vm->jit->buf, CHIP8_JIT_BUFFER_SIZE);
+    free(vm->jit);
+    vm->jit = NULL;
+}
+
+uint64_t run_jit(chip8_vm *vm, uint64_t cycles) {
+    chip8_jit *jit = vm->jit;
+    uint64_t budget = cycles == 0 ? UINT64_MAX : cycles;
+    uint64_t left = budget;
+    chip8_jit_ctx ctx = {
+        .v = vm->rs1,
+        .rs2 = vm->rs2,
+        .mem = vm->memory,
+        .table = jit->table,
+        .stack = vm->stack,
+    };
+
+    // with the stubs or other blocks no longer executable,
+    // interpret from here on
+    if (jit->failed) {
+        return run_switch(vm, cycles);
+    }
+
+    while (!vm->halted && left > 0) {
+        uint16_t pc = vm->rs2[CHIP8_PC];
+
+        if (jit->table[pc] == jit->exit && jit->heat[pc] != CHIP8_JIT_NEVER && ++jit->heat[pc] >= CHIP8_JIT_THRESHOLD) {
+            jit->heat[pc] = jit_compile(vm, pc) ? 0 : CHIP8_JIT_NEVER;
+        }
+
+        if (jit->table[pc] != jit->exit && jit->blocks[pc].count <= left) {
+            ctx.pc = pc;
+            ctx.budget = left;
+            jit->enter(&ctx);
+            vm->rs2[CHIP8_PC] = ctx.pc;
+            left = ctx.budget;
+            continue;
+        }
+
+        left -= run_switch(vm, 1);
+
+        if (vm->idle) {
+            break;
+        }
+    }
+
+    return budget - left;
+}
+
+#undef EMIT
+
+#endif // CHIP8_JIT
@@ -0,0 +1,514 @@
+/************************************
+ * chip8_keypad.c - live keypad input, read by a thread
+ *                  of its own and queued for the machine
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_internal.h"
+
+/**
+ * terminals report key presses and autorepeats, never key
+ * releases, so a key typed there is held down for this long
+ * after it was last seen
+ */
+#define CHIP8_KEYPAD_HOLD_MS 150
+#define CHIP8_KEYPAD_QUEUE 64 // a power of two
+#define CHIP8_KEYPAD_EVENTS 16
+#define CHIP8_KEYPAD_CLIENTS 8
+
+/**
+ * the COSMAC VIP keypad on the left of a QWERTY keyboard
+ */
+static const char layout[] = "x123qweasdzc4rfv";
+
+/**
+ * the queue
+ *
+ * the input thread produces every change to the keypad, and
+ * the machine's thread consumes them between frames, so a
+ * press and release that both land within one frame are still
+ * seen. Like the trace ring, each side owns one counter and
+ * the two sit on separate cache lines. `keys` is the keypad as
+ * last produced, and `seq` counts the changes, for the machine
+ * to sleep on with a futex while it waits for a key
+ */
+typedef struct chip8_keypad {
+    _Alignas(64) _Atomic uint32_t head;
+    _Atomic uint16_t keys;
+    _Atomic uint32_t seq;
+    _Atomic bool overflow;
+    _Atomic bool closed;
+    uint16_t queue[CHIP8_KEYPAD_QUEUE];
+
+    _Alignas(64) _Atomic uint32_t tail;
+
+    int epoll;
+    int stop; // an eventfd, to wake the thread when it should exit
+    int input; // the terminal or FIFO, or -1
+    int listener; // the Unix socket, or -1
+    int clients[CHIP8_KEYPAD_CLIENTS];
+    bool tty;
+    bool raw; // the terminal is in raw mode, and `saved` restores it
+    bool running;
+    struct termios saved;
+    struct timespec held[CHIP8_GP_REGS]; // when terminal keys are let go
+    uint16_t down; // the keypad as the thread sees it
+    pthread_t thread;
+} chip8_keypad;
+
+static void futex_wake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * the producer: queue the keypad as it is now
+ */
+static void publish(chip8_keypad *keypad) {
+    uint32_t head = atomic_load_explicit(&keypad->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&keypad->tail, memory_order_acquire) == CHIP8_KEYPAD_QUEUE) {
+        // the machine has fallen behind; it catches up from `keys`
+        atomic_store_explicit(&keypad->overflow, true, memory_order_relaxed);
+    } else {
+        keypad->queue[head % CHIP8_KEYPAD_QUEUE] = keypad->down;
+        atomic_store_explicit(&keypad->head, head + 1, memory_order_release);
+    }
+
+    atomic_store_explicit(&keypad->keys, keypad->down, memory_order_release);
+    atomic_fetch_add_explicit(&keypad->seq, 1, memory_order_release);
+    futex_wake(&keypad->seq);
+}
+
+static void set_keys(chip8_keypad *keypad, uint16_t keys) {
+    if (keys != keypad->down) {
+        keypad->down = keys;
+        publish(keypad);
+    }
+}
+
+static int64_t ms_until(const struct timespec *when, const struct timespec *now) {
+    return (when->tv_sec - now->tv_sec) * 1000 + (when->tv_nsec - now->tv_nsec) / 1000000;
+}
+
+/**
+ * the length of the escape sequence at the start of `bytes`,
+ * at least two of them: a CSI (ESC [, parameters, a final
+ * byte), an SS3 (ESC O and one byte) or ESC and any other byte,
+ * as Alt sends. Terminals write a sequence all at once, so one
+ * cut short by the end of a read is taken to end there
+ */
+static ssize_t escape(const char *bytes, ssize_t size) {
+    ssize_t n = 2;
+
+    if (bytes[1] == 'O') {
+        n = 3;
+    } else if (bytes[1] == '[') {
+        while (n < size && bytes[n] >= 0x20 && bytes[n] <= 0x3f) {
+            n++;
+        }
+
+        n++;
+    }
+
+    return n < size ? n : size;
+}
+
+/**
+ * keys typed at the terminal, which are held for a while
+ */
+static void typed(chip8_keypad *keypad, const char *bytes, ssize_t size) {
+    struct timespec now;
+    uint16_t keys = keypad->down;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (ssize_t i = 0; i < size; i++) {
+        // Ctrl-C, Ctrl-D and Escape on its own end the session; ISIG
+        // is off in raw mode. Arrow and function keys send escape
+        // sequences, which are dropped whole
+        if (bytes[i] == 0x03 || bytes[i] == 0x04 || (bytes[i] == 0x1b && i == size - 1)) {
+            atomic_store_explicit(&keypad->closed, true, memory_order_release);
+            continue;
+        }
+
+        if (bytes[i] == 0x1b) {
+            i += escape(&bytes[i], size - i) - 1;
+            continue;
+        }
+
+        // only letters fold to lower case; control characters would
+        // fold onto the digits
+        int c = (unsigned char) bytes[i];
+        const char *key = c != '\0' ? strchr(layout, isalpha(c) ? tolower(c) : c) : NULL;
+
+        if (key != NULL) {
+            int n = key - layout;
+            struct timespec *held = &keypad->held[n];
+
+            *held = now;
+            held->tv_nsec += CHIP8_KEYPAD_HOLD_MS * 1000000L;
+            held->tv_sec += held->tv_nsec / 1000000000L;
+            held->tv_nsec %= 1000000000L;
+            keys |= 1 << n;
+        }
+    }
+
+    set_keys(keypad, keys);
+}
+
+/**
+ * let go of terminal keys held long enough, and return how
+ * long until the next one is due, -1 for none
+ */
+static int release(chip8_keypad *keypad) {
+    struct timespec now;
+    uint16_t keys = keypad->down;
+    int64_t next = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int n = 0; n < CHIP8_GP_REGS; n++) {
+        if (keys & (1 << n)) {
+            int64_t left = ms_until(&keypad->held[n], &now);
+
+            if (left <= 0) {
+                keys &= ~(1 << n);
+            } else if (next < 0 || left < next) {
+                next = left;
+            }
+        }
+    }
+
+    set_keys(keypad, keys);
+
+    return next;
+}
+
+/**
+ * commands from a driver on a FIFO or socket, separated by
+ * whitespace: `+K` holds key K (a hex digit) down, `-K` lets
+ * go of it, `=MASK` sets the whole keypad and `q` ends the
+ * session
+ */
+static void command(chip8_keypad *keypad, const char *word) {
+    char *end;
+
+    if (strcmp(word, "q") == 0) {
+        atomic_store_explicit(&keypad->closed, true, memory_order_release);
+        return;
+    }
+
+    unsigned long value = strtoul(word + 1, &end, 16);
+
+    if (end == word + 1 || *end != '\0') {
+        return;
+    }
+
+    if (word[0] == '+' && value < CHIP8_GP_REGS) {
+        set_keys(keypad, keypad->down | 1 << value);
+    } else if (word[0] == '-' && value < CHIP8_GP_REGS) {
+        set_keys(keypad, keypad->down & ~(1 << value));
+    } else if (word[0] == '=' && value <= 0xFFFF) {
+        set_keys(keypad, value);
+    }
+}
+
+static void commands(chip8_keypad *keypad, const char *bytes, ssize_t size) {
+    char word[16];
+    size_t len = 0;
+
+    // a command split across two reads is lost; drivers write whole lines
+    for (ssize_t i = 0; i <= size; i++) {
+        if (i == size || bytes[i] == ' ' || bytes[i] == '\t' || bytes[i] == '\n' || bytes[i] == '\r') {
+            word[len] = '\0';
+
+            if (len > 0) {
+                command(keypad, word);
+            }
+
+            len = 0;
+        } else if (len < sizeof(word) - 1) {
+            word[len++] = bytes[i];
+        }
+    }
+}
+
+static void * watch(void *arg) {
+    chip8_keypad *keypad = arg;
+    struct epoll_event events[CHIP8_KEYPAD_EVENTS];
+    char bytes[256];
+
+    for (;;) {
+        int timeout = keypad->tty ? release(keypad) : -1;
+        int count = epoll_wait(keypad->epoll, events, CHIP8_KEYPAD_EVENTS, timeout);
+
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == keypad->stop) {
+                return NULL;
+            }
+
+            if (fd == keypad->listener) {
+                int client = accept4(keypad->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                struct epoll_event event = { .events = EPOLLIN, .data.fd = client };
+                int slot = 0;
+
+                while (slot < CHIP8_KEYPAD_CLIENTS && keypad->clients[slot] >= 0) {
+                    slot++;
+                }
+
+                if (client >= 0 && slot < CHIP8_KEYPAD_CLIENTS && epoll_ctl(keypad->epoll, EPOLL_CTL_ADD, client, &event) == 0) {
+                    keypad->clients[slot] = client;
+                } else if (client >= 0) {
+                    close(client);
+                }
+
+                continue;
+            }
+
+            ssize_t size = read(fd, bytes, sizeof(bytes));
+
+            if (size > 0) {
+                if (keypad->tty) {
+                    typed(keypad, bytes, size);
+                } else {
+                    commands(keypad, bytes, size);
+                }
+            } else if (size == 0 || (errno != EAGAIN && errno != EINTR)) {
+                // a driver hanging up leaves the keys as they were
+                epoll_ctl(keypad->epoll, EPOLL_CTL_DEL, fd, NULL);
+
+                for (int slot = 0; slot < CHIP8_KEYPAD_CLIENTS; slot++) {
+                    if (keypad->clients[slot] == fd) {
+                        keypad->clients[slot] = -1;
+                        close(fd);
+                    }
+                }
+
+                // with the terminal gone, nothing can press a key again
+                if (fd == keypad->input && keypad->listener < 0) {
+                    atomic_store_explicit(&keypad->closed, true, memory_order_release);
+                }
+            }
+
+            if (atomic_load_explicit(&keypad->closed, memory_order_acquire)) {
+                atomic_fetch_add_explicit(&keypad->seq, 1, memory_order_release);
+                futex_wake(&keypad->seq);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * open `source`: the terminal for NULL or "-", a Unix socket to
+ * listen on for "unix:PATH", or else a file or FIFO
+ */
+static bool open_source(chip8_keypad *keypad, const char *source) {
+    if (source == NULL || strcmp(source, "-") == 0) {
+        // piped in rather than typed, the bytes are still keys
+        keypad->input = STDIN_FILENO;
+        keypad->tty = true;
+
+        // raw mode: every key as it is typed, no echo, no signals
+        if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &keypad->saved) == 0) {
+            struct termios raw = keypad->saved;
+
+            raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+            raw.c_iflag &= ~(IXON | ICRNL);
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            keypad->raw = tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0;
+        }
+
+        return true;
+    }
+
+    if (strncmp(source, "unix:", 5) == 0) {
+        struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+        if (strlen(source + 5) >= sizeof(address.sun_path)) {
+            return false;
+        }
+
+        strcpy(address.sun_path, source + 5);
+        unlink(address.sun_path);
+
+        keypad->listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        return keypad->listener >= 0 && bind(keypad->listener, (struct sockaddr *) &address, sizeof(address)) == 0
+            && listen(keypad->listener, CHIP8_KEYPAD_CLIENTS) == 0;
+    }
+
+    // read-write, so that a FIFO stays open between drivers
+    keypad->input = open(source, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    return keypad->input >= 0;
+}
+
+chip8_keypad *chip8_keypad_start(const char *source) {
+    chip8_keypad *keypad = aligned_alloc(64, sizeof(chip8_keypad));
+
+    if (keypad == NULL) {
+        return NULL;
+    }
+
+    memset(keypad, 0, sizeof(*keypad));
+    atomic_init(&keypad->head, 0);
+    atomic_init(&keypad->tail, 0);
+    atomic_init(&keypad->keys, 0);
+    atomic_init(&keypad->seq, 0);
+    atomic_init(&keypad->overflow, false);
+    atomic_init(&keypad->closed, false);
+    keypad->input = -1;
+    keypad->listener = -1;
+
+    for (int slot = 0; slot < CHIP8_KEYPAD_CLIENTS; slot++) {
+        keypad->clients[slot] = -1;
+    }
+
+    keypad->epoll = epoll_create1(EPOLL_CLOEXEC);
+    keypad->stop = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (keypad->epoll < 0 || keypad->stop < 0 || !open_source(keypad, source)) {
+        chip8_keypad_stop(keypad);
+        return NULL;
+    }
+
+    int fds[] = { keypad->stop, keypad->input, keypad->listener };
+
+    for (int i = 0; i < 3; i++) {
+        struct epoll_event event = { .events = EPOLLIN, .data.fd = fds[i] };
+
+        if (fds[i] >= 0 && epoll_ctl(keypad->epoll, EPOLL_CTL_ADD, fds[i], &event) != 0) {
+            chip8_keypad_stop(keypad);
+            return NULL;
+        }
+    }
+
+    keypad->running = pthread_create(&keypad->thread, NULL, watch, keypad) == 0;
+
+    if (!keypad->running) {
+        chip8_keypad_stop(keypad);
+        return NULL;
+    }
+
+    return keypad;
+}
+
+void chip8_keypad_stop(chip8_keypad *keypad) {
+    if (keypad == NULL) {
+        return;
+    }
+
+    if (keypad->running) {
+        uint64_t one = 1;
+
+        while (write(keypad->stop, &one, sizeof(one)) < 0 && errno == EINTR) {
+        }
+
+        pthread_join(keypad->thread, NULL);
+    }
+
+    if (keypad->raw) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &keypad->saved);
+    }
+
+    for (int slot = 0; slot < CHIP8_KEYPAD_CLIENTS; slot++) {
+        if (keypad->clients[slot] >= 0) {
+            close(keypad->clients[slot]);
+        }
+    }
+
+    if (keypad->input > STDIN_FILENO) {
+        close(keypad->input);
+    }
+
+    if (keypad->listener >= 0) {
+        close(keypad->listener);
+    }
+
+    if (keypad->stop >= 0) {
+        close(keypad->stop);
+    }
+
+    if (keypad->epoll >= 0) {
+        close(keypad->epoll);
+    }
+
+    free(keypad);
+}
+
+bool chip8_keypad_poll(chip8_keypad *keypad, chip8_vm *vm) {
+    uint32_t tail = atomic_load_explicit(&keypad->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&keypad->head, memory_order_acquire);
+    uint16_t pressed = 0;
+
+    // the changes since the last frame, up to the first that lets
+    // go of a key pressed during this one, so that every press
+    // lasts a frame at least; the rest wait for the next frame
+    while (tail != head) {
+        uint16_t keys = keypad->queue[tail % CHIP8_KEYPAD_QUEUE];
+
+        if (pressed & ~keys) {
+            break;
+        }
+
+        pressed |= keys & ~vm->keys;
+        vm->keys = keys;
+        tail++;
+    }
+
+    atomic_store_explicit(&keypad->tail, tail, memory_order_release);
+
+    // events were lost; the keypad as it is now is the best guess
+    if (tail == head && atomic_exchange_explicit(&keypad->overflow, false, memory_order_acquire)) {
+        vm->keys = atomic_load_explicit(&keypad->keys, memory_order_acquire);
+    }
+
+    return tail != head || !atomic_load_explicit(&keypad->closed, memory_order_acquire);
+}
+
+bool chip8_keypad_wait(chip8_keypad *keypad) {
+    for (;;) {
+        // the thread queues a change before it bumps `seq`, so
+        // one made after this read still wakes the futex
+        uint32_t seq = atomic_load_explicit(&keypad->seq, memory_order_acquire);
+
+        if (atomic_load_explicit(&keypad->closed, memory_order_acquire)) {
+            return false;
+        }
+
+        if (atomic_load_explicit(&keypad->head, memory_order_acquire) != atomic_load_explicit(&keypad->tail, memory_order_relaxed)
+                || atomic_load_explicit(&keypad->overflow, memory_order_relaxed)) {
+            return true;
+        }
+
+        syscall(SYS_futex, &keypad->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    }
+}
@@ -0,0 +1,145 @@
+/************************************
+ * chip8_ppm.c - save frames published by chip8 -P
+ *               as PPM images
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+
+/**
+ * how long to sleep between looks at the segment while no new
+ * frame has come; the machine is never told a reader is there
+ */
+#define CHIP8_PPM_POLL_NS 1000000
+
+bool write_ppm(const chip8_frame *frame, const char *path, int scale);
+
+int main(int argc, char **argv) {
+    uint64_t count = 1;
+    uint64_t every = 1;
+    int scale = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e:n:s:")) != -1) {
+        switch (opt) {
+            case 'e':
+                every = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                count = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                scale = atoi(optarg);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 2 || every == 0 || scale < 1) {
+        printf("usage: %s [-e frames] [-n count] [-s scale] NAME PREFIX\n", argv[0]);
+        return 1;
+    }
+
+    chip8_shared *shared = chip8_shared_open(argv[optind]);
+
+    if (shared == NULL) {
+        printf("Error opening shared memory %s\n", argv[optind]);
+        return 2;
+    }
+
+    chip8_frame frame;
+    uint64_t saved = 0, next = 0;
+    bool seen = false;
+
+    // take every `every`th frame from the first one seen, or the
+    // one after it if the reader fell behind, until `count` are
+    // saved (0 for all of them) or the machine goes; the last
+    // frame it published is taken too
+    while (count == 0 || saved < count) {
+        if (!chip8_shared_snapshot(shared, &frame)) {
+            printf("%s is not a frame segment\n", argv[optind]);
+            chip8_shared_close(shared);
+            return 2;
+        }
+
+        bool started = frame.running || frame.frame != 0;
+
+        if (started && (!seen || frame.frame >= next)) {
+            char path[1024];
+
+            snprintf(path, sizeof(path), "%s%08llu.ppm", argv[optind + 1], (unsigned long long) frame.frame);
+
+            if (!write_ppm(&frame, path, scale)) {
+                printf("Error writing %s\n", path);
+                chip8_shared_close(shared);
+                return 2;
+            }
+
+            saved++;
+            seen = true;
+            next = frame.frame + every;
+            continue;
+        }
+
+        if (started && !frame.running) {
+            break;
+        }
+
+        struct timespec pause = { 0, CHIP8_PPM_POLL_NS };
+        nanosleep(&pause, NULL);
+    }
+
+    printf("%llu frames saved\n", (unsigned long long) saved);
+    chip8_shared_close(shared);
+
+    return 0;
+}
+
+/**
+ * the display, lit pixels white on black, each `scale` pixels
+ * square
+ */
+bool write_ppm(const chip8_frame *frame, const char *path, int scale) {
+    int width = frame->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    int height = frame->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    unsigned char *row = malloc((size_t) width * scale * 3);
+    FILE *out = fopen(path, "wb");
+
+    if (row == NULL || out == NULL) {
+        free(row);
+
+        if (out != NULL) {
+            fclose(out);
+        }
+
+        return false;
+    }
+
+    fprintf(out, "P6\n%d %d\n255\n", width * scale, height * scale);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char level = frame->display[y][x >> 6] >> (63 - (x & 63)) & 1 ? 255 : 0;
+
+            memset(&row[x * scale * 3], level, scale * 3);
+        }
+
+        for (int i = 0; i < scale; i++) {
+            fwrite(row, 3, (size_t) width * scale, out);
+        }
+    }
+
+    free(row);
+
+    return fclose(out) == 0;
+}
@@ -0,0 +1,65 @@
+/************************************
+ * chip8_profiler.c - instruction counts by opcode
+ *                    class, address and subroutine
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include "chip8_internal.h"
+
+void chip8_vm_profile(chip8_vm *vm, chip8_profile *profile) {
+    vm->profile = profile;
+}
+
+/**
+ * count a call from `site` to `target`, in the first free or
+ * matching slot after the one the pair hashes to
+ */
+static void profile_edge(chip8_profile *p, uint16_t site, uint16_t target) {
+    uint32_t hash = ((uint32_t) site << 12 | target) * 2654435761u;
+
+    for (int i = 0; i < CHIP8_PROFILE_EDGES; i++) {
+        chip8_profile_edge *e = &p->edges[((hash >> 24) + i) & (CHIP8_PROFILE_EDGES - 1)];
+
+        if (e->count == 0) {
+            e->site = site;
+            e->target = target;
+        }
+
+        if (e->site == site && e->target == target) {
+            e->count++;
+            return;
+        }
+    }
+
+    p->lost++;
+}
+
+void profile_step(chip8_vm *vm, uint16_t pc, const chip8_decoded *d) {
+    chip8_profile *p = vm->profile;
+    uint64_t clock = p->executed + p->skipped;
+
+    p->ops[d->handler]++;
+    p->pcs[pc]++;
+
+    if (d->handler == CHIP8_H_CALL) {
+        // the machine's stack wraps at 16, and so does this one
+        int top = p->depth++ % CHIP8_STACK_SIZE;
+
+        p->frames[top] = d->slab;
+        p->entered[top] = clock;
+        p->calls[d->slab]++;
+        profile_edge(p, pc, d->slab);
+    } else if (d->handler == CHIP8_H_RET && p->depth > 0) {
+        int top = --p->depth % CHIP8_STACK_SIZE;
+
+        p->inclusive[p->frames[top]] += clock + 1 - p->entered[top];
+    }
+
+    p->executed++;
+}
+
+void profile_skip(chip8_vm *vm, uint16_t head, uint64_t skipped) {
+    vm->profile->idle[head] += skipped;
+    vm->profile->skipped += skipped;
+}
@@ -0,0 +1,190 @@
+/************************************
+ * chip8_render.c - the display on an ANSI terminal,
+ *                  redrawn where it changed
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chip8_internal.h"
+
+/**
+ * runs of changed cells closer together than this are drawn
+ * as one, unchanged cells and all; moving the cursor over the
+ * gap would take more bytes
+ */
+#define CHIP8_RENDER_GAP 4
+
+/**
+ * the most a frame can take: every cell as a three byte
+ * glyph, a cursor move in front of every run, and the escapes
+ * that clear the screen
+ */
+#define CHIP8_RENDER_MOVE 10 // ESC [ row ; col H
+#define CHIP8_RENDER_BUFFER (CHIP8_HIRES_WIDTH * CHIP8_HIRES_HEIGHT / 2 * 3 + \
+    CHIP8_HIRES_HEIGHT / 2 * (CHIP8_HIRES_WIDTH / (CHIP8_RENDER_GAP + 1) + 1) * CHIP8_RENDER_MOVE + 64)
+
+/**
+ * a cell by its top pixel (bit 1) and bottom pixel (bit 0): a
+ * space, the lower half block, the upper half block and the
+ * full block, in UTF-8
+ */
+static const char *const glyphs[4] = { " ", "\xe2\x96\x84", "\xe2\x96\x80", "\xe2\x96\x88" };
+static const uint8_t glyph_sizes[4] = { 1, 3, 3, 3 };
+
+static const char clear[] = "\x1b[?25l\x1b[H\x1b[2J"; // hide the cursor, home, erase
+static const char restore[] = "\x1b[?25h"; // show the cursor
+
+bool chip8_render_init(chip8_render *render, int fd) {
+    memset(render, 0, sizeof(*render));
+
+    render->fd = fd;
+    render->out = malloc(CHIP8_RENDER_BUFFER);
+
+    return render->out != NULL;
+}
+
+/**
+ * write `size` bytes out, in one call unless the descriptor
+ * takes less at a time
+ */
+static bool flush(chip8_render *render, const char *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(render->fd, bytes, size);
+
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written < 0) {
+            return false;
+        }
+
+        render->syscalls++;
+        render->bytes += written;
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+void chip8_render_free(chip8_render *render) {
+    if (render->shown) {
+        char *out = render->out;
+        unsigned rows = (render->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT) / 2;
+
+        out += sprintf(out, "\x1b[%u;1H%s", rows + 1, restore);
+        flush(render, render->out, out - render->out);
+    }
+
+    free(render->out);
+    render->out = NULL;
+}
+
+/**
+ * the first column at or after `from` with its bit set in `mask`
+ */
+static unsigned next_set(const uint64_t *mask, unsigned from, unsigned width) {
+    for (unsigned w = from / 64; w * 64 < width; w++) {
+        uint64_t bits = w == from / 64 ? mask[w] & (UINT64_MAX >> (from & 63)) : mask[w];
+
+        if (bits != 0) {
+            return w * 64 + __builtin_clzll(bits);
+        }
+    }
+
+    return width;
+}
+
+static char *put_number(char *out, unsigned n) {
+    char digits[10];
+    int count = 0;
+
+    do {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+
+    return out;
+}
+
+bool chip8_render_frame(chip8_render *render, const chip8_vm *vm) {
+    unsigned width = vm->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    unsigned height = vm->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    char *out = render->out;
+
+    // nothing has been drawn or stored since the last frame
+    if (render->shown && render->hires == vm->hires && render->writes == vm->writes) {
+        render->clean++;
+        return true;
+    }
+
+    // a new screen, or one of another size, is drawn from blank
+    if (!render->shown || render->hires != vm->hires) {
+        memcpy(out, clear, sizeof(clear) - 1);
+        out += sizeof(clear) - 1;
+        memset(render->screen, 0, sizeof(render->screen));
+        render->hires = vm->hires;
+        render->shown = true;
+    }
+
+    render->writes = vm->writes;
+
+    for (unsigned row = 0; row < height / 2; row++) {
+        const uint64_t *top = vm->display[2 * row], *bottom = vm->display[2 * row + 1];
+        uint64_t *was_top = render->screen[2 * row], *was_bottom = render->screen[2 * row + 1];
+        uint64_t changed[CHIP8_DISPLAY_WORDS];
+        unsigned col = 0;
+
+        for (int w = 0; w < CHIP8_DISPLAY_WORDS; w++) {
+            changed[w] = (top[w] ^ was_top[w]) | (bottom[w] ^ was_bottom[w]);
+        }
+
+        while ((col = next_set(changed, col, width)) < width) {
+            unsigned end = col + 1, next;
+
+            while ((next = next_set(changed, end, width)) < width && next - end < CHIP8_RENDER_GAP) {
+                end = next + 1;
+            }
+
+            *out++ = '\x1b';
+            *out++ = '[';
+            out = put_number(out, row + 1);
+            *out++ = ';';
+            out = put_number(out, col + 1);
+            *out++ = 'H';
+
+            for (unsigned x = col; x < end; x++) {
+                unsigned shift = 63 - (x & 63);
+                unsigned cell = (top[x / 64] >> shift & 1) << 1 | (bottom[x / 64] >> shift & 1);
+
+                memcpy(out, glyphs[cell], glyph_sizes[cell]);
+                out += glyph_sizes[cell];
+            }
+
+            col = end;
+        }
+
+        memcpy(was_top, top, sizeof(vm->display[0]));
+        memcpy(was_bottom, bottom, sizeof(vm->display[0]));
+    }
+
+    // stores to memory count as writes too, and may leave the
+    // display as it was
+    if (out == render->out) {
+        render->clean++;
+        return true;
+    }
+
+    render->frames++;
+
+    return flush(render, render->out, out - render->out);
+}
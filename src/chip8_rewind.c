@@ -0,0 +1,362 @@
+/************************************
+ * chip8_rewind.c - the rewind buffer, keyframes and
+ *                  run-length encoded XOR deltas
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <string.h>
+
+#include "chip8_internal.h"
+
+/**
+ * literals run on through shorter gaps of zeros than this,
+ * which would cost more to encode as a run of their own
+ */
+#define CHIP8_REWIND_GAP 4
+
+/**
+ * a frame as it is encoded
+ *
+ * everything a program can see of the machine. The padding
+ * is zeroed once and never written, so it never shows up in
+ * a delta
+ */
+typedef struct chip8_image {
+    uint8_t memory[CHIP8_MEMORY_CAPACITY];
+    uint64_t display[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+    uint16_t rs2[CHIP8_SP_REGS];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint16_t keys;
+    uint8_t rs1[CHIP8_GP_REGS];
+    uint32_t rng;
+    bool hires;
+    bool halted;
+} chip8_image;
+
+_Static_assert(sizeof(chip8_image) % sizeof(uint64_t) == 0, "images are XORed a word at a time");
+
+/**
+ * the most a frame can take encoded: a literal of every
+ * byte, split wherever CHIP8_REWIND_GAP zeros could have
+ * been, each with two varints in front
+ */
+#define CHIP8_REWIND_ENCODED (sizeof(chip8_image) + (sizeof(chip8_image) / CHIP8_REWIND_GAP + 1) * 6)
+
+static void capture(const chip8_vm *vm, chip8_image *image) {
+    memcpy(image->memory, vm->memory, sizeof(image->memory));
+    memcpy(image->display, vm->display, sizeof(image->display));
+    memcpy(image->rs2, vm->rs2, sizeof(image->rs2));
+    memcpy(image->stack, vm->stack, sizeof(image->stack));
+    memcpy(image->rs1, vm->rs1, sizeof(image->rs1));
+    image->keys = vm->keys;
+    image->rng = vm->rng;
+    image->hires = vm->hires;
+    image->halted = vm->halted;
+}
+
+static void apply(chip8_vm *vm, const chip8_image *image) {
+    memcpy(vm->memory, image->memory, sizeof(vm->memory));
+    memcpy(vm->display, image->display, sizeof(vm->display));
+    memcpy(vm->rs2, image->rs2, sizeof(vm->rs2));
+    memcpy(vm->stack, image->stack, sizeof(vm->stack));
+    memcpy(vm->rs1, image->rs1, sizeof(vm->rs1));
+    vm->keys = image->keys;
+    vm->rng = image->rng;
+    vm->hires = image->hires;
+    vm->halted = image->halted;
+
+    // all of memory may have changed, and any code cached from it
+    invalidate(vm, 0, CHIP8_MEMORY_CAPACITY);
+    vm->idle = false;
+    vm->probe.armed = false;
+}
+
+static inline uint64_t load64(const uint8_t *bytes) {
+    uint64_t word;
+
+    memcpy(&word, bytes, sizeof(word));
+
+    return word;
+}
+
+static uint8_t *put_varint(uint8_t *out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = value | 0x80;
+        value >>= 7;
+    }
+
+    *out++ = value;
+
+    return out;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, size_t *value) {
+    int shift = 0;
+
+    *value = 0;
+
+    do {
+        *value |= (size_t) (*in & 0x7F) << shift;
+        shift += 7;
+    } while (*in++ & 0x80);
+
+    return in;
+}
+
+/**
+ * run-length encode `size` bytes, mostly zeros, as pairs of a
+ * count of zeros to skip and a count of literal bytes, each
+ * pair followed by its literals. Returns the encoded size
+ */
+static size_t pack(const uint8_t *bytes, size_t size, uint8_t *out) {
+    uint8_t *start = out;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t zeros = i;
+
+        // skip zeros a word at a time, then the last few
+        while (zeros + sizeof(uint64_t) <= size && load64(&bytes[zeros]) == 0) {
+            zeros += sizeof(uint64_t);
+        }
+
+        while (zeros < size && bytes[zeros] == 0) {
+            zeros++;
+        }
+
+        if (zeros == size) {
+            break;
+        }
+
+        size_t end = zeros, gap = 0;
+
+        while (end < size && gap < CHIP8_REWIND_GAP) {
+            gap = bytes[end] == 0 ? gap + 1 : 0;
+            end++;
+        }
+
+        end -= gap;
+
+        out = put_varint(out, zeros - i);
+        out = put_varint(out, end - zeros);
+        memcpy(out, &bytes[zeros], end - zeros);
+        out += end - zeros;
+        i = end;
+    }
+
+    return out - start;
+}
+
+/**
+ * XOR an encoded frame into `bytes`
+ */
+static void unpack(const uint8_t *in, size_t size, uint8_t *bytes) {
+    const uint8_t *end = in + size;
+    size_t i = 0;
+
+    while (in < end) {
+        size_t zeros, literals;
+
+        in = get_varint(in, &zeros);
+        in = get_varint(in, &literals);
+        i += zeros;
+
+        for (size_t j = 0; j < literals; j++) {
+            bytes[i++] ^= *in++;
+        }
+    }
+}
+
+bool chip8_rewind_init(chip8_rewind *rewind, size_t capacity, uint32_t interval) {
+    memset(rewind, 0, sizeof(*rewind));
+
+    rewind->capacity = capacity;
+    rewind->interval = interval == 0 ? CHIP8_REWIND_INTERVAL : interval;
+    rewind->data = malloc(capacity);
+    rewind->last = calloc(1, sizeof(chip8_image));
+    rewind->next = calloc(1, sizeof(chip8_image));
+    rewind->encoded = malloc(CHIP8_REWIND_ENCODED);
+
+    if (rewind->data == NULL || rewind->last == NULL || rewind->next == NULL || rewind->encoded == NULL) {
+        chip8_rewind_free(rewind);
+        return false;
+    }
+
+    return true;
+}
+
+void chip8_rewind_free(chip8_rewind *rewind) {
+    free(rewind->data);
+    free(rewind->frames);
+    free(rewind->last);
+    free(rewind->next);
+    free(rewind->encoded);
+    memset(rewind, 0, sizeof(*rewind));
+}
+
+static chip8_rewind_frame *frame_at(const chip8_rewind *rewind, size_t n) {
+    return &rewind->frames[(rewind->first + n) % rewind->slots];
+}
+
+/**
+ * drop the oldest keyframe and the deltas that lead on from it
+ */
+static void drop_oldest(chip8_rewind *rewind) {
+    do {
+        rewind->first = (rewind->first + 1) % rewind->slots;
+        rewind->count--;
+    } while (rewind->count > 0 && !frame_at(rewind, 0)->key);
+}
+
+/**
+ * find room for `size` bytes after the newest frame, dropping
+ * the oldest ones until there is. The ring never splits a
+ * frame: one that does not fit before the end goes back to
+ * the start, and the bytes left over at the end go unused
+ */
+static bool reserve(chip8_rewind *rewind, size_t size, size_t *offset) {
+    if (size > rewind->capacity) {
+        return false;
+    }
+
+    for (;;) {
+        if (rewind->count == 0) {
+            *offset = 0;
+            return true;
+        }
+
+        size_t tail = frame_at(rewind, 0)->offset;
+
+        if (rewind->head > tail) {
+            if (rewind->capacity - rewind->head >= size) {
+                *offset = rewind->head;
+                return true;
+            }
+
+            if (tail >= size) {
+                *offset = 0;
+                return true;
+            }
+        } else if (tail - rewind->head >= size) {
+            *offset = rewind->head;
+            return true;
+        }
+
+        drop_oldest(rewind);
+    }
+}
+
+bool chip8_rewind_push(chip8_rewind *rewind, const chip8_vm *vm) {
+    const uint8_t *last = (const uint8_t *) rewind->last;
+    const uint8_t *next = (const uint8_t *) rewind->next;
+    bool key = rewind->count == 0 || rewind->since + 1 >= rewind->interval;
+    size_t size, offset;
+
+    // the padding of `next` was zeroed with the rest of it, and
+    // is never written, so it XORs to zero
+    capture(vm, rewind->next);
+
+    for (;;) {
+        if (key) {
+            size = pack(next, sizeof(chip8_image), rewind->encoded);
+        } else {
+            uint8_t delta[sizeof(chip8_image)];
+
+            // a word at a time; images are a whole number of words
+            for (size_t i = 0; i < sizeof(chip8_image); i += sizeof(uint64_t)) {
+                uint64_t word = load64(&last[i]) ^ load64(&next[i]);
+
+                memcpy(&delta[i], &word, sizeof(word));
+            }
+
+            size = pack(delta, sizeof(delta), rewind->encoded);
+        }
+
+        if (!reserve(rewind, size, &offset)) {
+            return false;
+        }
+
+        // making room may have dropped the keyframe this delta needs
+        if (key || rewind->count > 0) {
+            break;
+        }
+
+        key = true;
+    }
+
+    if (rewind->count == rewind->slots) {
+        size_t slots = rewind->slots ? rewind->slots * 2 : 256;
+        chip8_rewind_frame *frames = malloc(slots * sizeof(chip8_rewind_frame));
+
+        if (frames == NULL) {
+            return false;
+        }
+
+        for (size_t i = 0; i < rewind->count; i++) {
+            frames[i] = *frame_at(rewind, i);
+        }
+
+        free(rewind->frames);
+        rewind->frames = frames;
+        rewind->slots = slots;
+        rewind->first = 0;
+    }
+
+    memcpy(&rewind->data[offset], rewind->encoded, size);
+
+    *frame_at(rewind, rewind->count++) = (chip8_rewind_frame) { offset, size, key };
+    rewind->head = offset + size;
+    rewind->since = key ? 0 : rewind->since + 1;
+
+    chip8_image *swap = rewind->last;
+    rewind->last = rewind->next;
+    rewind->next = swap;
+
+    return true;
+}
+
+bool chip8_rewind_seek(chip8_rewind *rewind, chip8_vm *vm, uint64_t back) {
+    if (back >= rewind->count) {
+        return false;
+    }
+
+    size_t target = rewind->count - 1 - back;
+    size_t key = target;
+
+    while (!frame_at(rewind, key)->key) {
+        key--;
+    }
+
+    memset(rewind->last, 0, sizeof(chip8_image));
+
+    for (size_t i = key; i <= target; i++) {
+        const chip8_rewind_frame *f = frame_at(rewind, i);
+
+        unpack(&rewind->data[f->offset], f->size, (uint8_t *) rewind->last);
+    }
+
+    apply(vm, rewind->last);
+
+    const chip8_rewind_frame *f = frame_at(rewind, target);
+
+    rewind->count = target + 1;
+    rewind->head = f->offset + f->size;
+    rewind->since = target - key;
+
+    return true;
+}
+
+void chip8_rewind_measure(const chip8_rewind *rewind, chip8_rewind_stats *stats) {
+    stats->frames = rewind->count;
+    stats->keyframes = 0;
+    stats->bytes = 0;
+    stats->capacity = rewind->capacity;
+
+    for (size_t i = 0; i < rewind->count; i++) {
+        const chip8_rewind_frame *f = frame_at(rewind, i);
+
+        stats->keyframes += f->key;
+        stats->bytes += f->size;
+    }
+}
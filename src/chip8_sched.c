@@ -0,0 +1,112 @@
+/************************************
+ * chip8_sched.c - the 60 Hz frame scheduler
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include "chip8_internal.h"
+
+#define CHIP8_NS 1000000000u
+
+void chip8_sched_init(chip8_sched *sched, chip8_sched_mode mode, uint64_t ips) {
+    sched->mode = mode;
+    sched->ips = ips;
+    sched->executed = 0;
+    sched->frames = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &sched->origin);
+}
+
+/**
+ * the instruction frame `frame` ends after, split so that
+ * long runs at high rates do not overflow
+ */
+static uint64_t frame_end(uint64_t ips, uint64_t frame) {
+    return frame / CHIP8_SCHED_HZ * ips + frame % CHIP8_SCHED_HZ * ips / CHIP8_SCHED_HZ;
+}
+
+/**
+ * sleep until `count` of `rate` per second have passed since
+ * the origin; at once if the machine is running behind
+ */
+static void pace(const chip8_sched *sched, uint64_t count, uint64_t rate) {
+    struct timespec until = sched->origin;
+    uint64_t ns = until.tv_nsec + count % rate * CHIP8_NS / rate;
+
+    until.tv_sec += count / rate + ns / CHIP8_NS;
+    until.tv_nsec = ns % CHIP8_NS;
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
+
+uint64_t chip8_sched_frame(chip8_sched *sched, chip8_vm *vm, uint64_t cycles) {
+    uint64_t start = sched->executed;
+
+    if (sched->ips == 0) {
+        sched->executed += chip8_vm_run(vm, cycles);
+        return sched->executed - start;
+    }
+
+    uint64_t end = frame_end(sched->ips, sched->frames + 1);
+    uint64_t left = end - start;
+    uint64_t slice = left;
+
+    if (cycles != 0 && cycles < left) {
+        left = cycles;
+    }
+
+    if (sched->mode == CHIP8_SCHED_FIXED_IPS) {
+        slice = sched->ips / (CHIP8_NS / CHIP8_SCHED_SLICE_NS);
+        slice = slice == 0 ? 1 : slice;
+    }
+
+    // the cores stop on the exact instruction asked for, so where
+    // the frame is cut into slices does not change what it does
+    while (left > 0 && !vm->halted) {
+        uint64_t executed = chip8_vm_run(vm, left < slice ? left : slice);
+
+        if (executed == 0) {
+            break;
+        }
+
+        sched->executed += executed;
+        left -= executed;
+
+        if (sched->mode == CHIP8_SCHED_FIXED_IPS) {
+            pace(sched, sched->executed, sched->ips);
+        }
+    }
+
+    if (sched->executed == end) {
+        chip8_vm_tick(vm);
+        sched->frames++;
+
+        if (sched->mode == CHIP8_SCHED_REALTIME) {
+            pace(sched, sched->frames, CHIP8_SCHED_HZ);
+        }
+    }
+
+    return sched->executed - start;
+}
+
+void chip8_sched_rebase(chip8_sched *sched) {
+    uint64_t ns = 0;
+
+    if (sched->mode == CHIP8_SCHED_REALTIME) {
+        ns = sched->frames / CHIP8_SCHED_HZ * CHIP8_NS + sched->frames % CHIP8_SCHED_HZ * CHIP8_NS / CHIP8_SCHED_HZ;
+    } else if (sched->ips != 0) {
+        ns = sched->executed / sched->ips * CHIP8_NS + sched->executed % sched->ips * CHIP8_NS / sched->ips;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &sched->origin);
+
+    // origin = now - ns, borrowing a second where the nanoseconds run short
+    sched->origin.tv_sec -= ns / CHIP8_NS;
+
+    if ((uint64_t) sched->origin.tv_nsec < ns % CHIP8_NS) {
+        sched->origin.tv_sec--;
+        sched->origin.tv_nsec += CHIP8_NS;
+    }
+
+    sched->origin.tv_nsec -= ns % CHIP8_NS;
+}
@@ -0,0 +1,198 @@
+/************************************
+ * chip8_shared.c - the framebuffer in shared memory,
+ *                  behind a sequence lock
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8_internal.h"
+
+/**
+ * the segment
+ *
+ * `seq` is bumped to odd before the frame is written and back
+ * to even after. A reader copies the frame between two reads
+ * of `seq` and keeps the copy only if both were the same even
+ * number. The frame starts on a cache line of its own, so the
+ * header reads are not disturbed by the copy
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t size; // of the frame
+    _Atomic uint32_t seq;
+    _Alignas(64) chip8_frame frame;
+} chip8_segment;
+
+_Static_assert(offsetof(chip8_segment, frame) == 64, "the header is documented as 64 bytes");
+
+typedef struct chip8_shared {
+    chip8_segment *segment;
+    bool owner; // created it, and publishes to it
+    bool published; // the segment holds a display
+    uint32_t writes; // vm->writes when the display was last published
+    char name[256];
+} chip8_shared;
+
+static chip8_shared *map(const char *name, bool owner) {
+    chip8_shared *shared = calloc(1, sizeof(chip8_shared));
+
+    if (shared == NULL || strlen(name) >= sizeof(shared->name)) {
+        free(shared);
+        return NULL;
+    }
+
+    int fd = owner ? shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644) : shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        free(shared);
+        return NULL;
+    }
+
+    struct stat st;
+
+    // a reader only maps a segment that has been sized by its machine
+    if ((owner && ftruncate(fd, sizeof(chip8_segment)) != 0)
+            || (!owner && (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(chip8_segment)))) {
+        close(fd);
+        free(shared);
+        return NULL;
+    }
+
+    void *segment = mmap(NULL, sizeof(chip8_segment), owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (segment == MAP_FAILED) {
+        if (owner) {
+            shm_unlink(name);
+        }
+
+        free(shared);
+        return NULL;
+    }
+
+    shared->segment = segment;
+    shared->owner = owner;
+    strcpy(shared->name, name);
+
+    return shared;
+}
+
+chip8_shared *chip8_shared_create(const char *name) {
+    chip8_shared *shared = map(name, true);
+
+    if (shared != NULL) {
+        chip8_segment *segment = shared->segment;
+
+        // readers check the magic last, once the rest is in place
+        segment->version = CHIP8_SHARED_VERSION;
+        segment->size = sizeof(chip8_frame);
+        atomic_store_explicit(&segment->seq, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        memcpy(segment->magic, CHIP8_SHARED_MAGIC, sizeof(segment->magic));
+    }
+
+    return shared;
+}
+
+static uint32_t begin(chip8_segment *segment) {
+    uint32_t seq = atomic_load_explicit(&segment->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&segment->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    return seq + 2;
+}
+
+static void end(chip8_segment *segment, uint32_t seq) {
+    atomic_store_explicit(&segment->seq, seq, memory_order_release);
+}
+
+void chip8_shared_publish(chip8_shared *shared, const chip8_vm *vm, uint64_t frame, uint64_t executed) {
+    chip8_frame *next = &shared->segment->frame;
+    uint32_t seq = begin(shared->segment);
+
+    // written in place, and the display only when something has
+    // been drawn or stored since; most frames only draw a little,
+    // and the registers are a cache line or two
+    next->frame = frame;
+    next->executed = executed;
+    memcpy(next->rs1, vm->rs1, sizeof(next->rs1));
+    memcpy(next->rs2, vm->rs2, sizeof(next->rs2));
+    memcpy(next->stack, vm->stack, sizeof(next->stack));
+    next->keys = vm->keys;
+    next->hires = vm->hires;
+    next->halted = vm->halted;
+    next->running = true;
+
+    if (!shared->published || shared->writes != vm->writes) {
+        memcpy(next->display, vm->display, sizeof(next->display));
+        shared->writes = vm->writes;
+        shared->published = true;
+    }
+
+    end(shared->segment, seq);
+}
+
+chip8_shared *chip8_shared_open(const char *name) {
+    return map(name, false);
+}
+
+bool chip8_shared_snapshot(const chip8_shared *shared, chip8_frame *frame) {
+    chip8_segment *segment = shared->segment;
+
+    if (memcmp(segment->magic, CHIP8_SHARED_MAGIC, sizeof(segment->magic)) != 0) {
+        return false;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if (segment->version != CHIP8_SHARED_VERSION || segment->size != sizeof(chip8_frame)) {
+        return false;
+    }
+
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&segment->seq, memory_order_acquire);
+
+        // the machine may have been preempted mid-frame; let it finish
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(frame, &segment->frame, sizeof(*frame));
+        atomic_thread_fence(memory_order_acquire);
+
+        if (atomic_load_explicit(&segment->seq, memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+}
+
+void chip8_shared_close(chip8_shared *shared) {
+    if (shared == NULL) {
+        return;
+    }
+
+    if (shared->owner) {
+        uint32_t seq = begin(shared->segment);
+
+        // readers still attached see the last frame, marked as such
+        shared->segment->frame.running = false;
+        end(shared->segment, seq);
+        shm_unlink(shared->name);
+    }
+
+    munmap(shared->segment, sizeof(chip8_segment));
+    free(shared);
+}
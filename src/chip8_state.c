@@ -0,0 +1,292 @@
+/************************************
+ * chip8_state.c - saved states, with main memory shared
+ *                 copy-on-write between them
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "chip8_internal.h"
+
+#define CHIP8_STATE_PAGE (1 << CHIP8_STATE_PAGE_SHIFT)
+
+_Static_assert(CHIP8_STATE_PAGES <= 64, "one bit per page in vm->dirty");
+
+/**
+ * main memory as it was when saved
+ *
+ * any number of states and machines may hold it, from any
+ * number of threads, and the last one to let go frees it. It
+ * is only changed while the one machine saving over it is the
+ * only other holder. Two pages with the same version hold the
+ * same bytes, in this copy or any other
+ */
+typedef struct chip8_memory {
+    _Atomic uint32_t refs;
+    uint64_t versions[CHIP8_STATE_PAGES];
+    uint8_t bytes[CHIP8_MEMORY_CAPACITY];
+} chip8_memory;
+
+/**
+ * the next version, one per save that stored to memory, taken
+ * by every page it wrote
+ */
+static _Atomic uint64_t versions = 1;
+
+/**
+ * the size of a state on disk, after the header
+ */
+#define CHIP8_STATE_SIZE (sizeof(((chip8_state *) 0)->rs1) + sizeof(((chip8_state *) 0)->rs2) + \
+    sizeof(((chip8_state *) 0)->stack) + sizeof(uint16_t) + sizeof(uint32_t) + 2 + \
+    sizeof(((chip8_state *) 0)->display) + CHIP8_MEMORY_CAPACITY)
+
+static chip8_memory *memory_new(void) {
+    chip8_memory *memory = malloc(sizeof(chip8_memory));
+
+    if (memory != NULL) {
+        atomic_init(&memory->refs, 1);
+    }
+
+    return memory;
+}
+
+static chip8_memory *memory_hold(chip8_memory *memory) {
+    if (memory != NULL) {
+        atomic_fetch_add_explicit(&memory->refs, 1, memory_order_relaxed);
+    }
+
+    return memory;
+}
+
+static void memory_drop(chip8_memory *memory) {
+    if (memory != NULL && atomic_fetch_sub_explicit(&memory->refs, 1, memory_order_acq_rel) == 1) {
+        free(memory);
+    }
+}
+
+bool chip8_vm_save(chip8_vm *vm, chip8_state *state) {
+    chip8_memory *memory = vm->saved;
+    uint64_t dirty = vm->dirty;
+
+    // with nothing stored since, the copy from the last save or
+    // restore is still good. Otherwise, held by nobody but this
+    // machine and the state being saved over, nobody else can
+    // see it change, so only the pages written need copying in
+    if (memory == NULL || (dirty != 0 && atomic_load_explicit(&memory->refs, memory_order_acquire)
+            != 1u + (state->memory == memory))) {
+        chip8_memory *copy = memory_new();
+
+        if (copy == NULL) {
+            return false;
+        }
+
+        memcpy(copy->bytes, vm->memory, sizeof(copy->bytes));
+
+        if (memory != NULL) {
+            memcpy(copy->versions, memory->versions, sizeof(copy->versions));
+        } else {
+            dirty = ~0ull;
+        }
+
+        memory_drop(memory);
+        vm->saved = memory = copy;
+    } else {
+        for (int i = 0; i < CHIP8_STATE_PAGES; i++) {
+            if (dirty & (1ull << i)) {
+                memcpy(&memory->bytes[i * CHIP8_STATE_PAGE], &vm->memory[i * CHIP8_STATE_PAGE], CHIP8_STATE_PAGE);
+            }
+        }
+    }
+
+    if (dirty != 0) {
+        uint64_t version = atomic_fetch_add_explicit(&versions, 1, memory_order_relaxed);
+
+        for (int i = 0; i < CHIP8_STATE_PAGES; i++) {
+            if (dirty & (1ull << i)) {
+                memory->versions[i] = version;
+            }
+        }
+
+        vm->dirty = 0;
+    }
+
+    if (state->memory != memory) {
+        memory_hold(memory);
+        memory_drop(state->memory);
+        state->memory = memory;
+    }
+
+    memcpy(state->rs1, vm->rs1, sizeof(state->rs1));
+    memcpy(state->rs2, vm->rs2, sizeof(state->rs2));
+    memcpy(state->stack, vm->stack, sizeof(state->stack));
+    memcpy(state->display, vm->display, sizeof(state->display));
+    state->keys = vm->keys;
+    state->rng = vm->rng;
+    state->hires = vm->hires;
+    state->halted = vm->halted;
+
+    return true;
+}
+
+void chip8_vm_restore(chip8_vm *vm, const chip8_state *state) {
+    chip8_memory *memory = state->memory;
+    uint64_t changed = vm->dirty;
+
+    if (vm->saved != memory) {
+        for (int i = 0; i < CHIP8_STATE_PAGES; i++) {
+            if (vm->saved == NULL || vm->saved->versions[i] != memory->versions[i]) {
+                changed |= 1ull << i;
+            }
+        }
+
+        memory_hold(memory);
+        memory_drop(vm->saved);
+        vm->saved = memory;
+    }
+
+    // bring in the pages that differ; code cached from them is stale now
+    for (int i = 0; i < CHIP8_STATE_PAGES; i++) {
+        if (changed & (1ull << i)) {
+            memcpy(&vm->memory[i * CHIP8_STATE_PAGE], &memory->bytes[i * CHIP8_STATE_PAGE], CHIP8_STATE_PAGE);
+            invalidate(vm, i * CHIP8_STATE_PAGE, CHIP8_STATE_PAGE);
+        }
+    }
+
+    memcpy(vm->rs1, state->rs1, sizeof(vm->rs1));
+    memcpy(vm->rs2, state->rs2, sizeof(vm->rs2));
+    memcpy(vm->stack, state->stack, sizeof(vm->stack));
+    memcpy(vm->display, state->display, sizeof(vm->display));
+
+    // every core indexes memory, the stack and the JIT's entry
+    // table with these unchecked, so keep them in range whatever
+    // the state was filled in from
+    vm->rs2[CHIP8_PC] &= CHIP8_ADDRESS_MASK;
+    vm->rs2[CHIP8_IX] &= CHIP8_ADDRESS_MASK;
+    vm->rs2[CHIP8_SP] &= CHIP8_STACK_SIZE - 1;
+
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++) {
+        vm->stack[i] &= CHIP8_ADDRESS_MASK;
+    }
+
+    vm->keys = state->keys;
+    vm->rng = state->rng;
+    vm->hires = state->hires;
+    vm->halted = state->halted;
+
+    vm->dirty = 0;
+    vm->writes++;
+    vm->idle = false;
+    vm->probe.armed = false;
+}
+
+bool chip8_vm_fork(chip8_vm *vm, chip8_vm *clone) {
+    chip8_state state = { 0 };
+
+    if (!chip8_vm_save(vm, &state)) {
+        return false;
+    }
+
+    chip8_vm_init(clone);
+    chip8_vm_set_core(clone, vm->core);
+    clone->skip_idle = vm->skip_idle;
+    chip8_vm_restore(clone, &state);
+    chip8_state_release(&state);
+
+    return true;
+}
+
+void chip8_state_fork(const chip8_state *state, chip8_state *clone) {
+    // the clone only copies the pointer to memory
+    memcpy(clone, state, sizeof(*clone));
+    memory_hold(clone->memory);
+}
+
+void chip8_state_release(chip8_state *state) {
+    // nothing else needs clearing for the state to be saved or
+    // read into again
+    memory_drop(state->memory);
+    state->memory = NULL;
+}
+
+void state_detach(chip8_vm *vm) {
+    memory_drop(vm->saved);
+    vm->saved = NULL;
+    vm->dirty = ~0ull;
+}
+
+bool chip8_state_write(const chip8_state *state, FILE *out) {
+    chip8_state_header header = { CHIP8_STATE_MAGIC, CHIP8_STATE_VERSION, CHIP8_STATE_SIZE };
+    uint8_t flags[2] = { state->hires, state->halted };
+
+    // a zeroed or released state holds no machine to write
+    if (state->memory == NULL) {
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(state->rs1, sizeof(state->rs1), 1, out);
+    fwrite(state->rs2, sizeof(state->rs2), 1, out);
+    fwrite(state->stack, sizeof(state->stack), 1, out);
+    fwrite(&state->keys, sizeof(state->keys), 1, out);
+    fwrite(&state->rng, sizeof(state->rng), 1, out);
+    fwrite(flags, sizeof(flags), 1, out);
+    fwrite(state->display, sizeof(state->display), 1, out);
+
+    fwrite(state->memory->bytes, sizeof(state->memory->bytes), 1, out);
+
+    return !ferror(out);
+}
+
+bool chip8_state_read(chip8_state *state, FILE *in) {
+    chip8_state_header header;
+    uint8_t flags[2];
+    chip8_memory *memory = memory_new();
+
+    if (memory == NULL) {
+        return false;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CHIP8_STATE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != CHIP8_STATE_VERSION || header.size != CHIP8_STATE_SIZE) {
+        memory_drop(memory);
+        return false;
+    }
+
+    if (fread(state->rs1, sizeof(state->rs1), 1, in) != 1 || fread(state->rs2, sizeof(state->rs2), 1, in) != 1
+            || fread(state->stack, sizeof(state->stack), 1, in) != 1 || fread(&state->keys, sizeof(state->keys), 1, in) != 1
+            || fread(&state->rng, sizeof(state->rng), 1, in) != 1 || fread(flags, sizeof(flags), 1, in) != 1
+            || fread(state->display, sizeof(state->display), 1, in) != 1
+            || fread(memory->bytes, sizeof(memory->bytes), 1, in) != 1) {
+        memory_drop(memory);
+        return false;
+    }
+
+    // a file from anywhere else may hold addresses no machine could
+    bool valid = state->rs2[CHIP8_PC] <= CHIP8_ADDRESS_MASK && state->rs2[CHIP8_IX] <= CHIP8_ADDRESS_MASK
+        && state->rs2[CHIP8_SP] < CHIP8_STACK_SIZE;
+
+    for (int i = 0; valid && i < CHIP8_STACK_SIZE; i++) {
+        valid = state->stack[i] <= CHIP8_ADDRESS_MASK;
+    }
+
+    if (!valid) {
+        memory_drop(memory);
+        return false;
+    }
+
+    // nothing else has these bytes, so every page is new
+    uint64_t version = atomic_fetch_add_explicit(&versions, 1, memory_order_relaxed);
+
+    for (int i = 0; i < CHIP8_STATE_PAGES; i++) {
+        memory->versions[i] = version;
+    }
+
+    state->hires = flags[0];
+    state->halted = flags[1];
+    memory_drop(state->memory);
+    state->memory = memory;
+
+    return true;
+}
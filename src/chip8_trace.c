@@ -0,0 +1,184 @@
+/************************************
+ * chip8_trace.c - print an execution trace written
+ *                 by chip8 -t
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+#define CHIP8_TRACE_BATCH 4096
+
+/**
+ * write the instruction back out in assembler syntax, from
+ * the fields the interpreter decoded
+ */
+static void disassemble(const chip8_trace_record *r, char *text, size_t size) {
+    const chip8_operations *op = optab;
+
+    while (op->mnemonic != NULL && (op->opr != CHIP8_OPR_IX || op->opcode != r->opcode)) {
+        op++;
+    }
+
+    if (op->mnemonic == NULL) {
+        snprintf(text, size, "?? 0x%04x", r->word);
+        return;
+    }
+
+    int len = snprintf(text, size, "%s", op->mnemonic);
+
+    for (int i = 0; i < 3 && op->operands[i] != CHIP8_OP_NONE; i++) {
+        const char *sep = i == 0 ? " " : ", ";
+
+        switch (op->operands[i]) {
+            case CHIP8_OP_REG8:
+                len += snprintf(text + len, size - len, "%sV%X", sep, r->vx);
+                break;
+            case CHIP8_OP_REG4:
+                len += snprintf(text + len, size - len, "%sV%X", sep, r->vy);
+                break;
+            case CHIP8_OP_REG0:
+                len += snprintf(text + len, size - len, "%sV0", sep);
+                break;
+            case CHIP8_OP_DT:
+                len += snprintf(text + len, size - len, "%sDT", sep);
+                break;
+            case CHIP8_OP_ST:
+                len += snprintf(text + len, size - len, "%sST", sep);
+                break;
+            case CHIP8_OP_IX:
+                len += snprintf(text + len, size - len, "%sI", sep);
+                break;
+            case CHIP8_OP_IXR:
+                len += snprintf(text + len, size - len, "%s[I]", sep);
+                break;
+            case CHIP8_OP_BCD:
+                len += snprintf(text + len, size - len, "%sB", sep);
+                break;
+            case CHIP8_OP_SPRITE:
+                len += snprintf(text + len, size - len, "%sF", sep);
+                break;
+            case CHIP8_OP_KEY:
+                len += snprintf(text + len, size - len, "%sK", sep);
+                break;
+            case CHIP8_OP_NIBBLE:
+            case CHIP8_OP_NULL:
+                len += snprintf(text + len, size - len, "%s%X", sep, r->byte);
+                break;
+            case CHIP8_OP_BYTE:
+                len += snprintf(text + len, size - len, "%s0x%02x", sep, r->byte);
+                break;
+            case CHIP8_OP_SLAB:
+                len += snprintf(text + len, size - len, "%s0x%03x", sep, r->slab);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * the registers the instruction changed, and their new values
+ */
+static void changes(const chip8_trace_record *r, char *text, size_t size) {
+    static const char *names[CHIP8_SP_REGS] = { "PC", "I", "SP", "DT", "ST" };
+    uint16_t rs2[CHIP8_SP_REGS] = { r->pc, r->ix, r->sp, r->dt, r->st };
+    int len = 0;
+
+    text[0] = '\0';
+
+    for (int i = 0; i < CHIP8_GP_REGS; i++) {
+        if (r->changed & (1u << i)) {
+            len += snprintf(text + len, size - len, "V%X=%02x ", i, r->v[i]);
+        }
+    }
+
+    for (int i = CHIP8_IX; i < CHIP8_SP_REGS; i++) {
+        if (r->changed & CHIP8_TRACE_RS2(i)) {
+            len += snprintf(text + len, size - len, i == CHIP8_IX ? "%s=%03x " : "%s=%02x ", names[i], rs2[i]);
+        }
+    }
+
+    if (r->halted) {
+        snprintf(text + len, size - len, "HALTED");
+    }
+}
+
+int main(int argc, char **argv) {
+    uint64_t limit = 0;
+    int opt;
+
+    static struct option options[] = {
+        { "records", required_argument, NULL, 'n' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while ((opt = getopt_long(argc, argv, "n:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                limit = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1) {
+        printf("usage: %s [-n records] TRACE\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[optind], "rb");
+    chip8_trace_header header;
+
+    if (in == NULL) {
+        printf("Error opening %s\n", argv[optind]);
+        return 2;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CHIP8_TRACE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != CHIP8_TRACE_VERSION || header.size != sizeof(chip8_trace_record)) {
+        printf("%s is not a trace this tool can read\n", argv[optind]);
+        fclose(in);
+        return 2;
+    }
+
+    static chip8_trace_record records[CHIP8_TRACE_BATCH];
+    uint64_t seq = 0, total = 0, skipped = 0;
+    size_t count;
+    char text[32], delta[160];
+
+    printf("%12s  %-4s %-5s %-18s %s\n", "seq", "pc", "word", "instruction", "changes");
+
+    while ((limit == 0 || total < limit) && (count = fread(records, sizeof(chip8_trace_record), CHIP8_TRACE_BATCH, in)) > 0) {
+        for (size_t i = 0; i < count && (limit == 0 || total < limit); i++) {
+            const chip8_trace_record *r = &records[i];
+
+            // a gap in the numbering is an idle loop the machine skipped ahead through
+            if (r->seq != seq) {
+                printf("%12s  ... %llu instructions skipped idle\n", "", (unsigned long long) (r->seq - seq));
+                skipped += r->seq - seq;
+            }
+
+            disassemble(r, text, sizeof(text));
+            changes(r, delta, sizeof(delta));
+            printf("%12llu  %03x  %04x  %-18s %s\n", (unsigned long long) r->seq, r->pc, r->word, text, delta);
+
+            seq = r->seq + 1;
+            total++;
+        }
+    }
+
+    fprintf(stderr, "%llu records, %llu instructions skipped idle\n", (unsigned long long) total, (unsigned long long) skipped);
+
+    fclose(in);
+
+    return 0;
+}
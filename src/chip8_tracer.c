@@ -0,0 +1,190 @@
+/************************************
+ * chip8_tracer.c - binary execution traces, written
+ *                  through a ring buffer per machine
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8_internal.h"
+
+/**
+ * how long the drain thread sleeps when the ring is empty
+ */
+#define CHIP8_TRACE_IDLE_NS 200000
+
+_Static_assert(sizeof(chip8_trace_record) == 48, "trace records are written to disk as they are");
+
+/**
+ * the ring buffer
+ *
+ * one producer, the machine, and one consumer, the drain
+ * thread. Each side owns one of the counters and only reads
+ * the other, so neither takes a lock; they live on cache
+ * lines of their own so that the two threads do not keep
+ * stealing one line from each other. The machine also keeps
+ * its own copy of how far the drain thread had got, and only
+ * reads the real one again when that says the ring is full
+ */
+typedef struct chip8_trace {
+    _Alignas(64) _Atomic uint64_t head; // records written by the machine
+    uint64_t seq;
+    uint64_t limit;
+
+    _Alignas(64) _Atomic uint64_t tail; // records written out to the file
+    _Atomic bool stop;
+
+    FILE *out;
+    pthread_t thread;
+    chip8_trace_record records[CHIP8_TRACE_RECORDS];
+} chip8_trace;
+
+/**
+ * the drain thread: write out whatever the machine has put
+ * in the ring, in as few writes as the wrap-around allows,
+ * until tracing stops and the ring is empty
+ */
+static void * drain(void *arg) {
+    chip8_trace *trace = arg;
+    uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+    for (;;) {
+        bool stop = atomic_load_explicit(&trace->stop, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+        if (head == tail) {
+            if (stop) {
+                break;
+            }
+
+            struct timespec idle = { 0, CHIP8_TRACE_IDLE_NS };
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        uint64_t start = tail & (CHIP8_TRACE_RECORDS - 1);
+        uint64_t count = head - tail;
+
+        if (count > CHIP8_TRACE_RECORDS - start) {
+            count = CHIP8_TRACE_RECORDS - start;
+        }
+
+        // on a write error keep emptying the ring, so the machine never waits forever
+        fwrite(&trace->records[start], sizeof(chip8_trace_record), count, trace->out);
+
+        tail += count;
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+    }
+
+    return NULL;
+}
+
+bool chip8_vm_trace_start(chip8_vm *vm, const char *path) {
+    chip8_trace_header header = { CHIP8_TRACE_MAGIC, CHIP8_TRACE_VERSION, sizeof(chip8_trace_record) };
+
+    chip8_vm_trace_stop(vm);
+
+    chip8_trace *trace = aligned_alloc(64, sizeof(chip8_trace));
+
+    if (trace == NULL) {
+        return false;
+    }
+
+    if ((trace->out = fopen(path, "wb")) == NULL) {
+        free(trace);
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, trace->out);
+
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->stop, false);
+    trace->seq = 0;
+    trace->limit = CHIP8_TRACE_RECORDS;
+
+    if (pthread_create(&trace->thread, NULL, drain, trace) != 0) {
+        fclose(trace->out);
+        free(trace);
+        return false;
+    }
+
+    vm->trace = trace;
+
+    return true;
+}
+
+void chip8_vm_trace_stop(chip8_vm *vm) {
+    chip8_trace *trace = vm->trace;
+
+    if (trace == NULL) {
+        return;
+    }
+
+    atomic_store_explicit(&trace->stop, true, memory_order_release);
+    pthread_join(trace->thread, NULL);
+
+    fclose(trace->out);
+    free(trace);
+    vm->trace = NULL;
+}
+
+void trace_step(chip8_vm *vm, uint16_t pc, uint16_t word, const chip8_decoded *d) {
+    chip8_trace *trace = vm->trace;
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    uint8_t rs1[CHIP8_GP_REGS];
+    uint16_t rs2[CHIP8_SP_REGS];
+
+    memcpy(rs1, vm->rs1, sizeof(rs1));
+    memcpy(rs2, vm->rs2, sizeof(rs2));
+
+    execute(vm, d);
+
+    // wait for the drain thread to make room
+    while (head == trace->limit) {
+        trace->limit = atomic_load_explicit(&trace->tail, memory_order_acquire) + CHIP8_TRACE_RECORDS;
+
+        if (head == trace->limit) {
+            sched_yield();
+        }
+    }
+
+    chip8_trace_record *r = &trace->records[head & (CHIP8_TRACE_RECORDS - 1)];
+
+    r->seq = trace->seq++;
+    r->pc = pc;
+    r->word = word;
+    r->opcode = d->opcode;
+    r->slab = d->slab;
+    r->vx = d->vx;
+    r->vy = d->vy;
+    r->byte = d->byte;
+    r->sp = vm->rs2[CHIP8_SP];
+    r->ix = vm->rs2[CHIP8_IX];
+    r->dt = vm->rs2[CHIP8_DL];
+    r->st = vm->rs2[CHIP8_ST];
+    r->keys = vm->keys;
+    r->halted = vm->halted;
+    r->hires = vm->hires;
+    r->changed = 0;
+
+    for (int i = 0; i < CHIP8_GP_REGS; i++) {
+        r->v[i] = vm->rs1[i];
+        r->changed |= (uint32_t) (rs1[i] != vm->rs1[i]) << i;
+    }
+
+    for (int i = CHIP8_IX; i < CHIP8_SP_REGS; i++) {
+        r->changed |= (uint32_t) (rs2[i] != vm->rs2[i]) << (CHIP8_GP_REGS + i);
+    }
+
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+void trace_skip(chip8_vm *vm, uint64_t skipped) {
+    vm->trace->seq += skipped;
+}
@@ -0,0 +1,948 @@
+/************************************
+ * chip8_vm.c - CHIP-8 machine and interpreter cores
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <pthread.h>
+#include <string.h>
+
+#include "chip8_internal.h"
+
+/**
+ * built-in hexadecimal font sprites 0-F
+ */
+static const uint8_t font[16 * CHIP8_FONT_SPRITE_SIZE] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+};
+
+chip8_decoded dectab[CHIP8_DECODE_TABLE_SIZE];
+
+static pthread_once_t dectab_once = PTHREAD_ONCE_INIT;
+
+/**
+ * the block cache
+ *
+ * blocks are decoded once into an array of pre-split operations
+ * and replayed until a store overlaps them. pages counts the live
+ * blocks on each page so that stores to pages without code cost
+ * nothing
+ */
+typedef struct {
+    uint16_t start; // address of the first instruction
+    uint16_t size; // bytes of memory covered
+    uint16_t count; // number of operations
+    chip8_decoded ops[];
+} chip8_block;
+
+typedef struct chip8_block_cache {
+    chip8_block *blocks[CHIP8_MEMORY_CAPACITY];
+    uint16_t pages[CHIP8_PAGES];
+} chip8_block_cache;
+
+/**
+ * fill the decode table by matching every possible
+ * instruction word against optab, once per process
+ */
+static void decode_init(void);
+
+static uint64_t run_threaded(chip8_vm *vm, uint64_t cycles);
+static uint64_t run_block(chip8_vm *vm, uint64_t cycles);
+
+/**
+ * run one instruction on the reference core
+ */
+static void step(chip8_vm *vm);
+
+/**
+ * go round the idle loop the machine stopped in, and skip
+ * as many whole trips of the `left` instructions as fit
+ */
+static uint64_t idle_skip(chip8_vm *vm, uint64_t left);
+
+/**
+ * decode the block starting at `start` into the cache
+ */
+static chip8_block *translate(chip8_vm *vm, uint16_t start);
+static void evict(chip8_block_cache *cache, uint16_t start);
+static void flush_blocks(chip8_vm *vm);
+
+void chip8_vm_init(chip8_vm *vm) {
+    pthread_once(&dectab_once, decode_init);
+
+    memset(vm, 0, sizeof(*vm));
+    vm->core = CHIP8_CORE_THREADED;
+    vm->skip_idle = true;
+
+    chip8_vm_reset(vm);
+}
+
+void chip8_vm_reset(chip8_vm *vm) {
+    flush_blocks(vm);
+
+#if CHIP8_JIT
+    if (vm->jit != NULL) {
+        jit_flush(vm);
+    }
+#endif
+
+    memset(vm->rs1, 0, sizeof(vm->rs1));
+    memset(vm->rs2, 0, sizeof(vm->rs2));
+    memset(vm->memory, 0, sizeof(vm->memory));
+    memset(vm->stack, 0, sizeof(vm->stack));
+    memset(vm->display, 0, sizeof(vm->display));
+    memcpy(vm->memory + CHIP8_FONT_START, font, sizeof(font));
+
+    vm->rs2[CHIP8_PC] = CHIP8_PROGRAM_START;
+    vm->hires = false;
+    vm->keys = 0;
+    vm->halted = false;
+    vm->rng = 0x2545F491;
+    vm->idle = false;
+    vm->idled = 0;
+    vm->writes = 0;
+    vm->dirty = ~0ull;
+    memset(&vm->probe, 0, sizeof(vm->probe));
+}
+
+void chip8_vm_free(chip8_vm *vm) {
+    chip8_vm_trace_stop(vm);
+    state_detach(vm);
+    flush_blocks(vm);
+    free(vm->cache);
+    vm->cache = NULL;
+
+#if CHIP8_JIT
+    jit_free(vm);
+#endif
+}
+
+bool chip8_vm_set_core(chip8_vm *vm, chip8_core core) {
+    if (core == CHIP8_CORE_JIT) {
+#if CHIP8_JIT
+        if (!jit_init(vm)) {
+            return false;
+        }
+#else
+        return false;
+#endif
+    }
+
+    vm->core = core;
+
+    return true;
+}
+
+uint16_t chip8_vm_load(chip8_vm *vm, const char *path) {
+    FILE *program = fopen(path, "rb");
+
+    if (program == NULL) {
+        return 0;
+    }
+
+    uint16_t size = fread(vm->memory + CHIP8_PROGRAM_START, sizeof(uint8_t), CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START, program);
+    fclose(program);
+
+    invalidate(vm, CHIP8_PROGRAM_START, CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START);
+
+    return size;
+}
+
+uint16_t chip8_vm_load_buffer(chip8_vm *vm, const uint8_t *program, size_t size) {
+    if (size > CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START) {
+        size = CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START;
+    }
+
+    memcpy(vm->memory + CHIP8_PROGRAM_START, program, size);
+    invalidate(vm, CHIP8_PROGRAM_START, CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START);
+
+    return (uint16_t) size;
+}
+
+bool chip8_vm_step(chip8_vm *vm) {
+    if (!vm->halted) {
+        step(vm);
+    }
+
+    return !vm->halted;
+}
+
+uint64_t chip8_vm_run(chip8_vm *vm, uint64_t cycles) {
+    uint64_t executed;
+
+    vm->idle = false;
+
+    // only the reference core records and counts what it runs
+    switch (vm->trace != NULL || vm->profile != NULL ? CHIP8_CORE_SWITCH : vm->core) {
+        case CHIP8_CORE_SWITCH:
+            executed = run_switch(vm, cycles);
+            break;
+        case CHIP8_CORE_BLOCK:
+            executed = run_block(vm, cycles);
+            break;
+#if CHIP8_JIT
+        case CHIP8_CORE_JIT:
+            executed = run_jit(vm, cycles);
+            break;
+#endif
+        default:
+            executed = run_threaded(vm, cycles);
+            break;
+    }
+
+    if (vm->idle && cycles != 0) {
+        executed += idle_skip(vm, cycles - executed);
+    }
+
+    return executed;
+}
+
+bool idle_check(chip8_vm *vm, uint16_t pc) {
+    chip8_idle_probe *probe = &vm->probe;
+
+    vm->rs2[CHIP8_PC] = pc;
+
+    if (probe->armed && probe->pc == pc) {
+        probe->armed = false;
+
+        if (probe->writes == vm->writes && probe->rng == vm->rng && probe->keys == vm->keys &&
+            memcmp(probe->rs1, vm->rs1, sizeof(vm->rs1)) == 0 &&
+            memcmp(probe->rs2, vm->rs2, sizeof(vm->rs2)) == 0 &&
+            memcmp(probe->stack, vm->stack, sizeof(vm->stack)) == 0) {
+            probe->backoff = 0;
+            vm->idle = true;
+
+            return true;
+        }
+
+        // went round and did something: a loop doing work, look less often
+        probe->backoff = probe->backoff < CHIP8_IDLE_BACKOFF / 2 ? probe->backoff * 2 + 1 : CHIP8_IDLE_BACKOFF;
+        probe->wait = probe->backoff;
+
+        return false;
+    }
+
+    // remember the machine as it is, to compare next time round
+    probe->armed = true;
+    probe->pc = pc;
+    probe->writes = vm->writes;
+    probe->rng = vm->rng;
+    probe->keys = vm->keys;
+    memcpy(probe->rs1, vm->rs1, sizeof(vm->rs1));
+    memcpy(probe->rs2, vm->rs2, sizeof(vm->rs2));
+    memcpy(probe->stack, vm->stack, sizeof(vm->stack));
+
+    return false;
+}
+
+static uint64_t idle_skip(chip8_vm *vm, uint64_t left) {
+    uint16_t head = vm->rs2[CHIP8_PC];
+    uint64_t trip = 0;
+
+    // the machine is the same every time it gets back here, so
+    // one trip round tells how long every trip is
+    do {
+        step(vm);
+        trip++;
+    } while (trip < left && vm->rs2[CHIP8_PC] != head);
+
+    if (trip == left) {
+        return left;
+    }
+
+    uint64_t rest = (left - trip) % trip;
+    vm->idled += left - trip - rest;
+
+    if (vm->trace != NULL) {
+        trace_skip(vm, left - trip - rest);
+    }
+
+    if (vm->profile != NULL) {
+        profile_skip(vm, head, left - trip - rest);
+    }
+
+    for (uint64_t i = 0; i < rest; i++) {
+        step(vm);
+    }
+
+    return left;
+}
+
+void chip8_vm_tick(chip8_vm *vm) {
+    // a snapshot from before the tick would not match for a loop
+    // reading DT, which is not the loop doing any work
+    vm->probe.armed = false;
+
+    if (vm->rs2[CHIP8_DL] > 0) {
+        vm->rs2[CHIP8_DL]--;
+    }
+
+    if (vm->rs2[CHIP8_ST] > 0) {
+        vm->rs2[CHIP8_ST]--;
+    }
+}
+
+uint32_t chip8_vm_checksum(const chip8_vm *vm) {
+    uint32_t checksum = 0;
+
+    for (int i = 0; i < CHIP8_MEMORY_CAPACITY; i++) {
+        checksum = (checksum ^ vm->memory[i]) * 16777619u;
+    }
+
+    return checksum;
+}
+
+/**
+ * the SUPER-CHIP display
+ *
+ * high resolution sprites, and the 16x16 ones DXY0 draws in
+ * either mode, are drawn a row at a time like the others: the
+ * sprite row is rotated across both words of a 128-pixel row.
+ * Scrolling moves whole words, with memmove for rows and
+ * shifts GCC vectorizes for columns. Scroll distances are in
+ * pixels of the current resolution
+ */
+uint8_t draw_wide(chip8_vm *vm, uint8_t x, uint8_t y, uint16_t ix, uint8_t n) {
+    unsigned width = vm->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH;
+    unsigned height = vm->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+    unsigned bytes = n == 0 ? 2 : 1;
+    unsigned rows = n == 0 ? 16 : n;
+    unsigned shift = x & (width - 1);
+    uint64_t hit = 0;
+
+    for (unsigned i = 0; i < rows; i++) {
+        uint16_t addr = ix + i * bytes;
+        uint64_t bits = vm->memory[addr & CHIP8_ADDRESS_MASK];
+        uint64_t *row = vm->display[(y + i) & (height - 1)];
+
+        if (bytes == 2) {
+            bits = bits << 8 | vm->memory[(addr + 1) & CHIP8_ADDRESS_MASK];
+        }
+
+        uint64_t left = bits << (64 - 8 * bytes), right = 0;
+
+        if (!vm->hires) {
+            left = (left >> shift) | (left << (-shift & 63));
+        } else {
+            unsigned s = shift & 63;
+
+            if (shift & 64) {
+                right = left;
+                left = 0;
+            }
+
+            if (s != 0) {
+                uint64_t l = (left >> s) | (right << (64 - s));
+                right = (right >> s) | (left << (64 - s));
+                left = l;
+            }
+        }
+
+        hit |= (row[0] & left) | (row[1] & right);
+        row[0] ^= left;
+        row[1] ^= right;
+    }
+
+    vm->writes++;
+
+    return hit != 0;
+}
+
+void set_hires(chip8_vm *vm, bool hires) {
+    // the buffer always has room for high resolution, so switching
+    // only clears it
+    vm->hires = hires;
+    memset(vm->display, 0, sizeof(vm->display));
+    vm->writes++;
+}
+
+void scroll_down(chip8_vm *vm, uint8_t n) {
+    unsigned height = vm->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT;
+
+    memmove(vm->display[n], vm->display[0], (height - n) * sizeof(vm->display[0]));
+    memset(vm->display[0], 0, n * sizeof(vm->display[0]));
+    vm->writes++;
+}
+
+CHIP8_TARGET_CLONES
+void scroll_right(chip8_vm *vm) {
+    // in low resolution what falls off the right edge is dropped
+    uint64_t keep = vm->hires ? UINT64_MAX : 0;
+
+    for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+        uint64_t *row = vm->display[y];
+
+        row[1] = ((row[1] >> 4) | (row[0] << 60)) & keep;
+        row[0] >>= 4;
+    }
+
+    vm->writes++;
+}
+
+CHIP8_TARGET_CLONES
+void scroll_left(chip8_vm *vm) {
+    // the second word is always clear in low resolution
+    for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+        uint64_t *row = vm->display[y];
+
+        row[0] = (row[0] << 4) | (row[1] >> 60);
+        row[1] <<= 4;
+    }
+
+    vm->writes++;
+}
+
+bool chip8_vm_pixel(const chip8_vm *vm, int x, int y) {
+    x &= (vm->hires ? CHIP8_HIRES_WIDTH : CHIP8_DISPLAY_WIDTH) - 1;
+    y &= (vm->hires ? CHIP8_HIRES_HEIGHT : CHIP8_DISPLAY_HEIGHT) - 1;
+
+    return vm->display[y][x >> 6] >> (63 - (x & 63)) & 1;
+}
+
+void chip8_vm_dump(const chip8_vm *vm, FILE *out) {
+    uint32_t display = 0;
+
+    for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+        for (int w = 0; w < CHIP8_DISPLAY_WORDS; w++) {
+            for (int i = 0; i < 8; i++) {
+                display = (display ^ (uint8_t) (vm->display[y][w] >> (56 - 8 * i))) * 16777619u;
+            }
+        }
+    }
+
+    for (int i = 0; i < CHIP8_GP_REGS; i++) {
+        fprintf(out, "V%X=%02x ", i, vm->rs1[i]);
+    }
+
+    fprintf(out, "\nPC=%03x I=%03x SP=%x DT=%02x ST=%02x MEM=%08x FB=%08x%s\n",
+        vm->rs2[CHIP8_PC], vm->rs2[CHIP8_IX], vm->rs2[CHIP8_SP], vm->rs2[CHIP8_DL], vm->rs2[CHIP8_ST],
+        chip8_vm_checksum(vm), display, vm->halted ? " HALTED" : "");
+}
+
+static void decode_init(void) {
+    for (uint32_t word = 0; word < CHIP8_DECODE_TABLE_SIZE; word++) {
+        chip8_decoded *d = &dectab[word];
+        int i;
+
+        // first matching instruction wins, same order as the assembler
+        for (i = 0; optab[i].mnemonic != NULL; i++) {
+            if (optab[i].opr == CHIP8_OPR_IX && (word & optab[i].mask) == optab[i].opcode) {
+                break;
+            }
+        }
+
+        d->vx = (word & CHIP8_OP_MASK_VX8) >> 8;
+        d->vy = (word & CHIP8_OP_MASK_VX4) >> 4;
+        d->slab = word & CHIP8_OP_MASK_LSS;
+
+        if (optab[i].mnemonic == NULL) {
+            d->opcode = CHIP8_OP_ILLEGAL;
+            d->handler = CHIP8_H_ILLEGAL;
+            d->byte = 0x00;
+            continue;
+        }
+
+        d->opcode = optab[i].opcode;
+        d->byte = word & CHIP8_OP_MASK_LSB;
+
+        for (int j = 0; j < 3; j++) {
+            // DXY0's trailing operand is the nibble 0 spelled out
+            if (optab[i].operands[j] == CHIP8_OP_NIBBLE || optab[i].operands[j] == CHIP8_OP_NULL) {
+                d->byte = word & CHIP8_OP_MASK_LSN;
+            }
+        }
+
+#define X(name, op) if (d->opcode == (op)) d->handler = CHIP8_H_##name;
+        CHIP8_HANDLERS(X)
+#undef X
+    }
+}
+
+static void step(chip8_vm *vm) {
+    // fetch
+    uint16_t pc = vm->rs2[CHIP8_PC];
+    uint16_t word = fetch(vm, pc);
+    vm->rs2[CHIP8_PC] = (pc + 2) & CHIP8_ADDRESS_MASK;
+
+    // decode
+    const chip8_decoded *d = decode(word);
+
+    if (vm->profile != NULL) {
+        profile_step(vm, pc, d);
+    }
+
+    // execute, recording the instruction if the machine is traced
+    if (vm->trace != NULL) {
+        trace_step(vm, pc, word, d);
+    } else {
+        execute(vm, d);
+    }
+}
+
+uint64_t run_switch(chip8_vm *vm, uint64_t cycles) {
+    uint64_t executed = 0;
+
+    while (!vm->halted && (cycles == 0 || executed < cycles)) {
+        uint16_t pc = vm->rs2[CHIP8_PC];
+        const chip8_decoded *d = decode(fetch(vm, pc));
+
+        // stop in front of a key wait with no key down, or a loop spinning in place
+        if (d->handler == CHIP8_H_LD_KEY && vm->keys == 0 && vm->skip_idle) {
+            vm->idle = true;
+            break;
+        }
+
+        if (d->handler == CHIP8_H_JP && (uint16_t) (pc - d->slab) < CHIP8_IDLE_SPAN && idle_poll(vm) && idle_check(vm, pc)) {
+            break;
+        }
+
+        step(vm);
+        executed++;
+    }
+
+    return executed;
+}
+
+void execute(chip8_vm *vm, const chip8_decoded *d) {
+    uint8_t *vx = &vm->rs1[d->vx];
+    uint8_t vy = vm->rs1[d->vy];
+
+    switch (d->opcode) {
+        case CHIP8_OP_CLS:            // 0x00E0
+            memset(vm->display, 0, sizeof(vm->display));
+            vm->writes++;
+            break;
+        case CHIP8_OP_RET:            // 0x00EE
+            vm->rs2[CHIP8_SP] = (vm->rs2[CHIP8_SP] - 1) & (CHIP8_STACK_SIZE - 1);
+            vm->rs2[CHIP8_PC] = vm->stack[vm->rs2[CHIP8_SP]];
+            break;
+        case CHIP8_OP_SCR:            // 0x00FB
+            scroll_right(vm);
+            break;
+        case CHIP8_OP_SCL:            // 0x00FC
+            scroll_left(vm);
+            break;
+        case CHIP8_OP_LOW:            // 0x00FE
+            set_hires(vm, false);
+            break;
+        case CHIP8_OP_HIGH:           // 0x00FF
+            set_hires(vm, true);
+            break;
+        case CHIP8_OP_EXIT:           // 0x00FD
+            vm->halted = true;
+            break;
+        case CHIP8_OP_JP:             // 0x1000
+            vm->rs2[CHIP8_PC] = d->slab;
+            break;
+        case CHIP8_OP_CALL:           // 0x2000
+            vm->stack[vm->rs2[CHIP8_SP]] = vm->rs2[CHIP8_PC];
+            vm->rs2[CHIP8_SP] = (vm->rs2[CHIP8_SP] + 1) & (CHIP8_STACK_SIZE - 1);
+            vm->rs2[CHIP8_PC] = d->slab;
+            break;
+        case CHIP8_OP_LD_ADDR:        // 0xA000
+            vm->rs2[CHIP8_IX] = d->slab;
+            break;
+        case CHIP8_OP_JP_V0:          // 0xB000
+            vm->rs2[CHIP8_PC] = (d->slab + vm->rs1[CHIP8_V0]) & CHIP8_ADDRESS_MASK;
+            break;
+        case CHIP8_OP_SE_BYTE:        // 0x3000
+            if (*vx == d->byte) {
+                vm->rs2[CHIP8_PC] = (vm->rs2[CHIP8_PC] + 2) & CHIP8_ADDRESS_MASK;
+            }
+            break;
+        case CHIP8_OP_SNE_BYTE:       // 0x4000
+            if (*vx != d->byte) {
+                vm->rs2[CHIP8_PC] = (vm->rs2[CHIP8_PC] + 2) & CHIP8_ADDRESS_MASK;
+            }
+            break;
+        case CHIP8_OP_LD_BYTE:        // 0x6000
+            *vx = d->byte;
+            break;
+        case CHIP8_OP_ADD_BYTE:       // 0x7000
+            *vx += d->byte;
+            break;
+        case CHIP8_OP_RND_BYTE:       // 0xC000
+            *vx = rnd(vm) & d->byte;
+            break;
+        case CHIP8_OP_SE_REG:         // 0x5000
+            if (*vx == vy) {
+                vm->rs2[CHIP8_PC] = (vm->rs2[CHIP8_PC] + 2) & CHIP8_ADDRESS_MASK;
+            }
+            break;
+        case CHIP8_OP_LD_REG:         // 0x8000
+            *vx = vy;
+            break;
+        case CHIP8_OP_OR:             // 0x8001
+            *vx |= vy;
+            break;
+        case CHIP8_OP_AND:            // 0x8002
+            *vx &= vy;
+            break;
+        case CHIP8_OP_XOR:            // 0x8003
+            *vx ^= vy;
+            break;
+        case CHIP8_OP_ADD_REG: {      // 0x8004
+            uint16_t sum = *vx + vy;
+            *vx = (uint8_t) sum;
+            vm->rs1[CHIP8_VF] = sum > 0xFF;
+            break;
+        }
+        case CHIP8_OP_SUB: {          // 0x8005
+            uint8_t flag = *vx >= vy;
+            *vx -= vy;
+            vm->rs1[CHIP8_VF] = flag;
+            break;
+        }
+        case CHIP8_OP_SHR: {          // 0x8006
+            uint8_t flag = *vx & 0x01;
+            *vx >>= 1;
+            vm->rs1[CHIP8_VF] = flag;
+            break;
+        }
+        case CHIP8_OP_SUBN: {         // 0x8007
+            uint8_t flag = vy >= *vx;
+            *vx = vy - *vx;
+            vm->rs1[CHIP8_VF] = flag;
+            break;
+        }
+        case CHIP8_OP_SHL: {          // 0x800E
+            uint8_t flag = *vx >> 7;
+            *vx <<= 1;
+            vm->rs1[CHIP8_VF] = flag;
+            break;
+        }
+        case CHIP8_OP_SNE_REG:        // 0x9000
+            if (*vx != vy) {
+                vm->rs2[CHIP8_PC] = (vm->rs2[CHIP8_PC] + 2) & CHIP8_ADDRESS_MASK;
+            }
+            break;
+        case CHIP8_OP_SKP:            // 0xE09E
+            if (vm->keys & (1 << (*vx & 0xF))) {
+                vm->rs2[CHIP8_PC] = (vm->rs2[CHIP8_PC] + 2) & CHIP8_ADDRESS_MASK;
+            }
+            break;
+        case CHIP8_OP_SKNP:           // 0xE0A1
+            if (!(vm->keys & (1 << (*vx & 0xF)))) {
+                vm->rs2[CHIP8_PC] = (vm->rs2[CHIP8_PC] + 2) & CHIP8_ADDRESS_MASK;
+            }
+            break;
+        case CHIP8_OP_LD_KEY:         // 0xF00A
+            // wait by running this instruction again until a key is down
+            if (vm->keys == 0) {
+                vm->rs2[CHIP8_PC] = (vm->rs2[CHIP8_PC] - 2) & CHIP8_ADDRESS_MASK;
+            } else {
+                *vx = first_key(vm->keys);
+            }
+            break;
+        case CHIP8_OP_LD_DT:          // 0xF007
+            *vx = (uint8_t) vm->rs2[CHIP8_DL];
+            break;
+        case CHIP8_OP_LD_REG_DT:      // 0xF015
+            vm->rs2[CHIP8_DL] = *vx;
+            break;
+        case CHIP8_OP_LD_REG_ST:      // 0xF018
+            vm->rs2[CHIP8_ST] = *vx;
+            break;
+        case CHIP8_OP_ADD_REG_IX:     // 0xF01E
+            vm->rs2[CHIP8_IX] = (vm->rs2[CHIP8_IX] + *vx) & CHIP8_ADDRESS_MASK;
+            break;
+        case CHIP8_OP_LD_SPRITE:      // 0xF029
+            vm->rs2[CHIP8_IX] = CHIP8_FONT_START + (*vx & 0x0F) * CHIP8_FONT_SPRITE_SIZE;
+            break;
+        case CHIP8_OP_LDS_BCD:        // 0xF033
+            vm->memory[vm->rs2[CHIP8_IX]] = *vx / 100;
+            vm->memory[(vm->rs2[CHIP8_IX] + 1) & CHIP8_ADDRESS_MASK] = *vx / 10 % 10;
+            vm->memory[(vm->rs2[CHIP8_IX] + 2) & CHIP8_ADDRESS_MASK] = *vx % 10;
+            invalidate(vm, vm->rs2[CHIP8_IX], 3);
+            break;
+        case CHIP8_OP_LDS_REGS:       // 0xF055
+            for (int i = 0; i <= d->vx; i++) {
+                vm->memory[(vm->rs2[CHIP8_IX] + i) & CHIP8_ADDRESS_MASK] = vm->rs1[i];
+            }
+            invalidate(vm, vm->rs2[CHIP8_IX], d->vx + 1);
+            break;
+        case CHIP8_OP_LD_REGS:        // 0xF065
+            for (int i = 0; i <= d->vx; i++) {
+                vm->rs1[i] = vm->memory[(vm->rs2[CHIP8_IX] + i) & CHIP8_ADDRESS_MASK];
+            }
+            break;
+        case CHIP8_OP_SCD:            // 0x00C0
+            scroll_down(vm, d->byte);
+            break;
+        case CHIP8_OP_DRW_NIBBLE:     // 0xD000
+            vm->rs1[CHIP8_VF] = draw(vm, *vx, vy, vm->rs2[CHIP8_IX], d->byte);
+            break;
+        default:                      // Illegal instruction
+            vm->halted = true;
+            break;
+    }
+}
+
+#define SKIP_IF(cond) do { \
+        if (cond) { \
+            pc = (pc + 2) & CHIP8_ADDRESS_MASK; \
+        } \
+    } while (0)
+
+static uint64_t run_threaded(chip8_vm *vm, uint64_t cycles) {
+    uint8_t *v = vm->rs1;
+    uint8_t *mem = vm->memory;
+    uint16_t pc = vm->rs2[CHIP8_PC];
+    uint16_t ix = vm->rs2[CHIP8_IX];
+    uint16_t sp = vm->rs2[CHIP8_SP];
+    uint64_t budget = cycles == 0 ? UINT64_MAX : cycles;
+    uint64_t left = budget;
+    const chip8_decoded *d;
+
+    if (vm->halted) {
+        return 0;
+    }
+
+    // fetch and decode straight from memory, one instruction at a time
+#define UNDO() left++
+#define NEXT() do { \
+        if (left == 0) goto out; \
+        left--; \
+        d = &dectab[(mem[pc] << 8) | mem[(pc + 1) & CHIP8_ADDRESS_MASK]]; \
+        pc = (pc + 2) & CHIP8_ADDRESS_MASK; \
+    } while (0)
+
+#if CHIP8_COMPUTED_GOTO
+    static void *handlers[CHIP8_H_COUNT] = {
+#define X(name, op) &&L_##name,
+        CHIP8_HANDLERS(X)
+#undef X
+    };
+
+#define HANDLER(name) L_##name:
+#define DISPATCH() do { NEXT(); goto *handlers[d->handler]; } while (0)
+
+    DISPATCH();
+#else
+#define HANDLER(name) case CHIP8_H_##name:
+#define DISPATCH() goto dispatch
+
+dispatch:
+    NEXT();
+
+    switch (d->handler) {
+#endif
+
+#include "chip8_handlers.h"
+
+#if !CHIP8_COMPUTED_GOTO
+    }
+#endif
+
+#undef UNDO
+#undef NEXT
+#undef HANDLER
+#undef DISPATCH
+
+out:
+    vm->rs2[CHIP8_PC] = pc;
+    vm->rs2[CHIP8_IX] = ix;
+    vm->rs2[CHIP8_SP] = sp;
+
+    return budget - left;
+}
+
+bool ends_block(const chip8_decoded *d) {
+    switch (d->handler) {
+        case CHIP8_H_ILLEGAL:
+        case CHIP8_H_EXIT:
+        case CHIP8_H_RET:
+        case CHIP8_H_JP:
+        case CHIP8_H_CALL:
+        case CHIP8_H_JP_V0:
+        case CHIP8_H_SE_BYTE:
+        case CHIP8_H_SNE_BYTE:
+        case CHIP8_H_SE_REG:
+        case CHIP8_H_SNE_REG:
+        case CHIP8_H_SKP:
+        case CHIP8_H_SKNP:
+        case CHIP8_H_LD_KEY:
+        case CHIP8_H_LDS_BCD:  // stores may rewrite the rest of the block
+        case CHIP8_H_LDS_REGS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static chip8_block *translate(chip8_vm *vm, uint16_t start) {
+    chip8_decoded ops[CHIP8_BLOCK_MAX_OPS];
+    uint16_t count = 0;
+    uint16_t pc = start;
+
+    // a block stops at the end of memory, and the code that
+    // wraps around to address 0 is a block of its own
+    do {
+        ops[count++] = *decode(fetch(vm, pc));
+        pc += 2;
+    } while (!ends_block(&ops[count - 1]) && count < CHIP8_BLOCK_MAX_OPS && pc < CHIP8_MEMORY_CAPACITY - 1);
+
+    chip8_block *b = malloc(sizeof(chip8_block) + count * sizeof(chip8_decoded));
+
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->start = start;
+    b->size = count * 2;
+    b->count = count;
+    memcpy(b->ops, ops, count * sizeof(chip8_decoded));
+
+    vm->cache->blocks[start] = b;
+    pages_add(vm->cache->pages, start, b->size, 1);
+
+    return b;
+}
+
+static void evict(chip8_block_cache *cache, uint16_t start) {
+    chip8_block *b = cache->blocks[start];
+
+    pages_add(cache->pages, start, b->size, -1);
+    cache->blocks[start] = NULL;
+    free(b);
+}
+
+void invalidate(chip8_vm *vm, uint16_t addr, uint16_t len) {
+    chip8_block_cache *cache = vm->cache;
+
+    vm->writes++;
+    vm->dirty |= pages_mask(addr, len, CHIP8_STATE_PAGE_SHIFT);
+
+#if CHIP8_JIT
+    if (vm->jit != NULL) {
+        jit_invalidate(vm, addr, len);
+    }
+#endif
+
+    // common case: nothing cached on the pages written to
+    if (cache == NULL || !pages_used(cache->pages, addr, len)) {
+        return;
+    }
+
+    // a block overlapping the write starts at most one block size before it
+    for (int i = 1 - 2 * CHIP8_BLOCK_MAX_OPS; i < len; i++) {
+        uint16_t start = (addr + i) & CHIP8_ADDRESS_MASK;
+
+        if (cache->blocks[start] != NULL && (i >= 0 || cache->blocks[start]->size > -i)) {
+            evict(cache, start);
+        }
+    }
+}
+
+static void flush_blocks(chip8_vm *vm) {
+    if (vm->cache == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < CHIP8_MEMORY_CAPACITY; i++) {
+        if (vm->cache->blocks[i] != NULL) {
+            evict(vm->cache, i);
+        }
+    }
+}
+
+static uint64_t run_block(chip8_vm *vm, uint64_t cycles) {
+    uint8_t *v = vm->rs1;
+    uint8_t *mem = vm->memory;
+    uint16_t pc = vm->rs2[CHIP8_PC];
+    uint16_t ix = vm->rs2[CHIP8_IX];
+    uint16_t sp = vm->rs2[CHIP8_SP];
+    uint64_t budget = cycles == 0 ? UINT64_MAX : cycles;
+    uint64_t left = budget;
+    uint64_t n = 0;
+    chip8_block_cache *cache = vm->cache;
+    const chip8_block *b;
+    const chip8_decoded *d;
+
+    if (vm->halted) {
+        return 0;
+    }
+
+    if (cache == NULL && (cache = vm->cache = calloc(1, sizeof(chip8_block_cache))) == NULL) {
+        return run_threaded(vm, cycles);
+    }
+
+    // replay the pre-decoded operations of the current block, and
+    // look up the next block once they run out
+#define UNDO() left += n
+#define NEXT() do { \
+        if (--n == 0) goto next; \
+        d++; \
+        pc = (pc + 2) & CHIP8_ADDRESS_MASK; \
+    } while (0)
+
+#if CHIP8_COMPUTED_GOTO
+    static void *handlers[CHIP8_H_COUNT] = {
+#define X(name, op) &&L_##name,
+        CHIP8_HANDLERS(X)
+#undef X
+    };
+
+#define HANDLER(name) L_##name:
+#define DISPATCH() do { NEXT(); goto *handlers[d->handler]; } while (0)
+#else
+#define HANDLER(name) case CHIP8_H_##name:
+#define DISPATCH() do { NEXT(); goto dispatch; } while (0)
+#endif
+
+next:
+    if (left == 0) {
+        goto out;
+    }
+
+    if ((b = cache->blocks[pc]) == NULL && (b = translate(vm, pc)) == NULL) {
+        goto out;
+    }
+
+    n = b->count < left ? b->count : left;
+    left -= n;
+    d = b->ops;
+    pc = (pc + 2) & CHIP8_ADDRESS_MASK;
+
+#if CHIP8_COMPUTED_GOTO
+    goto *handlers[d->handler];
+#else
+dispatch:
+    switch (d->handler) {
+#endif
+
+#include "chip8_handlers.h"
+
+#if !CHIP8_COMPUTED_GOTO
+    }
+#endif
+
+#undef UNDO
+#undef NEXT
+#undef HANDLER
+#undef DISPATCH
+
+out:
+    vm->rs2[CHIP8_PC] = pc;
+    vm->rs2[CHIP8_IX] = ix;
+    vm->rs2[CHIP8_SP] = sp;
+
+    return budget - left;
+}
+
+#undef SKIP_IF
@@ -0,0 +1,318 @@
+/************************************
+ * optab.c - operation code table and reserved
+ *           symbols shared by the interpreter
+ *           and the assembler
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include "chip8.h"
+
+chip8_operations optab[] = {
+    { // CLS -> 00E0
+        "CLS",
+        CHIP8_OP_CLS,
+        CHIP8_OP_MASK_WRD,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // RET -> 00EE
+        "RET",
+        CHIP8_OP_RET,
+        CHIP8_OP_MASK_WRD,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // SCR -> 00FB
+        "SCR",
+        CHIP8_OP_SCR,
+        CHIP8_OP_MASK_WRD,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // SCL -> 00FC
+        "SCL",
+        CHIP8_OP_SCL,
+        CHIP8_OP_MASK_WRD,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // EXIT -> 00FD
+        "EXIT",
+        CHIP8_OP_EXIT,
+        CHIP8_OP_MASK_WRD,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // LOW -> 00FE
+        "LOW",
+        CHIP8_OP_LOW,
+        CHIP8_OP_MASK_WRD,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // HIGH -> 00FF
+        "HIGH",
+        CHIP8_OP_HIGH,
+        CHIP8_OP_MASK_WRD,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NONE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // SCD nibble -> 00CN
+        "SCD",
+        CHIP8_OP_SCD,
+        CHIP8_OP_MASK_GSS,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_NIBBLE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // JP addr -> 1NNN
+        "JP",
+        CHIP8_OP_JP,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_SLAB, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // CALL addr -> 2NNN
+        "CALL",
+        CHIP8_OP_CALL,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_SLAB, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // LD I, addr -> ANNN
+        "LD",
+        CHIP8_OP_LD_ADDR,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_IX, CHIP8_OP_SLAB, CHIP8_OP_NONE }
+    },
+    { // JP V0, addr
+        "JP",
+        CHIP8_OP_JP_V0,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG0, CHIP8_OP_SLAB, CHIP8_OP_NONE }
+    },
+    { // SE Vx, byte -> 3XNN
+        "SE",
+        CHIP8_OP_SE_BYTE,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
+    },
+    { // SNE Vx, byte -> 4XNN
+        "SNE",
+        CHIP8_OP_SNE_BYTE,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
+    },
+    { // LD Vx, byte -> 6XNN
+        "LD",
+        CHIP8_OP_LD_BYTE,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
+    },
+    { // ADD Vx, byte -> 7XNN
+        "ADD",
+        CHIP8_OP_ADD_BYTE,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
+    },
+    { // RND Vx, byte -> CXNN
+        "RND",
+        CHIP8_OP_RND_BYTE,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_BYTE, CHIP8_OP_NONE }
+    },
+    { // SE Vx, Vy -> 5XY0
+        "SE",
+        CHIP8_OP_SE_REG,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // LD Vx, Vy -> 8XY0
+        "LD",
+        CHIP8_OP_LD_REG,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // OR Vx, Vy -> 8XY1
+        "OR",
+        CHIP8_OP_OR,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // AND Vx, Vy -> 8XY2
+        "AND",
+        CHIP8_OP_AND,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // X0R Vx, Vy -> 8XY3
+        "XOR",
+        CHIP8_OP_XOR,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // ADD Vx, Vy -> 8XY4
+        "ADD",
+        CHIP8_OP_ADD_REG,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // SUB Vx, Vy -> 8XY5
+        "SUB",
+        CHIP8_OP_SUB,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // SHR Vx -> 8XY6
+        "SHR",
+        CHIP8_OP_SHR,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // SUBN Vx, Vy -> 8XY7
+        "SUBN",
+        CHIP8_OP_SUBN,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // SHL Vx -> 8XYE
+        "SHL",
+        CHIP8_OP_SHL,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // SNE Vx, Vy -> 9XY0
+        "SNE",
+        CHIP8_OP_SNE_REG,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NONE }
+    },
+    { // SKP Vx -> EX9E
+        "SKP",
+        CHIP8_OP_SKP,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // SKNP Vx -> EXA1
+        "SKNP",
+        CHIP8_OP_SKNP,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // LD Vx, DT -> FX07
+        "LD",
+        CHIP8_OP_LD_DT,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_DT, CHIP8_OP_NONE }
+    },
+    { // LD Vx, K -> FX0A
+        "LD",
+        CHIP8_OP_LD_KEY,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_KEY, CHIP8_OP_NONE }
+    },
+    { // LD DT, Vx -> FX15
+        "LD",
+        CHIP8_OP_LD_REG_DT,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_DT, CHIP8_OP_REG8, CHIP8_OP_NONE }
+    },
+    { // LD ST, Vx -> FX18
+        "LD",
+        CHIP8_OP_LD_REG_ST,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_ST, CHIP8_OP_REG8, CHIP8_OP_NONE }
+    },
+    { // ADD I, Vx -> FX1E
+        "ADD",
+        CHIP8_OP_ADD_REG_IX,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_IX, CHIP8_OP_REG8, CHIP8_OP_NONE }
+    },
+    { // LD F, Vx -> FX29
+        "LD",
+        CHIP8_OP_LD_SPRITE,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_SPRITE, CHIP8_OP_REG8, CHIP8_OP_NONE }
+    },
+    { // LD B, Vx -> FX33
+        "LD",
+        CHIP8_OP_LDS_BCD,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_BCD, CHIP8_OP_REG8, CHIP8_OP_NONE }
+    },
+    { // LD [I], Vx -> FX55
+        "LD",
+        CHIP8_OP_LDS_REGS,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_IXR, CHIP8_OP_REG8, CHIP8_OP_NONE }
+    },
+    { // LD Vx, [I] -> FX65
+        "LD",
+        CHIP8_OP_LD_REGS,
+        CHIP8_OP_MASK_EXX,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_IXR, CHIP8_OP_NONE }
+    },
+    { // DRW Vx, Vy, 0 -> DXY0
+        "DRW",
+        CHIP8_OP_DRW_EXT,
+        CHIP8_OP_MASK_EXT,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NULL }
+    },
+    { // DRW Vx, Vy, nibble -> DXYN
+        "DRW",
+        CHIP8_OP_DRW_NIBBLE,
+        CHIP8_OP_MASK_GSN,
+        CHIP8_OPR_IX,
+        { CHIP8_OP_REG8, CHIP8_OP_REG4, CHIP8_OP_NIBBLE }
+    },
+    { // DB byte -> NN -- assembler directive
+        "DB",
+        CHIP8_OP_DB,
+        CHIP8_OP_MASK_GSB,
+        CHIP8_OPR_DR,
+        { CHIP8_OP_BYTE, CHIP8_OP_NONE, CHIP8_OP_NONE }
+    },
+    { // Sentinal to indicate end of optab
+        NULL, 0, 0, 0, { 0 }
+    }
+};
+
+/**
+ * reserved symbols
+ */
+char asm_reserved[][4] = {
+    "V0", "V1", "V2", "V3", "V4", "V5", "V6", "V7", "V8", "V9",
+    "VA", "VB", "VC", "VD", "VE", "VF", "DT", "ST", "I", "[I]",
+    "F", "B", "K", "",
+};
@@ -0,0 +1,129 @@
+#!/bin/sh
+#####################################
+# asm.sh - golden and error tests of the
+#          assembler
+#
+# Developer: Victor Nwosu
+#####################################
+
+# usage: asm.sh <chip8c>
+
+asm=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+golden=$(cd "$(dirname "$0")/asm" && pwd)
+work=$(mktemp -d) || exit 1
+failed=0
+
+trap 'rm -rf "$work"' EXIT
+
+cd "$work" || exit 1
+
+# report a failed check and carry on with the rest
+fail() {
+    echo "asm: $*"
+    failed=1
+}
+
+# write the lines after $1 to the file $1
+write() {
+    file=$1
+    shift
+    printf '%s\n' "$@" > "$file"
+}
+
+# assemble $2 and expect exit status $1, with $3 on the first
+# line of the output when it is given
+expect() {
+    status=$1
+    source=$2
+    message=$3
+
+    "$asm" "$source" > out.txt
+    got=$?
+
+    if [ "$got" -ne "$status" ]; then
+        fail "$source exited with $got, not $status"
+    elif [ -n "$message" ] && [ "$(head -n 1 out.txt)" != "$message" ]; then
+        fail "$source printed \"$(head -n 1 out.txt)\", not \"$message\""
+    fi
+}
+
+# a source that fails on its single line $1 with message $2,
+# which must leave the last good binary alone
+bad() {
+    printf '%s\n' "$1" > bad.ch8
+    printf 'good' > bad
+    expect 6 bad.ch8 "$2"
+
+    if [ "$(cat bad)" != good ]; then
+        fail "\"$1\" overwrote the last good binary"
+    fi
+}
+
+# every form in optab against a binary checked by hand
+cp "$golden/golden.ch8" .
+expect 0 golden.ch8
+
+if ! cmp -s golden "$golden/golden.bin"; then
+    fail "golden.ch8 does not assemble to golden.bin"
+fi
+
+bad "    NOP" "Unrecognized instruction or directive on line 1 of bad.ch8: NOP"
+bad "    CLS V0" "Unrecognized instruction or directive on line 1 of bad.ch8: CLS V0"
+bad "    LD V1" "Unrecognized instruction or directive on line 1 of bad.ch8: LD V1"
+bad "    SE V1, VG" "Unrecognized instruction or directive on line 1 of bad.ch8: SE V1, VG"
+bad "    SCD 0x10" "Unrecognized instruction or directive on line 1 of bad.ch8: SCD 0x10"
+bad "    DRW V0, V1, 0x10" "Unrecognized instruction or directive on line 1 of bad.ch8: DRW V0, V1, 0x10"
+bad "    DB 0x100" "Unrecognized instruction or directive on line 1 of bad.ch8: DB 0x100"
+bad "    DB -1" "Unrecognized instruction or directive on line 1 of bad.ch8: DB -1"
+bad "    JP 0x1000" "Undefined label 0x1000 on line 1, column 8 of bad.ch8"
+bad "    JP nowhere" "Undefined label nowhere on line 1, column 8 of bad.ch8"
+bad "    LD I, nowhere" "Undefined label nowhere on line 1, column 11 of bad.ch8"
+bad "V0:" "Label V0 is a reserved symbol on line 1 of bad.ch8"
+bad "abcdefghijabcdefghijabcdefghijabc:" "Label abcdefghijabcdefghijabcdefghijabc: exceeds maximum length of 32 characters on line 1 of bad.ch8"
+
+# INCLUDE must give what assembling the text in place gives,
+# whether the fragments are assembled or come from the cache
+mkdir lib cache
+write main.ch8 "start:" "    CALL sub" "    INCLUDE lib/a.ch8" "    JP start"
+write lib/a.ch8 "a:" "    LD V0, 0x1" "    INCLUDE b.ch8" "    RET"
+write lib/b.ch8 "sub:" "    LD I, a" "    RET"
+write flat.ch8 "start:" "    CALL sub" "a:" "    LD V0, 0x1" "sub:" "    LD I, a" "    RET" "    RET" "    JP start"
+expect 0 flat.ch8
+
+for options in "" "-t 4" "-C cache" "-C cache -t 4"; do
+    rm -f main
+    "$asm" -s $options main.ch8 > out.txt
+
+    if ! cmp -s main flat; then
+        fail "main.ch8 with options \"$options\" differs from flat.ch8"
+    fi
+done
+
+if ! grep -q "^3 files, 3 from the cache," out.txt; then
+    fail "the second run with -C assembled again: $(cat out.txt)"
+fi
+
+write cycle.ch8 "    CLS" "    INCLUDE loop.ch8"
+write loop.ch8 "    INCLUDE cycle.ch8"
+expect 6 cycle.ch8 "cycle.ch8 includes itself"
+
+write lost.ch8 "    CLS" "    INCLUDE gone.ch8"
+expect 6 lost.ch8 "Error opening file gone.ch8 included on line 2 of lost.ch8"
+
+# a file given twice is assembled twice, and the last
+# definition of its label wins
+write twice.ch8 "again:" "    JP again"
+"$asm" twice.ch8 twice.ch8 > out.txt
+
+if [ "$(od -An -tx1 twice | tr -d ' \n')" != 12021202 ]; then
+    fail "twice.ch8 given twice assembled to $(od -An -tx1 twice)"
+fi
+
+expect 4 missing.ch8 "Error opening file missing.ch8"
+expect 3 golden.txt "Unrecognized file type"
+
+if "$asm" > out.txt || ! grep -q "^usage:" out.txt; then
+    fail "no sources did not print the usage"
+fi
+
+exit $failed
@@ -0,0 +1,301 @@
+/************************************
+ * fuzz.c - differential fuzzing of the interpreter
+ *          cores and the batch lanes against the
+ *          switch core
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+#define FUZZ_ROMS 1000
+#define FUZZ_FRAMES 100
+#define FUZZ_MAX_WORDS 256
+#define FUZZ_TAIL_WORDS 8
+#define FUZZ_ROM_SIZE (CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START)
+#define FUZZ_CORES 4
+
+static const char *const names[FUZZ_CORES] = { "switch", "threaded", "block", "jit" };
+
+/**
+ * the second opcode byte of the FX instructions, and of the
+ * 0NNN ones the SUPER-CHIP added
+ */
+static const uint8_t fx[] = { 0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x30, 0x33, 0x55, 0x65, 0x75, 0x85 };
+static const uint8_t sys[] = { 0xE0, 0xEE, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF, 0xC1, 0xC4, 0xCF };
+
+static uint32_t next(uint32_t *seed) {
+    // xorshift32, so a seed names the same ROMs on every host
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+
+    return *seed;
+}
+
+/**
+ * a random program, mostly well-formed instructions with jumps
+ * and calls back into itself, so it loops, stores over its own
+ * code and waits on keys and timers the way real ones do. Now
+ * and then a few more sit at the very end of memory, where some
+ * of the jumps go and from where they run on into address 0
+ */
+static size_t generate(uint32_t *seed, uint8_t *rom) {
+    size_t words = 8 + next(seed) % (FUZZ_MAX_WORDS - 8);
+    size_t tail = next(seed) % 8 == 0 ? 1 + next(seed) % FUZZ_TAIL_WORDS : 0;
+    size_t end = FUZZ_ROM_SIZE / 2;
+
+    memset(rom, 0, FUZZ_ROM_SIZE);
+
+    // the program, then straight on to the tail if there is one
+    for (size_t i = 0; i < end; i = i + 1 == words ? end - tail : i + 1) {
+        uint16_t word = next(seed);
+        uint16_t target = tail > 0 && next(seed) % 4 == 0
+            ? CHIP8_MEMORY_CAPACITY - 2 * tail + next(seed) % (2 * tail)
+            : CHIP8_PROGRAM_START + next(seed) % (words * 2);
+
+        target &= ~(next(seed) % 8 == 0 ? 0 : 1);
+
+        switch (word >> 12) {
+            case 0x0:
+                word = next(seed) % 16 == 0 ? word : 0x0000 | sys[next(seed) % sizeof(sys)];
+                break;
+            case 0x1:
+            case 0x2:
+                word = (word & 0xF000) | target;
+                break;
+            case 0x8:
+                word = (word & 0xFFF0) | (next(seed) % 9 == 8 ? 0xE : next(seed) % 8);
+                break;
+            case 0xB:
+                word = 0xB000 | (target & 0xF00);
+                break;
+            case 0xF:
+                word = (word & 0xFF00) | fx[next(seed) % sizeof(fx)];
+                break;
+        }
+
+        rom[2 * i] = word >> 8;
+        rom[2 * i + 1] = word;
+    }
+
+    return tail > 0 ? FUZZ_ROM_SIZE : words * 2;
+}
+
+/**
+ * the first part of the machine where `vm` differs from
+ * `reference`, or NULL if they are the same throughout
+ */
+static const char *differ(const chip8_vm *vm, const chip8_vm *reference) {
+    if (memcmp(vm->rs1, reference->rs1, sizeof(vm->rs1)) != 0) {
+        return "V registers";
+    }
+
+    if (memcmp(vm->rs2, reference->rs2, sizeof(vm->rs2)) != 0) {
+        return "PC, I, SP or timers";
+    }
+
+    if (memcmp(vm->stack, reference->stack, sizeof(vm->stack)) != 0) {
+        return "stack";
+    }
+
+    if (memcmp(vm->memory, reference->memory, sizeof(vm->memory)) != 0) {
+        return "memory";
+    }
+
+    if (memcmp(vm->display, reference->display, sizeof(vm->display)) != 0) {
+        return "display";
+    }
+
+    if (vm->hires != reference->hires || vm->halted != reference->halted
+            || vm->keys != reference->keys || vm->rng != reference->rng) {
+        return "mode, keypad or RNG";
+    }
+
+    return NULL;
+}
+
+/**
+ * run `rom` on `count` lanes of a batch and, lane by lane, on
+ * machines of the switch core seeded the way the batch seeds its
+ * lanes, with each lane's keypad changing between frames; on a
+ * difference, return the part of the machine and set `frame` and
+ * `lane`
+ */
+static const char *batch_differs(chip8_vm *reference, int count, const uint8_t *rom, size_t size, uint64_t ipf,
+        bool skip_idle, uint32_t *seed, uint64_t *total, int *frame, int *lane) {
+    static chip8_batch batch;
+    uint64_t executed[CHIP8_BATCH_LANES] = { 0 };
+    const char *part = NULL;
+
+    if (!chip8_batch_init(&batch, count)) {
+        return "lanes, which could not be allocated";
+    }
+
+    chip8_batch_load_buffer(&batch, rom, size);
+
+    for (int i = 0; i < count; i++) {
+        chip8_vm_reset(&reference[i]);
+        reference[i].skip_idle = skip_idle;
+        reference[i].rng ^= i * CHIP8_BATCH_SEED;
+        chip8_vm_load_buffer(&reference[i], rom, size);
+    }
+
+    for (int f = 0; f < FUZZ_FRAMES && part == NULL; f++) {
+        bool running = false;
+
+        for (int i = 0; i < count; i++) {
+            if (next(seed) % 3 == 0) {
+                batch.lanes[i].keys = reference[i].keys = next(seed);
+            }
+        }
+
+        chip8_batch_run(&batch, ipf);
+        chip8_batch_tick(&batch);
+        chip8_batch_sync(&batch);
+
+        for (int i = 0; i < count && part == NULL; i++) {
+            executed[i] += chip8_vm_run(&reference[i], ipf);
+            chip8_vm_tick(&reference[i]);
+            running |= !reference[i].halted;
+
+            part = differ(&batch.lanes[i], &reference[i]);
+
+            if (part == NULL && batch.executed[i] != executed[i]) {
+                part = "instructions executed";
+            }
+
+            *frame = f;
+            *lane = i;
+        }
+
+        if (!running) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        *total += executed[i];
+    }
+
+    chip8_batch_free(&batch);
+
+    return part;
+}
+
+int main(int argc, char **argv) {
+    uint32_t seed = 0x2545F491;
+    int roms = FUZZ_ROMS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                roms = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                printf("usage: %s [-n roms] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    static chip8_vm vms[FUZZ_CORES];
+    static chip8_vm lanes[CHIP8_BATCH_LANES];
+    bool available[FUZZ_CORES];
+    uint64_t executed[FUZZ_CORES];
+    uint64_t total = 0, batched = 0;
+
+    if (seed == 0) {
+        seed = 1;
+    }
+
+    for (int c = 0; c < FUZZ_CORES; c++) {
+        chip8_vm_init(&vms[c]);
+        available[c] = chip8_vm_set_core(&vms[c], (chip8_core) c);
+
+        if (!available[c]) {
+            printf("%s core not available, skipped\n", names[c]);
+        }
+    }
+
+    for (int i = 0; i < CHIP8_BATCH_LANES; i++) {
+        chip8_vm_init(&lanes[i]);
+    }
+
+    for (int r = 0; r < roms; r++) {
+        uint8_t rom[FUZZ_ROM_SIZE];
+        uint32_t start = seed;
+        size_t size = generate(&seed, rom);
+
+        // a few instructions a frame cuts blocks short, a lot lets
+        // them run hot enough to be translated
+        uint64_t ipf = next(&seed) % 4 == 0 ? 1 + next(&seed) % 2000 : 1 + next(&seed) % 32;
+        bool skip_idle = next(&seed) % 4 != 0;
+
+        for (int c = 0; c < FUZZ_CORES; c++) {
+            chip8_vm_reset(&vms[c]);
+            vms[c].skip_idle = skip_idle;
+            chip8_vm_load_buffer(&vms[c], rom, size);
+            executed[c] = 0;
+        }
+
+        for (int f = 0; f < FUZZ_FRAMES && !vms[0].halted; f++) {
+            // the keypad changes between frames, the same for every core
+            uint16_t keys = next(&seed) % 3 == 0 ? next(&seed) : vms[0].keys;
+
+            for (int c = 0; c < FUZZ_CORES; c++) {
+                if (!available[c]) {
+                    continue;
+                }
+
+                vms[c].keys = keys;
+                executed[c] += chip8_vm_run(&vms[c], ipf);
+                chip8_vm_tick(&vms[c]);
+
+                const char *part = differ(&vms[c], &vms[0]);
+
+                if (part != NULL || executed[c] != executed[0]) {
+                    printf("rom %d (seed 0x%08x), frame %d: %s core differs from switch in %s\n", r, start, f,
+                        names[c], part != NULL ? part : "instructions executed");
+                    return 1;
+                }
+            }
+        }
+
+        total += executed[0];
+
+        // the batch engine, on anything from a single lane to a full
+        // vector of them, against each lane run on its own
+        int count = 1 + next(&seed) % CHIP8_BATCH_LANES;
+        int frame = 0, lane = 0;
+        const char *part = batch_differs(lanes, count, rom, size, ipf, skip_idle, &seed, &batched, &frame, &lane);
+
+        if (part != NULL) {
+            printf("rom %d (seed 0x%08x), frame %d: lane %d of %d in a batch differs from switch in %s\n", r, start,
+                frame, lane, count, part);
+            return 1;
+        }
+    }
+
+    for (int c = 0; c < FUZZ_CORES; c++) {
+        chip8_vm_free(&vms[c]);
+    }
+
+    for (int i = 0; i < CHIP8_BATCH_LANES; i++) {
+        chip8_vm_free(&lanes[i]);
+    }
+
+    printf("%d ROMs, %llu instructions, %llu more in batches: every core and every lane agrees\n", roms,
+        (unsigned long long) total, (unsigned long long) batched);
+
+    return 0;
+}
@@ -0,0 +1,489 @@
+/************************************
+ * state.c - round trips through saved states and the
+ *           rewind buffer, against whole copies
+ *
+ * Developer: Victor Nwosu
+ ***********************************/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+#define STATE_FRAMES 240
+#define STATE_SAVES 8
+#define STATE_REPLAY 30
+#define STATE_SEEKS 8
+#define STATE_CORES 4
+
+static const char *const names[STATE_CORES] = { "switch", "threaded", "block", "jit" };
+
+/**
+ * the ROMs
+ *
+ * each one an endless loop that leaves the machine different
+ * every frame, written out as instruction words
+ */
+typedef struct {
+    const char *name;
+    const uint16_t *words;
+    size_t count;
+} rom;
+
+// a loop that rewrites the immediate of its own LD V0, so code
+// cached from before a restore is wrong after it
+static const uint16_t selfmod[] = {
+    0xA203, 0x6000, 0x7001, 0xF055, 0xF029, 0xD125, 0x7103, 0x1200,
+};
+
+// block stores and loads of every register through I
+static const uint16_t memory[] = {
+    0xA400, 0xFF55, 0xFF65, 0xA500, 0xFF55, 0xF765, 0xF01E, 0xFF55,
+    0xF033, 0xF265, 0x7001, 0x1200,
+};
+
+// recursion 15 calls deep, unwinding back to the top
+static const uint16_t calls[] = {
+    0x7101, 0x2206, 0x1200, 0x7001, 0x300F, 0x2206, 0x70FF, 0x00EE,
+};
+
+// random delays waited out by polling DT, sprites at random
+// places, and a key read whenever a random key is down
+static const uint16_t timers[] = {
+    0xC10F, 0xE19E, 0x120A, 0xF20A, 0x8124, 0xC03F, 0xF015, 0xF318,
+    0xF029, 0xD015, 0xF307, 0x3300, 0x1214, 0x1200,
+};
+
+// 16x16 sprites and scrolling in high resolution, back to low
+// resolution whenever a random key is down
+static const uint16_t hires[] = {
+    0x00FF, 0xA200, 0xC07F, 0xC13F, 0xD010, 0xC07F, 0xC13F, 0xD01F,
+    0x00C1, 0x00FB, 0x00FC, 0xE09E, 0x1202, 0x00FE, 0x1200,
+};
+
+#define ROM(name, words) { name, words, sizeof(words) / sizeof(words[0]) }
+
+static const rom roms[] = {
+    ROM("selfmod", selfmod),
+    ROM("memory", memory),
+    ROM("calls", calls),
+    ROM("timers", timers),
+    ROM("hires", hires),
+};
+
+#define STATE_ROMS (int) (sizeof(roms) / sizeof(roms[0]))
+
+/**
+ * instructions a frame: one at a time, a few, and enough to
+ * run blocks hot
+ */
+static const uint64_t ipfs[] = { 1, 9, 500 };
+
+#define STATE_IPFS (int) (sizeof(ipfs) / sizeof(ipfs[0]))
+
+/**
+ * one rewind buffer too big to ever fill, on the default
+ * interval, and one so small it drops keyframes every few
+ * frames
+ */
+static const struct {
+    size_t capacity;
+    uint32_t interval;
+} rings[] = {
+    { 4 << 20, CHIP8_REWIND_INTERVAL },
+    { 16 << 10, 8 },
+};
+
+#define STATE_RINGS (int) (sizeof(rings) / sizeof(rings[0]))
+
+static uint32_t next(uint32_t *seed) {
+    // xorshift32, so every host seeks and presses the same
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+
+    return *seed;
+}
+
+/**
+ * everything a program can see of a machine, copied whole
+ */
+typedef struct {
+    uint8_t rs1[CHIP8_GP_REGS];
+    uint16_t rs2[CHIP8_SP_REGS];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint8_t memory[CHIP8_MEMORY_CAPACITY];
+    uint64_t display[CHIP8_HIRES_HEIGHT][CHIP8_DISPLAY_WORDS];
+    uint16_t keys;
+    uint32_t rng;
+    bool hires;
+    bool halted;
+} snapshot;
+
+static void capture(const chip8_vm *vm, snapshot *copy) {
+    memcpy(copy->rs1, vm->rs1, sizeof(copy->rs1));
+    memcpy(copy->rs2, vm->rs2, sizeof(copy->rs2));
+    memcpy(copy->stack, vm->stack, sizeof(copy->stack));
+    memcpy(copy->memory, vm->memory, sizeof(copy->memory));
+    memcpy(copy->display, vm->display, sizeof(copy->display));
+    copy->keys = vm->keys;
+    copy->rng = vm->rng;
+    copy->hires = vm->hires;
+    copy->halted = vm->halted;
+}
+
+/**
+ * the first part of the machine where `vm` differs from
+ * `copy`, or NULL if they are the same throughout
+ */
+static const char *differ(const chip8_vm *vm, const snapshot *copy) {
+    if (memcmp(vm->rs1, copy->rs1, sizeof(vm->rs1)) != 0) {
+        return "V registers";
+    }
+
+    if (memcmp(vm->rs2, copy->rs2, sizeof(vm->rs2)) != 0) {
+        return "PC, I, SP or timers";
+    }
+
+    if (memcmp(vm->stack, copy->stack, sizeof(vm->stack)) != 0) {
+        return "stack";
+    }
+
+    if (memcmp(vm->memory, copy->memory, sizeof(vm->memory)) != 0) {
+        return "memory";
+    }
+
+    if (memcmp(vm->display, copy->display, sizeof(vm->display)) != 0) {
+        return "display";
+    }
+
+    if (vm->hires != copy->hires || vm->halted != copy->halted || vm->keys != copy->keys || vm->rng != copy->rng) {
+        return "mode, keypad or RNG";
+    }
+
+    return NULL;
+}
+
+/**
+ * a run of a program, frame by frame: the keypad it was given
+ * and the whole machine after each frame, frame 0 being the
+ * program as loaded
+ */
+typedef struct {
+    uint64_t ipf;
+    uint16_t keys[STATE_FRAMES + 1];
+    snapshot frames[STATE_FRAMES + 1];
+} history;
+
+static void step(chip8_vm *vm, const history *run, int frame) {
+    vm->keys = run->keys[frame];
+    chip8_vm_run(vm, run->ipf);
+    chip8_vm_tick(vm);
+}
+
+/**
+ * run `vm` on from `frame` for up to `frames` more, pushing
+ * each into `rewind` if there is one; on a difference from the
+ * history, return the part of the machine and set `frame`
+ */
+static const char *replay(chip8_vm *vm, const history *run, chip8_rewind *rewind, int *frame, int frames) {
+    for (int end = *frame + frames; *frame < end && *frame < STATE_FRAMES;) {
+        step(vm, run, ++*frame);
+
+        if (rewind != NULL && !chip8_rewind_push(rewind, vm)) {
+            return "a frame that does not fit the rewind buffer";
+        }
+
+        const char *part = differ(vm, &run->frames[*frame]);
+
+        if (part != NULL) {
+            return part;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * step back through `rewind`, which holds the run up to its
+ * last frame, replaying a little after each seek so the frames
+ * pushed then are the next ones stepped back through; on a
+ * difference, return it and set `frame`
+ */
+static const char *seek_back(chip8_vm *vm, const history *run, chip8_rewind *rewind, uint32_t *seed, int *frame) {
+    int newest = STATE_FRAMES;
+    chip8_rewind_stats stats;
+
+    for (int s = 0; s <= STATE_SEEKS; s++) {
+        chip8_rewind_measure(rewind, &stats);
+
+        // the last time all the way back to the oldest frame held
+        uint64_t back = s == STATE_SEEKS ? stats.frames - 1 : next(seed) % stats.frames;
+
+        if (chip8_rewind_seek(rewind, vm, stats.frames) || !chip8_rewind_seek(rewind, vm, back)) {
+            *frame = newest;
+            return "the frames held";
+        }
+
+        *frame = newest -= back;
+
+        const char *part = differ(vm, &run->frames[newest]);
+
+        if (part != NULL) {
+            return part;
+        }
+
+        if (s < STATE_SEEKS && (part = replay(vm, run, rewind, frame, next(seed) % STATE_REPLAY)) != NULL) {
+            return part;
+        }
+
+        newest = *frame;
+    }
+
+    return NULL;
+}
+
+/**
+ * restore each saved state, into the machine that saved it or
+ * into one that has never run the program, and run on from
+ * there; fork each one, run the fork on and save over it, and
+ * check the state it came from is untouched; and write each one
+ * out and read it back. On a difference, return it and set
+ * `frame`
+ */
+static const char *restore(chip8_vm *vm, chip8_vm *other, const history *run, chip8_state *states, uint32_t *seed,
+        int *frame) {
+    static snapshot saved;
+    const char *part;
+
+    for (int k = 0; k < STATE_SAVES; k++) {
+        int at = k * STATE_FRAMES / STATE_SAVES;
+        chip8_vm *target = next(seed) % 2 ? vm : other;
+
+        *frame = at;
+        chip8_vm_restore(target, &states[k]);
+
+        if ((part = differ(target, &run->frames[at])) != NULL) {
+            return part;
+        }
+
+        if ((part = replay(target, run, NULL, frame, STATE_REPLAY)) != NULL) {
+            return part;
+        }
+
+        // a fork stores to memory it shares with the state, then
+        // is saved over; only the fork may change
+        chip8_state fork;
+
+        chip8_state_fork(&states[k], &fork);
+        chip8_vm_restore(vm, &fork);
+        *frame = at;
+
+        if ((part = replay(vm, run, NULL, frame, 1 + next(seed) % STATE_REPLAY)) != NULL) {
+            chip8_state_release(&fork);
+            return part;
+        }
+
+        capture(vm, &saved);
+
+        if (!chip8_vm_save(vm, &fork)) {
+            chip8_state_release(&fork);
+            return "the fork, which could not be saved";
+        }
+
+        chip8_vm_restore(other, &states[k]);
+        part = differ(other, &run->frames[at]);
+
+        if (part == NULL) {
+            chip8_vm_restore(other, &fork);
+            part = differ(other, &saved);
+        }
+
+        chip8_state_release(&fork);
+
+        if (part != NULL) {
+            return part;
+        }
+
+        // and through a file
+        chip8_state read = { 0 };
+        FILE *file = tmpfile();
+        bool ok = file != NULL && chip8_state_write(&states[k], file);
+
+        if (ok) {
+            rewind(file);
+            ok = chip8_state_read(&read, file);
+        }
+
+        if (file != NULL) {
+            fclose(file);
+        }
+
+        *frame = at;
+
+        if (!ok) {
+            return "the state written out";
+        }
+
+        chip8_vm_restore(target, &read);
+        part = differ(target, &run->frames[at]);
+        chip8_state_release(&read);
+
+        if (part != NULL) {
+            return part;
+        }
+    }
+
+    return NULL;
+}
+
+int main(void) {
+    static chip8_vm vm, other;
+    static history run;
+    chip8_rewind rewinds[STATE_RINGS];
+    chip8_state states[STATE_SAVES] = { 0 };
+    uint64_t dropped = 0, seeks = 0, restores = 0;
+    uint32_t seed = 0x2545F491;
+
+    chip8_vm_init(&vm);
+    chip8_vm_init(&other);
+
+    for (int i = 0; i < STATE_RINGS; i++) {
+        if (!chip8_rewind_init(&rewinds[i], rings[i].capacity, rings[i].interval)) {
+            printf("Out of memory\n");
+            return 1;
+        }
+    }
+
+    {
+        chip8_state empty = { 0 };
+        FILE *file = tmpfile();
+
+        if (file == NULL || chip8_state_write(&empty, file)) {
+            printf("a state never saved into was written out\n");
+            return 1;
+        }
+
+        fclose(file);
+    }
+
+    // every ROM at every rate, with and without idle loops skipped
+    for (int t = 0; t < STATE_ROMS * STATE_IPFS * 2; t++) {
+        const rom *r = &roms[t / (STATE_IPFS * 2)];
+        uint8_t program[CHIP8_MEMORY_CAPACITY - CHIP8_PROGRAM_START];
+        bool skip_idle = t % 2;
+
+        for (size_t i = 0; i < r->count; i++) {
+            program[2 * i] = r->words[i] >> 8;
+            program[2 * i + 1] = r->words[i] & 0xFF;
+        }
+
+        run.ipf = ipfs[t / 2 % STATE_IPFS];
+
+        // the keypad changes every few frames, and is often let go
+        for (int f = 0; f <= STATE_FRAMES; f++) {
+            uint16_t keys = next(&seed) % 3 == 0 ? 0 : next(&seed);
+
+            run.keys[f] = f == 0 || next(&seed) % 4 == 0 ? keys : run.keys[f - 1];
+        }
+
+        for (int c = 0; c < STATE_CORES; c++) {
+            if (!chip8_vm_set_core(&vm, (chip8_core) c) || !chip8_vm_set_core(&other, (chip8_core) c)) {
+                if (t == 0) {
+                    printf("%s core not available, skipped\n", names[c]);
+                }
+
+                continue;
+            }
+
+            chip8_vm_reset(&vm);
+            chip8_vm_reset(&other);
+            vm.skip_idle = other.skip_idle = skip_idle;
+            chip8_vm_load_buffer(&vm, program, 2 * r->count);
+
+            for (int i = 0; i < STATE_RINGS; i++) {
+                chip8_rewind_free(&rewinds[i]);
+
+                if (!chip8_rewind_init(&rewinds[i], rings[i].capacity, rings[i].interval)) {
+                    printf("Out of memory\n");
+                    return 1;
+                }
+            }
+
+            // the run itself, copied whole, saved every so often and
+            // pushed into every rewind buffer
+            for (int f = 0; f <= STATE_FRAMES; f++) {
+                if (f > 0) {
+                    step(&vm, &run, f);
+                }
+
+                capture(&vm, &run.frames[f]);
+
+                if (f % (STATE_FRAMES / STATE_SAVES) == 0 && f < STATE_FRAMES
+                        && !chip8_vm_save(&vm, &states[f / (STATE_FRAMES / STATE_SAVES)])) {
+                    printf("Out of memory\n");
+                    return 1;
+                }
+
+                for (int i = 0; i < STATE_RINGS; i++) {
+                    if (!chip8_rewind_push(&rewinds[i], &vm)) {
+                        printf("%s, %llu a frame: frame %d does not fit %zu bytes\n", r->name,
+                            (unsigned long long) run.ipf, f, rings[i].capacity);
+                        return 1;
+                    }
+                }
+            }
+
+            const char *part = NULL;
+            int frame = 0;
+
+            for (int i = 0; i < STATE_RINGS && part == NULL; i++) {
+                chip8_rewind_stats stats;
+
+                chip8_rewind_measure(&rewinds[i], &stats);
+                dropped += STATE_FRAMES + 1 - stats.frames;
+                part = seek_back(&vm, &run, &rewinds[i], &seed, &frame);
+
+                if (part != NULL) {
+                    printf("%s, %llu a frame, frame %d: %s core differs after rewinding %zu bytes in %s\n",
+                        r->name, (unsigned long long) run.ipf, frame, names[c], rings[i].capacity, part);
+                    return 1;
+                }
+            }
+
+            seeks += STATE_RINGS * (STATE_SEEKS + 1);
+
+            if ((part = restore(&vm, &other, &run, states, &seed, &frame)) != NULL) {
+                printf("%s, %llu a frame, frame %d: %s core differs after restoring a state in %s\n", r->name,
+                    (unsigned long long) run.ipf, frame, names[c], part);
+                return 1;
+            }
+
+            restores += STATE_SAVES;
+        }
+    }
+
+    for (int k = 0; k < STATE_SAVES; k++) {
+        chip8_state_release(&states[k]);
+    }
+
+    for (int i = 0; i < STATE_RINGS; i++) {
+        chip8_rewind_free(&rewinds[i]);
+    }
+
+    chip8_vm_free(&vm);
+    chip8_vm_free(&other);
+
+    // the small buffer must have wrapped, or dropping was not tested
+    if (dropped == 0) {
+        printf("no rewind buffer ever dropped a frame\n");
+        return 1;
+    }
+
+    printf("%d ROMs, %llu seeks, %llu states restored, %llu frames dropped: every one matches its copy\n", STATE_ROMS,
+        (unsigned long long) seeks, (unsigned long long) restores, (unsigned long long) dropped);
+
+    return 0;
+}